@@ -2,6 +2,8 @@
 
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
+#include "utils.h"
 
 void count_cum_freqs(struct symbol *table, size_t symbols)
 {
@@ -42,27 +44,25 @@ void ac_init(struct ac *ac)
 
 #define put_bit(bio, b) bio_write_bits((bio), (b), 1)
 #define get_bit(bio) bio_read_bits((bio), 1)
+/* the bit followed by the pending (inverted) bits, in a single call */
+#define put_bits_pending(bio, b, n) bio_write_pending((bio), (b), (n))
 
 void ac_encode_scale(struct ac *ac, struct bio *bio)
 {
 	// E1/E2
 	while ((ac->mHigh < g_Half) || (ac->mLow >= g_Half)) {
 		if (ac->mHigh < g_Half) {
-			put_bit(bio, 0);
+			put_bits_pending(bio, 0, ac->mScale);
 			ac->mLow  = 2 * ac->mLow;
 			ac->mHigh = 2 * ac->mHigh + 1;
 
-			for (; ac->mScale > 0; ac->mScale--) {
-				put_bit(bio, 1);
-			}
+			ac->mScale = 0;
 		} else if (ac->mLow >= g_Half) {
-			put_bit(bio, 1);
+			put_bits_pending(bio, 1, ac->mScale);
 			ac->mLow  = 2 * (ac->mLow  - g_Half);
 			ac->mHigh = 2 * (ac->mHigh - g_Half) + 1;
 
-			for (; ac->mScale > 0; ac->mScale--) {
-				put_bit(bio, 0);
-			}
+			ac->mScale = 0;
 		}
 	}
 
@@ -115,11 +115,7 @@ float ac_encode_symbol_query_prob(size_t symb, struct symbol *model, size_t symb
 void ac_encode_flush(struct ac *ac, struct bio *bio)
 {
 	if (ac->mLow < g_FirstQuarter) {
-		put_bit(bio, 0);
-
-		for (size_t i=0; i < ac->mScale + 1; i++) {
-			put_bit(bio, 1);
-		}
+		put_bits_pending(bio, 0, ac->mScale + 1);
 	} else {
 		put_bit(bio, 1);
 	}
@@ -175,11 +171,16 @@ size_t index_of_value(size_t value, struct symbol *model, size_t symbols)
 		}
 	}
 
-	abort();
+	corrupted();
 }
 
 size_t ac_decode_symbol(struct ac *ac, struct bio *bio, struct symbol *model, size_t symbols, size_t total)
 {
+	/* an empty model or a collapsed range, only in a corrupted stream */
+	if (total == 0 || ac->mHigh - ac->mLow + 1 < total) {
+		corrupted();
+	}
+
 	size_t mStep = (ac->mHigh - ac->mLow + 1) / total;
 
 	size_t value = ac_decode_target(ac, mStep);
@@ -197,6 +198,40 @@ size_t ac_decode_symbol(struct ac *ac, struct bio *bio, struct symbol *model, si
 	return model[index].symb;
 }
 
+void ac_encode_bits(struct ac *ac, struct bio *bio, size_t value, size_t bits)
+{
+	assert(bits <= 16 && value < ((size_t)1 << bits));
+
+	ac_encode(ac, bio, value, value + 1, (size_t)1 << bits);
+}
+
+size_t ac_decode_bits(struct ac *ac, struct bio *bio, size_t bits)
+{
+	size_t total = (size_t)1 << bits;
+
+	assert(bits <= 16);
+
+	/* a collapsed range, only in a corrupted stream */
+	if (ac->mHigh - ac->mLow + 1 < total) {
+		corrupted();
+	}
+
+	size_t mStep = (ac->mHigh - ac->mLow + 1) / total;
+
+	size_t value = ac_decode_target(ac, mStep);
+
+	if (value >= total) {
+		corrupted();
+	}
+
+	ac->mHigh = ac->mLow + mStep * (value + 1) - 1;
+	ac->mLow  = ac->mLow + mStep * value;
+
+	ac_decode_scale(ac, bio);
+
+	return value;
+}
+
 void ac_encode_symbol_model(struct ac *ac, struct bio *bio, size_t symb, struct model *model)
 {
 	ac_encode_symbol(ac, bio, symb, model->table, model->count, model->total);
@@ -232,6 +267,7 @@ void model_create(struct model *model, size_t size)
 	assert(model != NULL);
 
 	model->count = size;
+	model->capacity = size;
 	model->table = malloc(model->count * sizeof(struct symbol));
 
 	if (model->table == NULL) {
@@ -252,10 +288,14 @@ void model_enlarge(struct model *model)
 	assert(model != NULL);
 
 	model->count++;
-	model->table = realloc(model->table, model->count * sizeof(struct symbol));
 
-	if (model->table == NULL) {
-		abort();
+	if (model->count > model->capacity) {
+		model->capacity = 2 * model->count;
+		model->table = realloc(model->table, model->capacity * sizeof(struct symbol));
+
+		if (model->table == NULL) {
+			abort();
+		}
 	}
 
 	model->table[model->count - 1].symb = model->count - 1;
@@ -265,9 +305,98 @@ void model_enlarge(struct model *model)
 	model->total = calc_total_freq(model->table, model->count);
 }
 
+void model_preallocate(struct model *model, size_t capacity)
+{
+	assert(model != NULL);
+
+	if (capacity > model->capacity) {
+		model->table = realloc(model->table, capacity * sizeof(struct symbol));
+
+		if (model->table == NULL) {
+			abort();
+		}
+
+		model->capacity = capacity;
+	}
+}
+
 void model_destroy(struct model *model)
 {
 	assert(model != NULL);
 
 	free(model->table);
+
+	model->table = NULL;
+	model->capacity = 0;
+}
+
+void model_reset(struct model *model, size_t size)
+{
+	assert(model != NULL);
+
+	if (size > model->capacity) {
+		model->table = realloc(model->table, size * sizeof(struct symbol));
+
+		if (model->table == NULL) {
+			abort();
+		}
+
+		model->capacity = size;
+	}
+
+	model->count = size;
+
+	for (size_t i = 0; i < model->count; ++i) {
+		model->table[i].symb = i;
+		model->table[i].freq = 1;
+	}
+
+	count_cum_freqs(model->table, model->count);
+	model->total = calc_total_freq(model->table, model->count);
+}
+
+void model_save(struct snapshot *s, const struct model *model)
+{
+	snapshot_put(s, model->count);
+
+	for (size_t i = 0; i < model->count; ++i) {
+		snapshot_put(s, model->table[i].symb);
+		snapshot_put(s, model->table[i].freq);
+	}
+}
+
+void model_load(struct snapshot *s, struct model *model)
+{
+	/* each symbol takes at least 2 bytes */
+	model_create(model, snapshot_get_size(s, s->size / 2));
+
+	for (size_t i = 0; i < model->count; ++i) {
+		model->table[i].symb = (size_t)snapshot_get(s);
+		model->table[i].freq = (size_t)snapshot_get(s);
+	}
+
+	count_cum_freqs(model->table, model->count);
+	model->total = calc_total_freq(model->table, model->count);
+}
+
+void model_copy(struct model *model, const struct model *that)
+{
+	assert(model != NULL && that != NULL);
+
+	if (that->count > model->capacity) {
+		model->table = realloc(model->table, that->count * sizeof(struct symbol));
+
+		if (model->table == NULL) {
+			abort();
+		}
+
+		model->capacity = that->count;
+	}
+
+	model->count = that->count;
+	model->total = that->total;
+
+	if (that->count > 0) {
+		memcpy(model->table, that->table, that->count * sizeof(struct symbol));
+	}
 }
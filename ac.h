@@ -4,6 +4,7 @@
 #include <stddef.h>
 
 #include "bio.h"
+#include "snapshot.h"
 
 struct symbol {
 	size_t symb;
@@ -31,10 +32,15 @@ void ac_encode_flush(struct ac *ac, struct bio *bio);
 void ac_decode_init(struct ac *ac, struct bio *bio);
 size_t ac_decode_symbol(struct ac *ac, struct bio *bio, struct symbol *model, size_t symbols, size_t total);
 
+/* the value of (at most 16) equiprobable bits, without a model */
+void ac_encode_bits(struct ac *ac, struct bio *bio, size_t value, size_t bits);
+size_t ac_decode_bits(struct ac *ac, struct bio *bio, size_t bits);
+
 struct model {
 	size_t count;
 	size_t total;
 	struct symbol *table; /* count entries */
+	size_t capacity; /* allocated entries */
 };
 
 void ac_encode_symbol_model(struct ac *ac, struct bio *bio, size_t symb, struct model *model);
@@ -44,6 +50,21 @@ void inc_model(struct model *model, size_t symbol);
 
 void model_create(struct model *model, size_t size);
 void model_enlarge(struct model *model);
+
+/* allocates the table for capacity symbols up front */
+void model_preallocate(struct model *model, size_t capacity);
+
 void model_destroy(struct model *model);
 
+/* same as model_create(), but the table of the model is reused (the model is empty or destroyed initially) */
+void model_reset(struct model *model, size_t size);
+
+void model_save(struct snapshot *s, const struct model *model);
+
+/* the model is created from the snapshot */
+void model_load(struct snapshot *s, struct model *model);
+
+/* the model becomes a copy of that, the table is reallocated only when it does not fit */
+void model_copy(struct model *model, const struct model *that);
+
 #endif /* AC_H */
@@ -0,0 +1,243 @@
+#define _POSIX_C_SOURCE 200809L
+#include "async.h"
+#include <stdlib.h>
+#include <string.h>
+
+static size_t minsize(size_t a, size_t b)
+{
+	return a < b ? a : b;
+}
+
+static void async_init(struct async *a, FILE *stream, size_t chunk)
+{
+	a->stream = stream;
+	a->chunk = chunk;
+	a->count = 0;
+	a->head = 0;
+	a->pos = 0;
+	a->eof = 0;
+	a->stop = 0;
+
+	for (int i = 0; i < ASYNC_BUFFERS; ++i) {
+		a->buffer[i] = malloc(chunk);
+		a->size[i] = 0;
+
+		if (a->buffer[i] == NULL) {
+			abort();
+		}
+	}
+
+	if (pthread_mutex_init(&a->mutex, NULL) || pthread_cond_init(&a->cond, NULL)) {
+		abort();
+	}
+}
+
+static void async_start(struct async *a, void *(*thread)(void *))
+{
+	if (pthread_create(&a->thread, NULL, thread, a)) {
+		fprintf(stderr, "Cannot create thread\n");
+		abort();
+	}
+}
+
+static void async_destroy(struct async *a)
+{
+	pthread_join(a->thread, NULL);
+
+	for (int i = 0; i < ASYNC_BUFFERS; ++i) {
+		free(a->buffer[i]);
+	}
+
+	pthread_cond_destroy(&a->cond);
+	pthread_mutex_destroy(&a->mutex);
+}
+
+static void *async_reader_thread(void *p)
+{
+	struct async *a = p;
+
+	for (size_t tail = 0; ; tail = (tail + 1) % ASYNC_BUFFERS) {
+		pthread_mutex_lock(&a->mutex);
+		while (a->count == ASYNC_BUFFERS && !a->stop) {
+			pthread_cond_wait(&a->cond, &a->mutex);
+		}
+		int stop = a->stop;
+		pthread_mutex_unlock(&a->mutex);
+
+		if (stop) {
+			break;
+		}
+
+		/* the buffer is not used by the caller */
+		size_t n = fread(a->buffer[tail], 1, a->chunk, a->stream);
+
+		if (n < a->chunk && ferror(a->stream)) {
+			fprintf(stderr, "Read error\n");
+			abort();
+		}
+
+		pthread_mutex_lock(&a->mutex);
+		a->size[tail] = n;
+		a->count++;
+		if (n < a->chunk) {
+			a->eof = 1;
+		}
+		pthread_cond_broadcast(&a->cond);
+		pthread_mutex_unlock(&a->mutex);
+
+		if (n < a->chunk) {
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+void async_reader_open(struct async *a, FILE *stream, size_t chunk)
+{
+	async_init(a, stream, chunk);
+	async_start(a, async_reader_thread);
+}
+
+size_t async_load_partial(struct async *a, void *ptr, size_t size)
+{
+	size_t done = 0;
+
+	while (done < size) {
+		pthread_mutex_lock(&a->mutex);
+		while (a->count == 0 && !a->eof) {
+			pthread_cond_wait(&a->cond, &a->mutex);
+		}
+		size_t count = a->count;
+		pthread_mutex_unlock(&a->mutex);
+
+		if (count == 0) {
+			break;
+		}
+
+		size_t n = minsize(a->size[a->head] - a->pos, size - done);
+
+		memcpy((unsigned char *)ptr + done, a->buffer[a->head] + a->pos, n);
+
+		a->pos += n;
+		done += n;
+
+		/* hand the buffer back to the thread */
+		if (a->pos == a->size[a->head]) {
+			pthread_mutex_lock(&a->mutex);
+			a->count--;
+			pthread_cond_broadcast(&a->cond);
+			pthread_mutex_unlock(&a->mutex);
+
+			a->head = (a->head + 1) % ASYNC_BUFFERS;
+			a->pos = 0;
+		}
+	}
+
+	return done;
+}
+
+void async_load(struct async *a, void *ptr, size_t size)
+{
+	if (async_load_partial(a, ptr, size) < size) {
+		abort();
+	}
+}
+
+void async_reader_close(struct async *a)
+{
+	pthread_mutex_lock(&a->mutex);
+	a->stop = 1;
+	pthread_cond_broadcast(&a->cond);
+	pthread_mutex_unlock(&a->mutex);
+
+	async_destroy(a);
+}
+
+static void *async_writer_thread(void *p)
+{
+	struct async *a = p;
+
+	for (size_t tail = 0; ; tail = (tail + 1) % ASYNC_BUFFERS) {
+		pthread_mutex_lock(&a->mutex);
+		while (a->count == 0 && !a->eof) {
+			pthread_cond_wait(&a->cond, &a->mutex);
+		}
+		size_t count = a->count;
+		pthread_mutex_unlock(&a->mutex);
+
+		if (count == 0) {
+			break;
+		}
+
+		if (fwrite(a->buffer[tail], 1, a->size[tail], a->stream) < a->size[tail]) {
+			fprintf(stderr, "Write error\n");
+			abort();
+		}
+
+		pthread_mutex_lock(&a->mutex);
+		a->count--;
+		pthread_cond_broadcast(&a->cond);
+		pthread_mutex_unlock(&a->mutex);
+	}
+
+	return NULL;
+}
+
+void async_writer_open(struct async *a, FILE *stream, size_t chunk)
+{
+	async_init(a, stream, chunk);
+	async_start(a, async_writer_thread);
+}
+
+/* pass the buffer of the caller to the thread, and wait for a free one */
+static void async_submit(struct async *a)
+{
+	pthread_mutex_lock(&a->mutex);
+	a->size[a->head] = a->pos;
+	a->count++;
+	pthread_cond_broadcast(&a->cond);
+	while (a->count == ASYNC_BUFFERS) {
+		pthread_cond_wait(&a->cond, &a->mutex);
+	}
+	pthread_mutex_unlock(&a->mutex);
+
+	a->head = (a->head + 1) % ASYNC_BUFFERS;
+	a->pos = 0;
+}
+
+void async_save(struct async *a, const void *ptr, size_t size)
+{
+	while (size > 0) {
+		size_t n = minsize(a->chunk - a->pos, size);
+
+		memcpy(a->buffer[a->head] + a->pos, ptr, n);
+
+		a->pos += n;
+		ptr = (const unsigned char *)ptr + n;
+		size -= n;
+
+		if (a->pos == a->chunk) {
+			async_submit(a);
+		}
+	}
+}
+
+void async_writer_close(struct async *a)
+{
+	if (a->pos > 0) {
+		async_submit(a);
+	}
+
+	pthread_mutex_lock(&a->mutex);
+	a->eof = 1;
+	pthread_cond_broadcast(&a->cond);
+	pthread_mutex_unlock(&a->mutex);
+
+	async_destroy(a);
+
+	if (fflush(a->stream)) {
+		fprintf(stderr, "Write error\n");
+		abort();
+	}
+}
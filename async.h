@@ -0,0 +1,49 @@
+/*
+ * Reading and writing on a background thread
+ */
+#ifndef ASYNC_H
+#define ASYNC_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <pthread.h>
+
+/* the number of buffers, the caller works on one of them while the thread reads or writes the others */
+#define ASYNC_BUFFERS 3
+
+struct async {
+	FILE *stream;
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	unsigned char *buffer[ASYNC_BUFFERS];
+	size_t size[ASYNC_BUFFERS]; /* of the data in the buffer */
+	size_t chunk; /* capacity of each buffer */
+	size_t count; /* full buffers (read ahead, or waiting to be written) */
+	size_t head;  /* the buffer of the caller */
+	size_t pos;   /* in the buffer of the caller */
+	int eof;      /* the reader reached the end of file, or the writer has been closed */
+	int stop;     /* the reader has been closed */
+};
+
+/* start reading the stream ahead in chunks */
+void async_reader_open(struct async *a, FILE *stream, size_t chunk);
+
+/* same as fload, the data come from the buffers filled by the thread */
+void async_load(struct async *a, void *ptr, size_t size);
+
+/* same as fload_partial */
+size_t async_load_partial(struct async *a, void *ptr, size_t size);
+
+/* stop the thread, the data read ahead are lost */
+void async_reader_close(struct async *a);
+
+void async_writer_open(struct async *a, FILE *stream, size_t chunk);
+
+/* same as fsave, the full chunks are written by the thread */
+void async_save(struct async *a, const void *ptr, size_t size);
+
+/* write the rest and wait for the thread, the stream can be used again afterwards */
+void async_writer_close(struct async *a);
+
+#endif /* ASYNC_H */
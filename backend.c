@@ -1,11 +1,25 @@
+#define _POSIX_C_SOURCE 200809L
 #include "backend.h"
 #include <assert.h>
 #include <string.h>
+#include <stdint.h>
+#include <pthread.h>
 
 #include "dict.h"
+#include "utils.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#	include <immintrin.h>
+#	define BACKEND_X86
+#endif
+
+/*
+ * The parameters of the parser are per thread, as the coders running at once may parse
+ * the streams of different parameters (the threads start with the defaults, see set_backend_params()).
+ */
 
 /* search buffer */
-static size_t g_forward_window = 8 * 1024;
+static THREAD_LOCAL size_t g_forward_window = 8 * 1024;
 
 void set_forward_window(size_t n)
 {
@@ -18,7 +32,7 @@ size_t get_forward_window()
 }
 
 /* found empirically */
-static int g_max_match_count = 15;
+static THREAD_LOCAL int g_max_match_count = 15;
 
 void set_max_match_count(int n)
 {
@@ -30,8 +44,8 @@ int get_max_match_count()
 	return g_max_match_count;
 }
 
-static size_t g_factor1 = 4;
-static size_t g_factor2 = 0;
+static THREAD_LOCAL size_t g_factor1 = 4;
+static THREAD_LOCAL size_t g_factor2 = 0;
 
 size_t get_magic_factor1()
 {
@@ -53,17 +67,29 @@ void set_magic_factor2(size_t factor)
 	g_factor2 = factor;
 }
 
-size_t find_best_match(char *p)
+void get_backend_params(struct backend_params *params)
 {
-	size_t count[MAX_MATCH_LEN];
-
-	char *end = p + g_forward_window;
+	params->forward_window = g_forward_window;
+	params->max_match_count = g_max_match_count;
+	params->factor1 = g_factor1;
+	params->factor2 = g_factor2;
+}
 
-	for (int i = 0; i < MAX_MATCH_LEN; ++i) {
-		count[i] = 0;
-	}
+void set_backend_params(const struct backend_params *params)
+{
+	g_forward_window = params->forward_window;
+	g_max_match_count = params->max_match_count;
+	g_factor1 = params->factor1;
+	g_factor2 = params->factor2;
+}
 
-	for (char *s = p + 1; s < end - MAX_MATCH_LEN; ++s) {
+/*
+ * For each position s in [begin, end), count[i] is incremented if the strings at p and s share the first i + 1 characters.
+ * At least MAX_MATCH_LEN - 1 characters past the end must be readable.
+ */
+static void scan_window_sw(const char *p, const char *begin, const char *end, size_t count[MAX_MATCH_LEN])
+{
+	for (const char *s = begin; s < end; ++s) {
 		for (int i = 0; i < MAX_MATCH_LEN; ++i) {
 			if (p[i] == s[i]) {
 				count[i]++;
@@ -72,6 +98,107 @@ size_t find_best_match(char *p)
 			}
 		}
 	}
+}
+
+#ifdef BACKEND_X86
+/*
+ * The positions are processed in groups, a bit of the mask per position.
+ * The i-th pass keeps the positions that also match p[i], until none is left.
+ */
+__attribute__((target("avx2,popcnt")))
+static void scan_window_avx2(const char *p, const char *begin, const char *end, size_t count[MAX_MATCH_LEN])
+{
+	const char *s = begin;
+
+	for (; end - s >= 32; s += 32) {
+		uint32_t alive = UINT32_MAX;
+
+		for (int i = 0; i < MAX_MATCH_LEN && alive != 0; ++i) {
+			__m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+
+			alive &= (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(p[i])));
+			count[i] += (size_t)_mm_popcnt_u32(alive);
+		}
+	}
+
+	scan_window_sw(p, s, end, count);
+}
+
+__attribute__((target("avx512f,avx512bw,popcnt")))
+static void scan_window_avx512(const char *p, const char *begin, const char *end, size_t count[MAX_MATCH_LEN])
+{
+	const char *s = begin;
+
+	for (; end - s >= 64; s += 64) {
+		uint64_t alive = UINT64_MAX;
+
+		for (int i = 0; i < MAX_MATCH_LEN && alive != 0; ++i) {
+			__m512i v = _mm512_loadu_si512((const void *)(s + i));
+
+			alive &= (uint64_t)_mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8(p[i]));
+			count[i] += (size_t)_mm_popcnt_u64(alive);
+		}
+	}
+
+	scan_window_avx2(p, s, end, count);
+}
+#endif
+
+/* the scalar kernel until backend_init() */
+static void (*scan_window)(const char *p, const char *begin, const char *end, size_t count[MAX_MATCH_LEN]) = scan_window_sw;
+
+static const char *isa = "scalar";
+
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+/* the best variant of the kernels for this processor */
+static void init()
+{
+	dict_init();
+
+#ifdef BACKEND_X86
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+		scan_window = scan_window_avx2;
+		isa = "avx2";
+	}
+
+	if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("popcnt")) {
+		scan_window = scan_window_avx512;
+		isa = "avx512";
+	}
+#endif
+}
+
+void backend_init()
+{
+	pthread_once(&once, init);
+}
+
+const char *get_isa()
+{
+	return isa;
+}
+
+size_t get_forward_padding()
+{
+	return g_forward_window + MAX_MATCH_LEN;
+}
+
+size_t find_best_match(char *p)
+{
+	size_t count[MAX_MATCH_LEN];
+
+	char *end = p + g_forward_window;
+
+	for (int i = 0; i < MAX_MATCH_LEN; ++i) {
+		count[i] = 0;
+	}
+
+	if (p + 1 < end - MAX_MATCH_LEN) {
+		scan_window(p, p + 1, end - MAX_MATCH_LEN, count);
+	}
 
 	for (int tc = g_max_match_count; tc > 0; --tc) {
 		for (int i = MAX_MATCH_LEN - 1; i >= 0; --i) {
@@ -19,9 +19,18 @@
  */
 size_t find_best_match(char *p);
 
+/* selects the kernels for this processor (and those of the dictionary), before the threads start; until then the scalar ones are used */
+void backend_init();
+
+/* the instruction set of the kernels selected for this processor ("scalar", "avx2", or "avx512") */
+const char *get_isa();
+
 void set_forward_window(size_t n);
 size_t get_forward_window();
 
+/* the readable bytes past the end of the input (the zero padding): the forward window, and MAX_MATCH_LEN for the kernels loading the whole string */
+size_t get_forward_padding();
+
 void set_max_match_count(int n);
 int get_max_match_count();
 
@@ -30,4 +39,15 @@ void set_magic_factor1(size_t factor);
 size_t get_magic_factor2();
 void set_magic_factor2(size_t factor);
 
+/* the parameters above, they are per thread and are handed over to the threads of the coders */
+struct backend_params {
+	size_t forward_window;
+	int max_match_count;
+	size_t factor1;
+	size_t factor2;
+};
+
+void get_backend_params(struct backend_params *params);
+void set_backend_params(const struct backend_params *params);
+
 #endif /* BACKEND_H */
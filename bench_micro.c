@@ -0,0 +1,602 @@
+/*
+ * Microbenchmarks of the hot paths of the coder, each kernel in isolation
+ *
+ * The kernels run on the synthetic data (ALPHABET symbols, repeated fragments) or on the given file.
+ * Each kernel is repeated until it runs for at least MIN_TIME, the best of RUNS is reported.
+ */
+#define _POSIX_C_SOURCE 2
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "backend.h"
+#include "dict.h"
+#include "tag_pair.h"
+#include "context.h"
+#include "ac.h"
+#include "bio.h"
+#include "file.h"
+#include "utils.h"
+
+/* in nanoseconds */
+#define MIN_TIME 100000000L
+
+#define RUNS 3
+
+/* the parameters */
+static size_t g_dict_elems = 1024;
+static size_t g_alphabet = 16;
+static size_t g_size = (size_t)1 << 20;
+static size_t g_items = 64;
+
+/* the data, followed by the zero padding (the forward window) */
+static char *g_data = NULL;
+
+/* the results of the kernels end up here, so that they are not optimized out */
+static volatile size_t g_sink;
+
+static uint64_t g_random = 88172645463325252ULL;
+
+/* xorshift64 */
+static size_t next_random()
+{
+	g_random ^= g_random << 13;
+	g_random ^= g_random >> 7;
+	g_random ^= g_random << 17;
+
+	return (size_t)(g_random >> 1);
+}
+
+/* time and cycles of the measured section */
+struct measure {
+	long ns;
+	uint64_t cycles;
+	long start_ns;
+	uint64_t start_cycles;
+};
+
+static void measure_start(struct measure *m)
+{
+	m->start_cycles = cycles();
+	m->start_ns = wall_clock();
+}
+
+static void measure_stop(struct measure *m)
+{
+	m->ns = wall_clock() - m->start_ns;
+	m->cycles = cycles() - m->start_cycles;
+}
+
+/* half the data are random symbols, half the fragments copied from the preceding data */
+static void generate_data(char *p, size_t size)
+{
+	for (size_t i = 0; i < size; ) {
+		if (i >= MAX_MATCH_LEN && next_random() % 2) {
+			size_t len = 2 + next_random() % (MAX_MATCH_LEN - 1);
+			size_t src = next_random() % (i - MAX_MATCH_LEN + 1);
+
+			for (size_t c = 0; c < len && i < size; ++c) {
+				p[i++] = p[src + c];
+			}
+		} else {
+			p[i++] = (char)('a' + next_random() % g_alphabet);
+		}
+	}
+}
+
+static void load_data(const char *path)
+{
+	size_t window = get_forward_window();
+	FILE *stream = NULL;
+
+	if (path != NULL) {
+		stream = fopen(path, "r");
+
+		if (stream == NULL) {
+			fprintf(stderr, "Cannot open input file\n");
+			abort();
+		}
+
+		g_size = fsize(stream);
+	}
+
+	if (g_size < 2 * MAX_MATCH_LEN) {
+		fprintf(stderr, "The data are too small\n");
+		abort();
+	}
+
+	g_data = malloc(g_size + window + MAX_MATCH_LEN);
+
+	if (g_data == NULL) {
+		abort();
+	}
+
+	if (stream != NULL) {
+		fload(g_data, g_size, stream);
+		fclose(stream);
+	} else {
+		generate_data(g_data, g_size);
+	}
+
+	memset(g_data + g_size, 0, window + MAX_MATCH_LEN);
+}
+
+/* a random position in the data */
+static size_t random_pos()
+{
+	return next_random() % (g_size - MAX_MATCH_LEN);
+}
+
+/* the fragments of the data, as the parser inserts them */
+static void fill_dict()
+{
+	for (size_t tries = 0; dict_get_elems() < g_dict_elems && tries < 16 * g_dict_elems; ++tries) {
+		size_t pos = random_pos();
+		struct elem e;
+
+		elem_fill(&e, g_data + pos, 2 + next_random() % (MAX_MATCH_LEN - 1), pos);
+
+		if (dict_query_elem(&e) == 0) {
+			if (!dict_can_insert_elem()) {
+				dict_enlarge();
+			}
+
+			dict_insert_elem(&e);
+		}
+	}
+
+	dict_update_costs(g_size);
+}
+
+static void kernel_find_best_match(size_t ops, struct measure *m)
+{
+	size_t sum = 0;
+
+	measure_start(m);
+
+	for (size_t i = 0; i < ops; ++i) {
+		sum += find_best_match(g_data + (i * 4099) % (g_size - MAX_MATCH_LEN));
+	}
+
+	measure_stop(m);
+
+	g_sink = sum;
+}
+
+static void kernel_dict_find_match(size_t ops, struct measure *m)
+{
+	size_t sum = 0;
+
+	measure_start(m);
+
+	for (size_t i = 0; i < ops; ++i) {
+		sum += dict_find_match(g_data + (i * 4099) % (g_size - MAX_MATCH_LEN));
+	}
+
+	measure_stop(m);
+
+	g_sink = sum;
+}
+
+/* an element is touched before each update, as by the parser */
+static void kernel_dict_update_costs(size_t ops, struct measure *m)
+{
+	static size_t pos = 0;
+	size_t elems = dict_get_elems();
+
+	/* the positions only grow */
+	if (pos == 0) {
+		pos = g_size;
+	}
+
+	measure_start(m);
+
+	for (size_t i = 0; i < ops; ++i) {
+		dict_set_last_pos((i * 7919) % elems, pos);
+		dict_update_costs(++pos);
+	}
+
+	measure_stop(m);
+}
+
+/* the pairs in the map */
+static struct tag_pair *g_pairs = NULL;
+static size_t g_pair_count = 0;
+
+/* every other queried pair is in the map */
+static void kernel_tag_pair_query(size_t ops, struct measure *m)
+{
+	size_t sum = 0;
+
+	measure_start(m);
+
+	for (size_t i = 0; i < ops; ++i) {
+		struct tag_pair pair = g_pairs[(i * 7919) % g_pair_count];
+
+		if (i % 2) {
+			pair.tag1 += g_dict_elems;
+		}
+
+		sum += tag_pair_query(&pair);
+	}
+
+	measure_stop(m);
+
+	g_sink = sum;
+}
+
+/* up to 4 pairs per tag */
+static void fill_tag_pairs()
+{
+	g_pairs = malloc(4 * g_dict_elems * sizeof(struct tag_pair));
+
+	if (g_pairs == NULL) {
+		abort();
+	}
+
+	for (size_t tries = 0; g_pair_count < 4 * g_dict_elems && tries < 16 * g_dict_elems; ++tries) {
+		struct tag_pair pair = make_tag_pair(next_random() % g_dict_elems, next_random() % g_dict_elems);
+
+		if (tag_pair_query(&pair) == (size_t)-1) {
+			if (!tag_pair_can_add()) {
+				tag_pair_enlarge();
+			}
+
+			tag_pair_add(&pair);
+
+			g_pairs[g_pair_count++] = pair;
+		}
+	}
+}
+
+/* the context with g_items tags of the decreasing frequencies */
+static struct ctx g_ctx;
+
+static void fill_ctx()
+{
+	g_ctx.items = g_items;
+	g_ctx.capacity = g_items;
+	g_ctx.arr = malloc(g_items * sizeof(struct item));
+
+	if (g_ctx.arr == NULL) {
+		abort();
+	}
+
+	for (size_t i = 0; i < g_items; ++i) {
+		g_ctx.arr[i].tag = i;
+		g_ctx.arr[i].freq = g_items / (i + 1);
+	}
+}
+
+/* the bit stream for ops symbols */
+static unsigned char *alloc_code(size_t ops)
+{
+	unsigned char *code = malloc(ops * 8 + 64);
+
+	if (code == NULL) {
+		abort();
+	}
+
+	return code;
+}
+
+static void encode_ctx(unsigned char *code, size_t ops, struct measure *m)
+{
+	struct bio bio;
+	struct ac ac;
+
+	bio_open(&bio, code, code + ops * 8 + 64, BIO_MODE_WRITE);
+	ac_init(&ac);
+
+	measure_start(m);
+
+	for (size_t i = 0; i < ops; ++i) {
+		ctx_encode_tag_without_update_ac(&bio, &ac, &g_ctx, (size_t)(unsigned char)g_data[i % g_size] % g_items);
+	}
+
+	measure_stop(m);
+
+	ac_encode_flush(&ac, &bio);
+	bio_close(&bio, BIO_MODE_WRITE);
+}
+
+static void kernel_ctx_encode(size_t ops, struct measure *m)
+{
+	unsigned char *code = alloc_code(ops);
+
+	encode_ctx(code, ops, m);
+
+	free(code);
+}
+
+static void kernel_ctx_decode(size_t ops, struct measure *m)
+{
+	unsigned char *code = alloc_code(ops);
+	struct measure encoding;
+	struct bio bio;
+	struct ac ac;
+	size_t sum = 0;
+
+	encode_ctx(code, ops, &encoding);
+
+	bio_open(&bio, code, code + ops * 8 + 64, BIO_MODE_READ);
+	ac_init(&ac);
+	ac_decode_init(&ac, &bio);
+
+	measure_start(m);
+
+	for (size_t i = 0; i < ops; ++i) {
+		sum += ctx_decode_tag_without_update_ac(&bio, &ac, &g_ctx);
+	}
+
+	measure_stop(m);
+
+	bio_close(&bio, BIO_MODE_READ);
+
+	free(code);
+
+	g_sink = sum;
+}
+
+/* the order-0 model of the data */
+static struct model g_model;
+
+static void fill_model()
+{
+	model_create(&g_model, 256);
+
+	for (size_t i = 0; i < g_size; ++i) {
+		g_model.table[(unsigned char)g_data[i]].freq++;
+	}
+
+	/* the frequencies are bounded by the range of the coder */
+	for (size_t s = 0; s < 256; ++s) {
+		g_model.table[s].freq = 1 + (g_model.table[s].freq << 12) / g_size;
+	}
+
+	count_cum_freqs(g_model.table, g_model.count);
+	g_model.total = calc_total_freq(g_model.table, g_model.count);
+}
+
+static void encode_symbols(unsigned char *code, size_t ops, struct measure *m)
+{
+	struct bio bio;
+	struct ac ac;
+
+	bio_open(&bio, code, code + ops * 8 + 64, BIO_MODE_WRITE);
+	ac_init(&ac);
+
+	measure_start(m);
+
+	for (size_t i = 0; i < ops; ++i) {
+		ac_encode_symbol(&ac, &bio, (unsigned char)g_data[i % g_size], g_model.table, g_model.count, g_model.total);
+	}
+
+	measure_stop(m);
+
+	ac_encode_flush(&ac, &bio);
+	bio_close(&bio, BIO_MODE_WRITE);
+}
+
+static void kernel_ac_encode_symbol(size_t ops, struct measure *m)
+{
+	unsigned char *code = alloc_code(ops);
+
+	encode_symbols(code, ops, m);
+
+	free(code);
+}
+
+static void kernel_ac_decode_symbol(size_t ops, struct measure *m)
+{
+	unsigned char *code = alloc_code(ops);
+	struct measure encoding;
+	struct bio bio;
+	struct ac ac;
+	size_t sum = 0;
+
+	encode_symbols(code, ops, &encoding);
+
+	bio_open(&bio, code, code + ops * 8 + 64, BIO_MODE_READ);
+	ac_init(&ac);
+	ac_decode_init(&ac, &bio);
+
+	measure_start(m);
+
+	for (size_t i = 0; i < ops; ++i) {
+		sum += ac_decode_symbol(&ac, &bio, g_model.table, g_model.count, g_model.total);
+	}
+
+	measure_stop(m);
+
+	bio_close(&bio, BIO_MODE_READ);
+
+	free(code);
+
+	g_sink = sum;
+}
+
+/* 1 to 24 bits at once */
+static void write_bits(unsigned char *code, size_t ops, struct measure *m)
+{
+	struct bio bio;
+
+	bio_open(&bio, code, code + ops * 8 + 64, BIO_MODE_WRITE);
+
+	measure_start(m);
+
+	for (size_t i = 0; i < ops; ++i) {
+		size_t n = 1 + i % 24;
+
+		bio_write_bits(&bio, (uint32_t)i & ((1U << n) - 1), n);
+	}
+
+	measure_stop(m);
+
+	bio_close(&bio, BIO_MODE_WRITE);
+}
+
+static void kernel_bio_write_bits(size_t ops, struct measure *m)
+{
+	unsigned char *code = alloc_code(ops);
+
+	write_bits(code, ops, m);
+
+	free(code);
+}
+
+static void kernel_bio_read_bits(size_t ops, struct measure *m)
+{
+	unsigned char *code = alloc_code(ops);
+	struct measure writing;
+	struct bio bio;
+	size_t sum = 0;
+
+	write_bits(code, ops, &writing);
+
+	bio_open(&bio, code, code + ops * 8 + 64, BIO_MODE_READ);
+
+	measure_start(m);
+
+	for (size_t i = 0; i < ops; ++i) {
+		sum += bio_read_bits(&bio, 1 + i % 24);
+	}
+
+	measure_stop(m);
+
+	bio_close(&bio, BIO_MODE_READ);
+
+	free(code);
+
+	g_sink = sum;
+}
+
+struct kernel {
+	const char *name;
+	void (*run)(size_t ops, struct measure *m);
+};
+
+static const struct kernel kernels[] = {
+	{ "find_best_match", kernel_find_best_match },
+	{ "dict_find_match", kernel_dict_find_match },
+	{ "dict_update_costs", kernel_dict_update_costs },
+	{ "tag_pair_query", kernel_tag_pair_query },
+	{ "ctx_encode_tag", kernel_ctx_encode },
+	{ "ctx_decode_tag", kernel_ctx_decode },
+	{ "ac_encode_symbol", kernel_ac_encode_symbol },
+	{ "ac_decode_symbol", kernel_ac_decode_symbol },
+	{ "bio_write_bits", kernel_bio_write_bits },
+	{ "bio_read_bits", kernel_bio_read_bits },
+	{ NULL, NULL }
+};
+
+/* the number of operations is doubled until the kernel runs for MIN_TIME */
+static void run_kernel(const struct kernel *kernel)
+{
+	size_t ops = 1;
+	struct measure m;
+
+	for (;;) {
+		kernel->run(ops, &m);
+
+		if (m.ns >= MIN_TIME) {
+			break;
+		}
+
+		ops *= 2;
+	}
+
+	struct measure best = m;
+
+	for (int r = 1; r < RUNS; ++r) {
+		kernel->run(ops, &m);
+
+		if (m.ns < best.ns) {
+			best = m;
+		}
+	}
+
+	printf("%-18s %12.1f ns/op %12.1f cycles/op %12zu ops\n", kernel->name,
+		best.ns / (double)ops, best.cycles / (double)ops, ops);
+	fflush(stdout);
+}
+
+static void print_help(char *path)
+{
+	fprintf(stderr, "Usage :\n\t%s [arguments] [input-file]\n\n", path);
+	fprintf(stderr, "Arguments :\n");
+	fprintf(stderr, " -n NUM : dictionary size (elements, default 1024)\n");
+	fprintf(stderr, " -a NUM : alphabet size of the synthetic data (the entropy is log2 NUM bits, default 16)\n");
+	fprintf(stderr, " -s NUM : size of the synthetic data (in kilobytes, default 1024)\n");
+	fprintf(stderr, " -c NUM : number of tags in the context (default 64)\n");
+	fprintf(stderr, " -k NAME : run only the kernel\n");
+	fprintf(stderr, " -h     : print this message\n");
+}
+
+int main(int argc, char *argv[])
+{
+	const char *only = NULL;
+
+	backend_init();
+
+	parse: switch (getopt(argc, argv, "n:a:s:c:k:h")) {
+		case 'n':
+			g_dict_elems = atoi(optarg) > 0 ? (size_t)atoi(optarg) : 1;
+			goto parse;
+		case 'a':
+			g_alphabet = atoi(optarg) > 0 && atoi(optarg) <= 256 ? (size_t)atoi(optarg) : 256;
+			goto parse;
+		case 's':
+			g_size = (size_t)atoi(optarg) * 1024;
+			goto parse;
+		case 'c':
+			g_items = atoi(optarg) > 0 ? (size_t)atoi(optarg) : 1;
+			goto parse;
+		case 'k':
+			only = optarg;
+			goto parse;
+		case 'h':
+			print_help(argv[0]);
+			return 0;
+		default:
+			abort();
+		case -1:
+			;
+	}
+
+	load_data(optind < argc ? argv[optind] : NULL);
+
+	/* as the coder starts */
+	dict_enlarge();
+	tag_pair_create();
+	tag_pair_enlarge();
+
+	fill_dict();
+	fill_tag_pairs();
+	fill_ctx();
+	fill_model();
+
+	printf("data: %zu bytes (%s), dictionary: %zu elements, tag pairs: %zu, context: %zu tags\n",
+		g_size, optind < argc ? argv[optind] : "synthetic", dict_get_elems(), tag_pair_get_elems(), g_items);
+
+	if (cycles() == 0) {
+		printf("the cycle counter is not available\n");
+	}
+
+	for (const struct kernel *kernel = kernels; kernel->name != NULL; ++kernel) {
+		if (only == NULL || strcmp(only, kernel->name) == 0) {
+			run_kernel(kernel);
+		}
+	}
+
+	free(g_pairs);
+	free(g_ctx.arr);
+	model_destroy(&g_model);
+	tag_pair_destroy();
+	dict_destroy();
+	free(g_data);
+
+	return 0;
+}
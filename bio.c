@@ -2,19 +2,46 @@
 
 #include <assert.h>
 
+/* the stream is a sequence of little-endian 32-bit words, the bits are stored LSB first */
+
+static uint32_t load32(const unsigned char *p)
+{
+	return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t load64(const unsigned char *p)
+{
+	return (uint64_t)load32(p) | (uint64_t)load32(p + 4) << 32;
+}
+
+static void store32(unsigned char *p, uint32_t w)
+{
+	p[0] = (unsigned char)(w);
+	p[1] = (unsigned char)(w >> 8);
+	p[2] = (unsigned char)(w >> 16);
+	p[3] = (unsigned char)(w >> 24);
+}
+
+static void store64(unsigned char *p, uint64_t w)
+{
+	store32(p, (uint32_t)w);
+	store32(p + 4, (uint32_t)(w >> 32));
+}
+
 void bio_open(struct bio *bio, void *ptr, void *end, int mode)
 {
 	assert(bio != NULL);
 
 	bio->ptr = ptr;
-	bio->end = (char *)end - 3;
+	bio->end = end;
 
-	if (mode == BIO_MODE_READ) {
-		bio->c = 32;
-	} else {
-		bio->b = 0;
-		bio->c = 0;
-	}
+	bio->b = 0;
+	bio->c = 0;
+
+	bio->fill = NULL;
+	bio->arg = NULL;
+
+	(void)mode;
 }
 
 static void bio_flush_buffer(struct bio *bio)
@@ -22,9 +49,20 @@ static void bio_flush_buffer(struct bio *bio)
 	assert(bio != NULL);
 	assert(bio->ptr != NULL);
 
-	*(bio->ptr++) = bio->b;
-	bio->b = 0;
-	bio->c = 0;
+	store64(bio->ptr, bio->b);
+	bio->ptr += 8;
+}
+
+/* the next 32-bit word, past the end of the stream the decoder is fed by a constant */
+static uint32_t bio_next_word(struct bio *bio)
+{
+	if (bio->end - bio->ptr >= 4) {
+		uint32_t w = load32(bio->ptr);
+		bio->ptr += 4;
+		return w;
+	}
+
+	return 0x80000000;
 }
 
 static void bio_reload_buffer(struct bio *bio)
@@ -32,13 +70,19 @@ static void bio_reload_buffer(struct bio *bio)
 	assert(bio != NULL);
 	assert(bio->ptr != NULL);
 
-	if ((void *)bio->ptr < bio->end) {
-		bio->b = *(bio->ptr++);
+	if (bio->end - bio->ptr < 8 && bio->fill != NULL) {
+		bio->fill(bio);
+	}
+
+	if (bio->end - bio->ptr >= 8) {
+		bio->b = load64(bio->ptr);
+		bio->ptr += 8;
 	} else {
-		bio->b = 0x80000000;
+		bio->b = (uint64_t)bio_next_word(bio);
+		bio->b |= (uint64_t)bio_next_word(bio) << 32;
 	}
 
-	bio->c = 0;
+	bio->c = 64;
 }
 
 static size_t minsize(size_t a, size_t b)
@@ -49,64 +93,89 @@ static size_t minsize(size_t a, size_t b)
 void bio_write_bits(struct bio *bio, uint32_t b, size_t n)
 {
 	assert(n <= 32);
+	assert(bio->c < 64);
 
-	for (int i = 0; i < 2; ++i) {
-		assert(bio->c < 32);
+	uint64_t w = (uint64_t)b & (((uint64_t)1 << n) - 1);
 
-		size_t m = minsize(32 - bio->c, n);
+	bio->b |= w << bio->c;
+	bio->c += n;
 
-		bio->b |= (b & (((uint32_t)1 << m) - 1)) << bio->c;
-		bio->c += m;
+	if (bio->c >= 64) {
+		bio_flush_buffer(bio);
+		bio->c -= 64;
+		/* the bits that did not fit; n - bio->c is in the range 1 to 32 */
+		bio->b = w >> (n - bio->c);
+	}
+}
 
-		if (bio->c == 32) {
-			bio_flush_buffer(bio);
-		}
+void bio_write_run(struct bio *bio, uint32_t b, size_t n)
+{
+	uint32_t w = b ? UINT32_MAX : 0;
 
-		b >>= m;
-		n -= m;
+	while (n > 0) {
+		size_t m = minsize(n, 32);
 
-		if (n == 0) {
-			return;
-		}
+		bio_write_bits(bio, w, m);
+
+		n -= m;
 	}
 }
 
-uint32_t bio_read_bits(struct bio *bio, size_t n)
+void bio_write_pending(struct bio *bio, uint32_t b, size_t n)
 {
-	if (bio->c == 32) {
-		bio_reload_buffer(bio);
+	if (n < 32) {
+		uint32_t w = b ? 1 : (((uint32_t)1 << n) - 1) << 1;
+
+		bio_write_bits(bio, w, n + 1);
+	} else {
+		bio_write_bits(bio, b, 1);
+		bio_write_run(bio, !b, n);
 	}
+}
 
-	/* get the avail. least-significant bits */
-	size_t s = minsize(32 - bio->c, n);
+uint32_t bio_read_bits(struct bio *bio, size_t n)
+{
+	assert(n <= 32);
 
-	uint32_t w = bio->b & (((uint32_t)1 << s) - 1);
+	uint64_t w;
 
-	bio->b >>= s;
-	bio->c += s;
+	if (bio->c >= n) {
+		w = bio->b;
 
-	n -= s;
+		bio->b >>= n;
+		bio->c -= n;
+	} else {
+		/* get the avail. least-significant bits, reload & get the most-significant bits */
+		size_t s = bio->c;
 
-	/* need more bits? reload & get the most-significant bits */
-	if (n > 0) {
-		assert(bio->c == 32);
+		w = bio->b;
 
 		bio_reload_buffer(bio);
 
-		w |= (bio->b & (((uint32_t)1 << n) - 1)) << s;
+		w |= bio->b << s;
 
-		bio->b >>= n;
-		bio->c += n;
+		bio->b >>= n - s;
+		bio->c -= n - s;
 	}
 
-	return w;
+	return (uint32_t)(w & (((uint64_t)1 << n) - 1));
 }
 
 void bio_close(struct bio *bio, int mode)
 {
 	assert(bio != NULL);
 
-	if (mode == BIO_MODE_WRITE && bio->c > 0) {
-		bio_flush_buffer(bio);
+	if (mode == BIO_MODE_WRITE) {
+		/* flush the pending bits as whole 32-bit words */
+		if (bio->c > 0) {
+			store32(bio->ptr, (uint32_t)bio->b);
+			bio->ptr += 4;
+		}
+		if (bio->c > 32) {
+			store32(bio->ptr, (uint32_t)(bio->b >> 32));
+			bio->ptr += 4;
+		}
+		bio->b = 0;
+		bio->c = 0;
 	}
 }
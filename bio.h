@@ -13,10 +13,12 @@ enum {
 };
 
 struct bio {
-	uint32_t *ptr; /* pointer to memory */
-	void *end;
-	uint32_t b;    /* bit buffer */
-	size_t c;      /* bit counter */
+	unsigned char *ptr; /* pointer to memory */
+	unsigned char *end;
+	uint64_t b;    /* bit buffer */
+	size_t c;      /* bit counter (pending bits when writing, available bits when reading) */
+	void (*fill)(struct bio *bio); /* when reading, called to refill [ptr, end) before it runs dry (optional) */
+	void *arg;     /* for the fill callback */
 };
 
 void bio_open(struct bio *bio, void *ptr, void *end, int mode);
@@ -25,6 +27,12 @@ void bio_close(struct bio *bio, int mode);
 
 void bio_write_bits(struct bio *bio, uint32_t b, size_t n);
 
+/* write n copies of the bit b */
+void bio_write_run(struct bio *bio, uint32_t b, size_t n);
+
+/* write the bit b followed by n copies of the inverted bit (pending E3 bits) */
+void bio_write_pending(struct bio *bio, uint32_t b, size_t n);
+
 uint32_t bio_read_bits(struct bio *bio, size_t n);
 
 #endif /* BIO_H_ */
@@ -0,0 +1,36 @@
+/*
+ * The coder of this thread (implemented in x3.c), for the modules built on it
+ */
+#ifndef CODER_H
+#define CODER_H
+
+#include <stddef.h>
+
+/* an empty coder on this thread */
+void create();
+
+void destroy();
+
+/* keep the storage across the coders on this thread (or free it when the thread is done) */
+void keep_storage(int keep);
+
+/* the storage of the coder is grown for capacity fragments up front, between create() and destroy() */
+void preallocate_storage(size_t capacity);
+
+/* upper bound on the size of the bit stream holding size bytes */
+size_t compress_bound(size_t size);
+
+/*
+ * Compress [iptr, iptr + isize) into a standalone bit stream at optr (at least compress_bound(isize) bytes).
+ * The input must be followed by get_forward_padding() bytes of zero padding.
+ * Returns the size of the bit stream.
+ */
+size_t compress_buffer(char *iptr, size_t isize, unsigned char *optr);
+
+/*
+ * Decompress the bit stream [iptr, iptr + isize) holding exactly osize bytes.
+ * A corrupted stream is reported by corrupted().
+ */
+void decompress_buffer(unsigned char *iptr, size_t isize, char *optr, size_t osize);
+
+#endif /* CODER_H */
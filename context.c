@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include "utils.h"
 
 struct ctx *ctx_enlarge(struct ctx *c, size_t size, size_t elems)
 {
@@ -17,6 +18,13 @@ struct ctx *ctx_enlarge(struct ctx *c, size_t size, size_t elems)
 	return c;
 }
 
+void ctx_clear(struct ctx *c, size_t size)
+{
+	for (size_t e = 0; e < size; ++e) {
+		c[e].items = 0;
+	}
+}
+
 struct item *ctx_query_tag_item(struct ctx *c, size_t tag)
 {
 	for (size_t i = 0; i < c->items; ++i) {
@@ -45,10 +53,14 @@ void ctx_add_tag(struct ctx *c, size_t tag)
 
 	c->items++;
 
-	c->arr = realloc(c->arr, c->items * sizeof(struct item));
+	if (c->items > c->capacity) {
+		c->arr = realloc(c->arr, c->items * sizeof(struct item));
 
-	if (c->arr == NULL) {
-		abort();
+		if (c->arr == NULL) {
+			abort();
+		}
+
+		c->capacity = c->items;
 	}
 
 	c->arr[c->items - 1].tag = tag;
@@ -132,21 +144,86 @@ float ctx_encode_tag_without_update_ac_query_prob(struct ctx *ctx, size_t tag)
 	return prob;
 }
 
+/* the model of the decoder, kept on the thread (a corrupted stream may leave the decoder at any point) */
+static THREAD_LOCAL struct model decoder_model;
+
 size_t ctx_decode_tag_without_update_ac(struct bio *bio, struct ac *ac, struct ctx *ctx)
 {
-	struct model model;
-	model_create(&model, ctx->items);
+	struct model *model = &decoder_model;
+	model_reset(model, ctx->items);
 
 	for (size_t i = 0; i < ctx->items; ++i) {
-		model.table[i].freq = ctx->arr[i].freq;
+		model->table[i].freq = ctx->arr[i].freq;
 	}
 
-	count_cum_freqs(model.table, model.count);
-	model.total = calc_total_freq(model.table, model.count);
-
-	size_t item_index = ac_decode_symbol_model(ac, bio, &model);
+	count_cum_freqs(model->table, model->count);
+	model->total = calc_total_freq(model->table, model->count);
 
-	model_destroy(&model);
+	size_t item_index = ac_decode_symbol_model(ac, bio, model);
 
 	return ctx->arr[item_index].tag;
 }
+
+void ctx_free_decoder()
+{
+	model_destroy(&decoder_model);
+}
+
+void ctx_save(struct snapshot *s, const struct ctx *c, size_t size)
+{
+	for (size_t e = 0; e < size; ++e) {
+		snapshot_put(s, c[e].items);
+
+		for (size_t i = 0; i < c[e].items; ++i) {
+			snapshot_put(s, c[e].arr[i].tag);
+			snapshot_put(s, c[e].arr[i].freq);
+		}
+	}
+}
+
+struct ctx *ctx_load(struct snapshot *s, size_t size)
+{
+	struct ctx *c = ctx_enlarge(NULL, size, 0);
+
+	for (size_t e = 0; e < size; ++e) {
+		/* each item takes at least 2 bytes */
+		c[e].items = snapshot_get_size(s, s->size / 2);
+		c[e].capacity = c[e].items;
+
+		if (c[e].items > 0) {
+			c[e].arr = malloc(c[e].items * sizeof(struct item));
+
+			if (c[e].arr == NULL) {
+				abort();
+			}
+		}
+
+		for (size_t i = 0; i < c[e].items; ++i) {
+			c[e].arr[i].tag = (size_t)snapshot_get(s);
+			c[e].arr[i].freq = (size_t)snapshot_get(s);
+		}
+	}
+
+	return c;
+}
+
+void ctx_copy(struct ctx *c, const struct ctx *that, size_t size)
+{
+	for (size_t e = 0; e < size; ++e) {
+		if (that[e].items > c[e].capacity) {
+			c[e].arr = realloc(c[e].arr, that[e].items * sizeof(struct item));
+
+			if (c[e].arr == NULL) {
+				abort();
+			}
+
+			c[e].capacity = that[e].items;
+		}
+
+		c[e].items = that[e].items;
+
+		if (that[e].items > 0) {
+			memcpy(c[e].arr, that[e].arr, that[e].items * sizeof(struct item));
+		}
+	}
+}
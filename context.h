@@ -4,6 +4,7 @@
 #include <stddef.h>
 #include "bio.h"
 #include "ac.h"
+#include "snapshot.h"
 
 struct item {
 	size_t tag;
@@ -11,12 +12,16 @@ struct item {
 };
 
 struct ctx {
-	size_t items; /* allocated elements */
+	size_t items; /* elements */
+	size_t capacity; /* allocated elements */
 	struct item *arr; /* pointer to the first item */
 };
 
 struct ctx *ctx_enlarge(struct ctx *c, size_t size, size_t elems);
 
+/* empties the size contexts, the items are kept allocated */
+void ctx_clear(struct ctx *c, size_t size);
+
 struct item *ctx_query_tag_item(struct ctx *c, size_t tag);
 
 size_t ctx_query_tag_index(struct ctx *c, size_t tag);
@@ -32,4 +37,15 @@ float ctx_encode_tag_without_update_ac_query_prob(struct ctx *ctx, size_t tag);
 
 size_t ctx_decode_tag_without_update_ac(struct bio *bio_a, struct ac *ac, struct ctx *ctx);
 
+/* free the model kept by the decoder on this thread */
+void ctx_free_decoder();
+
+/* the array of size contexts */
+void ctx_save(struct snapshot *s, const struct ctx *c, size_t size);
+
+struct ctx *ctx_load(struct snapshot *s, size_t size);
+
+/* copies the size contexts into those of c, the items are reallocated only when they do not fit */
+void ctx_copy(struct ctx *c, const struct ctx *that, size_t size);
+
 #endif
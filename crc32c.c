@@ -0,0 +1,111 @@
+#define _POSIX_C_SOURCE 200809L
+#include "crc32c.h"
+#include <pthread.h>
+#include <string.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#	include <nmmintrin.h>
+#	define CRC32C_SSE42
+#endif
+
+/* reflected polynomial */
+#define POLY 0x82f63b78
+
+/* slicing-by-8 tables */
+static uint32_t table[8][256];
+
+static uint32_t (*update)(uint32_t crc, const unsigned char *p, size_t size);
+
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+static uint32_t update_sw(uint32_t crc, const unsigned char *p, size_t size)
+{
+	while (size > 0 && ((uintptr_t)p & 7) != 0) {
+		crc = table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+		size--;
+	}
+
+	while (size >= 8) {
+		uint32_t lo = crc ^ ((uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+		uint32_t hi = (uint32_t)p[4] | (uint32_t)p[5] << 8 | (uint32_t)p[6] << 16 | (uint32_t)p[7] << 24;
+
+		crc = table[7][lo & 0xff] ^ table[6][(lo >> 8) & 0xff] ^ table[5][(lo >> 16) & 0xff] ^ table[4][lo >> 24]
+		    ^ table[3][hi & 0xff] ^ table[2][(hi >> 8) & 0xff] ^ table[1][(hi >> 16) & 0xff] ^ table[0][hi >> 24];
+
+		p += 8;
+		size -= 8;
+	}
+
+	while (size > 0) {
+		crc = table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+		size--;
+	}
+
+	return crc;
+}
+
+#ifdef CRC32C_SSE42
+__attribute__((target("sse4.2")))
+static uint32_t update_hw(uint32_t crc, const unsigned char *p, size_t size)
+{
+	while (size > 0 && ((uintptr_t)p & 7) != 0) {
+		crc = _mm_crc32_u8(crc, *p++);
+		size--;
+	}
+
+	uint64_t crc64 = crc;
+
+	while (size >= 8) {
+		uint64_t w;
+
+		memcpy(&w, p, 8);
+
+		crc64 = _mm_crc32_u64(crc64, w);
+		p += 8;
+		size -= 8;
+	}
+
+	crc = (uint32_t)crc64;
+
+	while (size > 0) {
+		crc = _mm_crc32_u8(crc, *p++);
+		size--;
+	}
+
+	return crc;
+}
+#endif
+
+static void init()
+{
+	for (uint32_t i = 0; i < 256; ++i) {
+		uint32_t crc = i;
+
+		for (int k = 0; k < 8; ++k) {
+			crc = (crc >> 1) ^ (POLY & (0 - (crc & 1)));
+		}
+
+		table[0][i] = crc;
+	}
+
+	for (int t = 1; t < 8; ++t) {
+		for (int i = 0; i < 256; ++i) {
+			table[t][i] = table[0][table[t - 1][i] & 0xff] ^ (table[t - 1][i] >> 8);
+		}
+	}
+
+	update = update_sw;
+
+#ifdef CRC32C_SSE42
+	if (__builtin_cpu_supports("sse4.2")) {
+		update = update_hw;
+	}
+#endif
+}
+
+uint32_t crc32c(uint32_t crc, const void *ptr, size_t size)
+{
+	pthread_once(&once, init);
+
+	return ~update(~crc, ptr, size);
+}
@@ -0,0 +1,16 @@
+/*
+ * CRC-32C (Castagnoli) checksum
+ */
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Updates the checksum crc (0 for the empty data) by size bytes at ptr.
+ * Uses the SSE4.2 instruction if the processor supports it.
+ */
+uint32_t crc32c(uint32_t crc, const void *ptr, size_t size);
+
+#endif /* CRC32C_H */
@@ -3,15 +3,25 @@
 #include <assert.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdint.h>
+#include "utils.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#	include <immintrin.h>
+#	define DICT_X86
+#endif
 
 /* allocated size, enlarged logarithmically */
-size_t dict_logsize = 0;
-size_t dict_size = 1;
+THREAD_LOCAL size_t dict_logsize = 0;
+THREAD_LOCAL size_t dict_size = 1;
 
 /* number of elements in the dictionary */
-size_t dict_elems = 0;
+THREAD_LOCAL size_t dict_elems = 0;
+
+THREAD_LOCAL struct elem *dict = NULL; /* the dictionary, sorted by distance = curr_pos - dict[i]->last_pos */
 
-struct elem *dict = NULL; /* the dictionary, sorted by distance = curr_pos - dict[i]->last_pos */
+/* allocated elements, kept by dict_reset() */
+THREAD_LOCAL size_t dict_capacity = 0;
 
 size_t dict_get_size()
 {
@@ -23,19 +33,41 @@ size_t dict_get_elems()
 	return dict_elems;
 }
 
+static void dict_reserve()
+{
+	if (dict_size > dict_capacity) {
+		dict = realloc(dict, dict_size * sizeof(struct elem));
+
+		if (dict == NULL) {
+			abort();
+		}
+
+		dict_capacity = dict_size;
+	}
+}
+
 void dict_enlarge()
 {
 	dict_logsize++;
 	dict_size = (size_t)1 << dict_logsize;
 
-	dict = realloc(dict, dict_size * sizeof(struct elem));
+	dict_reserve();
+}
+
+void dict_preallocate(size_t capacity)
+{
+	if (capacity > dict_capacity) {
+		dict = realloc(dict, capacity * sizeof(struct elem));
+
+		if (dict == NULL) {
+			abort();
+		}
 
-	if (dict == NULL) {
-		abort();
+		dict_capacity = capacity;
 	}
 }
 
-size_t elem_calc_cost(struct elem *e, char *curr_pos)
+size_t elem_calc_cost(struct elem *e, size_t curr_pos)
 {
 	assert(e != NULL);
 
@@ -48,14 +80,14 @@ size_t elem_calc_cost(struct elem *e, char *curr_pos)
 	return cost;
 }
 
-void elem_fill(struct elem *e, char *p, size_t len)
+void elem_fill(struct elem *e, const char *p, size_t len, size_t pos)
 {
 	assert(e != NULL);
 
 	memcpy(e->s, p, len);
 	e->len = len;
 
-	e->last_pos = p;
+	e->last_pos = pos;
 }
 
 static int elem_compar(const void *l, const void *r)
@@ -102,7 +134,7 @@ void dict_insert_elem(const struct elem *e)
 	dict_elems++;
 }
 
-size_t dict_find_match(const char *p)
+static size_t dict_find_match_sw(const char *p)
 {
 	size_t best_len = 0;
 	size_t best_len_i;
@@ -129,12 +161,65 @@ size_t dict_find_match(const char *p)
 	return (size_t)-1; /* not found */
 }
 
-void dict_update_costs(char *p)
+#ifdef DICT_X86
+/* the string at p is loaded once, each element is compared in a single step (MAX_MATCH_LEN bytes of p must be readable) */
+__attribute__((target("avx2")))
+static size_t dict_find_match_avx2(const char *p)
+{
+	size_t best_len = 0;
+	size_t best_len_i;
+
+	__m256i v = _mm256_loadu_si256((const __m256i *)p);
+
+	for (size_t i = 0; i < dict_elems; ++i) {
+		size_t len = dict[i].len;
+
+		assert(len > 0 && len <= MAX_MATCH_LEN);
+
+		/* the first len characters must be equal */
+		uint32_t mask = len < 32 ? ((uint32_t)1 << len) - 1 : UINT32_MAX;
+		uint32_t eq = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_loadu_si256((const __m256i *)dict[i].s)));
+
+		if ((eq & mask) == mask && len > best_len) {
+			best_len = len;
+			best_len_i = i;
+		}
+	}
+
+	if (best_len > 0) {
+		return best_len_i;
+	}
+
+	return (size_t)-1; /* not found */
+}
+#endif
+
+/* the scalar kernel until dict_init() */
+static size_t (*find_match)(const char *p) = dict_find_match_sw;
+
+void dict_init()
+{
+#ifdef DICT_X86
+	__builtin_cpu_init();
+
+	/* MAX_MATCH_LEN characters in a register */
+	if (MAX_MATCH_LEN == 32 && __builtin_cpu_supports("avx2")) {
+		find_match = dict_find_match_avx2;
+	}
+#endif
+}
+
+size_t dict_find_match(const char *p)
+{
+	return find_match(p);
+}
+
+void dict_update_costs(size_t pos)
 {
 	for (size_t i = 0; i < dict_elems; ++i) {
 		assert(!elem_is_zero(&dict[i]));
 
-		dict[i].cost = elem_calc_cost(&dict[i], p);
+		dict[i].cost = elem_calc_cost(&dict[i], pos);
 	}
 
 	qsort(dict, dict_elems, sizeof(struct elem), elem_compar);
@@ -182,9 +267,9 @@ size_t dict_get_index_by_tag(size_t tag)
 	abort();
 }
 
-void dict_set_last_pos(size_t index, char *p)
+void dict_set_last_pos(size_t index, size_t pos)
 {
-	dict[index].last_pos = p;
+	dict[index].last_pos = pos;
 }
 
 void dict_dump()
@@ -194,7 +279,83 @@ void dict_dump()
 	}
 }
 
+void dict_save(struct snapshot *s)
+{
+	snapshot_put(s, dict_logsize);
+	snapshot_put(s, dict_elems);
+
+	for (size_t i = 0; i < dict_elems; ++i) {
+		snapshot_put(s, dict[i].len);
+		snapshot_put_bytes(s, dict[i].s, dict[i].len);
+		snapshot_put(s, dict[i].last_pos);
+		snapshot_put(s, dict[i].cost);
+		snapshot_put(s, dict[i].tag);
+	}
+}
+
+void dict_load(struct snapshot *s)
+{
+	dict_logsize = snapshot_get_size(s, 32);
+	dict_size = (size_t)1 << dict_logsize;
+	dict_elems = snapshot_get_size(s, dict_size);
+
+	dict_reserve();
+
+	for (size_t i = 0; i < dict_elems; ++i) {
+		dict[i].len = snapshot_get_size(s, MAX_MATCH_LEN);
+		snapshot_get_bytes(s, dict[i].s, dict[i].len);
+		dict[i].last_pos = (size_t)snapshot_get(s);
+		dict[i].cost = (size_t)snapshot_get(s);
+		dict[i].tag = snapshot_get_size(s, dict_elems - 1);
+
+		if (dict[i].len == 0) {
+			abort();
+		}
+	}
+}
+
+void dict_reset()
+{
+	dict_logsize = 0;
+	dict_size = 1;
+	dict_elems = 0;
+}
+
+void dict_get_state(struct dict_state *state)
+{
+	state->logsize = dict_logsize;
+	state->size = dict_size;
+	state->elems = dict_elems;
+	state->dict = dict;
+	state->capacity = dict_capacity;
+}
+
+void dict_set_state(const struct dict_state *state)
+{
+	dict_logsize = state->logsize;
+	dict_size = state->size;
+	dict_elems = state->elems;
+	dict = state->dict;
+	dict_capacity = state->capacity;
+}
+
+void dict_copy(const struct dict_state *state)
+{
+	dict_logsize = state->logsize;
+	dict_size = state->size;
+	dict_elems = state->elems;
+
+	dict_reserve();
+
+	memcpy(dict, state->dict, dict_elems * sizeof(struct elem));
+}
+
 void dict_destroy()
 {
 	free(dict);
+
+	dict = NULL;
+	dict_capacity = 0;
+
+	dict_reset();
 }
@@ -2,12 +2,13 @@
 #define DICT_H
 
 #include "backend.h"
+#include "snapshot.h"
 #include <stddef.h>
 
 struct elem {
 	char s[MAX_MATCH_LEN]; /* the string */
 	size_t len; /* of the length */
-	char *last_pos; /* recently seen at the position */
+	size_t last_pos; /* recently seen at the position (offset in the stream) */
 	size_t cost; /* sort key */
 	size_t tag; /* id */
 };
@@ -18,23 +19,32 @@ size_t dict_get_elems();
 
 void dict_enlarge();
 
-size_t elem_calc_cost(struct elem *e, char *curr_pos);
+/* allocates the storage for capacity fragments up front, the size of the dictionary is not changed */
+void dict_preallocate(size_t capacity);
 
-void elem_fill(struct elem *e, char *p, size_t len);
+size_t elem_calc_cost(struct elem *e, size_t curr_pos);
+
+/* the string p is at the position pos in the stream */
+void elem_fill(struct elem *e, const char *p, size_t len, size_t pos);
 
 int dict_can_insert_elem();
 
 void dict_insert_elem(const struct elem *e);
 
+/* selects the kernel for this processor (called by backend_init()) */
+void dict_init();
+
 /*
  * Searches the dictionary and returns the best match.
+ * MAX_MATCH_LEN characters at p must be readable.
  *
  * Returns the index of the best match.
  * If no match is found, the function returns (size_t)-1.
  */
 size_t dict_find_match(const char *p);
 
-void dict_update_costs(char *p);
+/* pos is the current position in the stream */
+void dict_update_costs(size_t pos);
 
 int dict_query_elem(struct elem *e);
 
@@ -46,10 +56,36 @@ size_t dict_get_tag_by_index(size_t index);
 
 size_t dict_get_index_by_tag(size_t tag);
 
-void dict_set_last_pos(size_t index, char *p);
+void dict_set_last_pos(size_t index, size_t pos);
 
 void dict_dump();
 
+void dict_save(struct snapshot *s);
+
+/* replaces the empty dictionary */
+void dict_load(struct snapshot *s);
+
+/* empties the dictionary, the allocated memory is kept for reuse */
+void dict_reset();
+
+/* the dictionary of this thread, handed over to another thread */
+struct dict_state {
+	size_t logsize;
+	size_t size;
+	size_t elems;
+	struct elem *dict;
+	size_t capacity;
+};
+
+/* the dictionary of this thread is left as it is, it must not be used until it is replaced by dict_set_state() */
+void dict_get_state(struct dict_state *state);
+
+/* replaces the dictionary of this thread (without freeing it) */
+void dict_set_state(const struct dict_state *state);
+
+/* replaces the dictionary of this thread by a copy of the state, in the storage of this thread */
+void dict_copy(const struct dict_state *state);
+
 void dict_destroy();
 
 #endif
@@ -0,0 +1,69 @@
+#include "estimate.h"
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+/* below this size, the estimate is not reliable */
+#define ESTIMATE_MIN_SIZE 1024
+
+/* the last 4-byte sequence seen for each hash */
+#define HASH_LOGSIZE 12
+
+/* the order-0 entropy (bits per byte) above which the data look random */
+#define MAX_ENTROPY 7.9
+
+/* the data with more repeated 4-byte sequences than 1 / MIN_REPEATS are compressible */
+#define MIN_REPEATS 64
+
+static uint32_t load32(const unsigned char *p)
+{
+	return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+int estimate_incompressible(const void *ptr, size_t size)
+{
+	const unsigned char *p = ptr;
+
+	if (size < ESTIMATE_MIN_SIZE) {
+		return 0;
+	}
+
+	size_t freq[256];
+	uint32_t last[1 << HASH_LOGSIZE];
+
+	memset(freq, 0, sizeof(freq));
+	memset(last, 0, sizeof(last));
+
+	size_t repeats = 0;
+
+	for (size_t i = 0; i + 4 <= size; ++i) {
+		uint32_t v = load32(p + i);
+		uint32_t h = (v * 2654435761U) >> (32 - HASH_LOGSIZE);
+
+		repeats += (last[h] == v);
+		last[h] = v;
+
+		freq[p[i]]++;
+	}
+
+	for (size_t i = size - 3; i < size; ++i) {
+		freq[p[i]]++;
+	}
+
+	if (repeats > size / MIN_REPEATS) {
+		return 0;
+	}
+
+	double entropy = 0;
+
+	for (int c = 0; c < 256; ++c) {
+		if (freq[c] > 0) {
+			double prob = freq[c] / (double)size;
+
+			entropy -= prob * log2(prob);
+		}
+	}
+
+	/* the entropy measured on a finite sample of random data falls short of 8 bits by about 255 / (2 size ln 2) */
+	return entropy > MAX_ENTROPY - 255 / (2 * size * log(2.));
+}
@@ -0,0 +1,16 @@
+/*
+ * Compressibility estimate
+ */
+#ifndef ESTIMATE_H
+#define ESTIMATE_H
+
+#include <stddef.h>
+
+/*
+ * Returns nonzero if the modeling would not pay off on the size bytes at ptr,
+ * i.e., the bytes are nearly uniformly distributed and the 4-byte sequences hardly ever repeat.
+ * Small inputs are never considered incompressible.
+ */
+int estimate_incompressible(const void *ptr, size_t size);
+
+#endif /* ESTIMATE_H */
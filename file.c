@@ -1,8 +1,13 @@
+#define _DEFAULT_SOURCE
 #include "file.h"
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 void fload(void *ptr, size_t size, FILE *stream)
 {
@@ -11,6 +16,17 @@ void fload(void *ptr, size_t size, FILE *stream)
 	}
 }
 
+size_t fload_partial(void *ptr, size_t size, FILE *stream)
+{
+	size_t n = fread(ptr, 1, size, stream);
+
+	if (n < size && ferror(stream)) {
+		abort();
+	}
+
+	return n;
+}
+
 void fsave(void *ptr, size_t size, FILE *stream)
 {
 	if (fwrite(ptr, 1, size, stream) < size) {
@@ -44,6 +60,125 @@ size_t fsize(FILE *stream)
 	return (size_t)end - (size_t)begin;
 }
 
+int fseekable(FILE *stream)
+{
+	return ftell(stream) != (long)-1;
+}
+
+void ftruncate_at(FILE *stream, size_t size)
+{
+	if (fflush(stream) || ftruncate(fileno(stream), (off_t)size)) {
+		fprintf(stderr, "Cannot truncate the file\n");
+		abort();
+	}
+
+	if (fseek(stream, (long)size, SEEK_SET)) {
+		abort();
+	}
+}
+
+static size_t page_size()
+{
+	long size = sysconf(_SC_PAGESIZE);
+
+	return size > 0 ? (size_t)size : 4096;
+}
+
+void *fmap_input(struct fmapping *m, FILE *stream, size_t size, size_t pad)
+{
+	m->base = NULL;
+	m->size = 0;
+
+	long pos = ftell(stream);
+
+	if (pos == (long)-1) {
+		return NULL;
+	}
+
+	/* the offset must be a multiple of the page size */
+	size_t offset = (size_t)pos % page_size();
+	size_t len = offset + size + pad;
+
+	if (len == 0) {
+		return NULL;
+	}
+
+	/* reserve the address space, the anonymous pages are zero */
+	char *base = mmap(NULL, len, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (base == MAP_FAILED) {
+		return NULL;
+	}
+
+	if (size > 0) {
+		/* past the end of the file, the last page is filled with zeros */
+		if (mmap(base, offset + size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fileno(stream), (off_t)pos - (off_t)offset) == MAP_FAILED) {
+			munmap(base, len);
+			return NULL;
+		}
+
+		madvise(base, offset + size, MADV_SEQUENTIAL);
+	}
+
+	m->base = base;
+	m->size = len;
+
+	return base + offset;
+}
+
+void *fmap_output(struct fmapping *m, FILE *stream, size_t size)
+{
+	m->base = NULL;
+	m->size = 0;
+
+	long pos = ftell(stream);
+
+	if (pos == (long)-1 || size == 0) {
+		return NULL;
+	}
+
+	int fd = fileno(stream);
+	struct stat st;
+
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+		return NULL;
+	}
+
+	if (fflush(stream) || ftruncate(fd, (off_t)pos + (off_t)size)) {
+		return NULL;
+	}
+
+	size_t offset = (size_t)pos % page_size();
+
+	char *base = mmap(NULL, offset + size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, (off_t)pos - (off_t)offset);
+
+	if (base == MAP_FAILED) {
+		return NULL;
+	}
+
+	madvise(base, offset + size, MADV_SEQUENTIAL);
+
+	/* the data are in the file, move past them */
+	if (fseek(stream, pos + (long)size, SEEK_SET)) {
+		abort();
+	}
+
+	m->base = base;
+	m->size = offset + size;
+
+	return base + offset;
+}
+
+void funmap(struct fmapping *m)
+{
+	if (m->base != NULL && munmap(m->base, m->size)) {
+		abort();
+	}
+
+	m->base = NULL;
+	m->size = 0;
+}
+
 FILE *force_fopen(const char *pathname, const char *mode, int force)
 {
 	if (force == 0 && access(pathname, F_OK) != -1) {
@@ -53,3 +188,50 @@ FILE *force_fopen(const char *pathname, const char *mode, int force)
 
 	return fopen(pathname, mode);
 }
+
+int fwalk(const char *path, void (*visit)(const char *path, size_t size, void *arg), void *arg)
+{
+	struct stat st;
+
+	if (stat(path, &st) == -1) {
+		return -1;
+	}
+
+	if (S_ISREG(st.st_mode)) {
+		visit(path, (size_t)st.st_size, arg);
+		return 0;
+	}
+
+	if (!S_ISDIR(st.st_mode)) {
+		return 0;
+	}
+
+	DIR *dir = opendir(path);
+
+	if (dir == NULL) {
+		return -1;
+	}
+
+	for (struct dirent *entry; (entry = readdir(dir)) != NULL; ) {
+		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+			continue;
+		}
+
+		char *child = malloc(strlen(path) + strlen(entry->d_name) + 2);
+
+		if (child == NULL) {
+			abort();
+		}
+
+		sprintf(child, "%s/%s", path, entry->d_name);
+
+		/* the files removed meanwhile are skipped */
+		fwalk(child, visit, arg);
+
+		free(child);
+	}
+
+	closedir(dir);
+
+	return 0;
+}
@@ -6,10 +6,45 @@
 
 void fload(void *ptr, size_t size, FILE *stream);
 
+/* read at most size bytes, returns the number of bytes read (less than size at the end of file) */
+size_t fload_partial(void *ptr, size_t size, FILE *stream);
+
 void fsave(void *ptr, size_t size, FILE *stream);
 
 size_t fsize(FILE *stream);
 
+int fseekable(FILE *stream);
+
+/* cuts the file at size bytes and moves to its end */
+void ftruncate_at(FILE *stream, size_t size);
+
+/* a memory-mapped part of a file */
+struct fmapping {
+	void *base;
+	size_t size;
+};
+
+/*
+ * Maps the rest of the file (size bytes from the current position) read-only, followed by pad zero bytes.
+ * Returns NULL if the stream cannot be mapped (the caller falls back to fload).
+ */
+void *fmap_input(struct fmapping *m, FILE *stream, size_t size, size_t pad);
+
+/*
+ * Resizes the output file to hold size bytes from the current position and maps them for writing.
+ * Returns NULL if the stream cannot be mapped (the caller falls back to fsave).
+ */
+void *fmap_output(struct fmapping *m, FILE *stream, size_t size);
+
+/* unmaps the region (if any), the written data stay in the file */
+void funmap(struct fmapping *m);
+
 FILE *force_fopen(const char *pathname, const char *mode, int force);
 
+/*
+ * Calls visit(path, size, arg) for the regular file at the path, or for each regular file in the directory tree at the path.
+ * Returns -1 if the path cannot be read.
+ */
+int fwalk(const char *path, void (*visit)(const char *path, size_t size, void *arg), void *arg);
+
 #endif /* FILE_H */
@@ -0,0 +1,294 @@
+#include "frame.h"
+#include <assert.h>
+#include <string.h>
+
+#include "backend.h"
+
+static const unsigned char frame_magic[4] = { 'X', '3', 0x1a, 0x00 };
+static const unsigned char seek_magic[4] = { 'X', '3', 0x1a, 'S' };
+
+/* in the uncompressed size of the block */
+#define BLOCK_STORED ((uint64_t)1 << 31)
+
+static uint64_t load_le(const unsigned char *p, size_t n)
+{
+	uint64_t v = 0;
+
+	for (size_t i = 0; i < n; ++i) {
+		v |= (uint64_t)p[i] << (8 * i);
+	}
+
+	return v;
+}
+
+static void store_le(unsigned char *p, uint64_t v, size_t n)
+{
+	for (size_t i = 0; i < n; ++i) {
+		p[i] = (unsigned char)(v >> (8 * i));
+	}
+}
+
+void frame_header_init(struct frame_header *header, size_t content_size)
+{
+	assert(header != NULL);
+
+	header->version = FRAME_VERSION;
+	header->flags = FRAME_FLAG_CONTENT_SIZE;
+	header->header_size = FRAME_HEADER_SIZE;
+	header->content_size = content_size;
+	header->forward_window = (uint32_t)get_forward_window();
+	header->max_match_count = (uint32_t)get_max_match_count();
+	header->magic_factor1 = (uint32_t)get_magic_factor1();
+	header->magic_factor2 = (uint32_t)get_magic_factor2();
+	header->block_size = 0;
+	header->prime_size = 0;
+	header->dict_id = 0;
+	header->mem_limit = 0;
+}
+
+/* the size of the header including the optional fields */
+static size_t frame_calc_header_size(unsigned flags)
+{
+	size_t size = FRAME_HEADER_SIZE;
+
+	if (flags & FRAME_FLAG_BLOCKS) {
+		size += 8;
+	}
+
+	if (flags & FRAME_FLAG_DICT) {
+		size += 4;
+	}
+
+	if (flags & FRAME_FLAG_MEM_LIMIT) {
+		size += 4;
+	}
+
+	assert(size <= FRAME_MAX_HEADER_SIZE);
+
+	return size;
+}
+
+void frame_header_set_blocks(struct frame_header *header, size_t block_size, size_t prime_size)
+{
+	assert(block_size > 0 && block_size <= FRAME_MAX_BLOCK_SIZE);
+	assert(prime_size <= block_size);
+
+	header->flags |= FRAME_FLAG_BLOCKS;
+	header->header_size = frame_calc_header_size(header->flags);
+	header->block_size = (uint32_t)block_size;
+	header->prime_size = (uint32_t)prime_size;
+}
+
+void frame_header_set_dict(struct frame_header *header, uint32_t dict_id)
+{
+	header->flags |= FRAME_FLAG_DICT;
+	header->header_size = frame_calc_header_size(header->flags);
+	header->dict_id = dict_id;
+}
+
+void frame_header_set_mem_limit(struct frame_header *header, uint32_t mem_limit)
+{
+	assert(mem_limit > 0);
+
+	header->flags |= FRAME_FLAG_MEM_LIMIT;
+	header->header_size = frame_calc_header_size(header->flags);
+	header->mem_limit = mem_limit;
+}
+
+size_t frame_write_header(const struct frame_header *header, void *ptr)
+{
+	unsigned char *p = ptr;
+
+	assert(header->header_size >= FRAME_HEADER_SIZE);
+
+	memset(p, 0, header->header_size);
+
+	memcpy(p, frame_magic, 4);
+	store_le(p +  4, header->version, 1);
+	store_le(p +  5, header->flags, 1);
+	store_le(p +  6, header->header_size, 2);
+	store_le(p +  8, header->content_size, 8);
+	store_le(p + 16, header->forward_window, 4);
+	store_le(p + 20, header->max_match_count, 4);
+	store_le(p + 24, header->magic_factor1, 4);
+	store_le(p + 28, header->magic_factor2, 4);
+
+	p += FRAME_HEADER_SIZE;
+
+	if (header->flags & FRAME_FLAG_BLOCKS) {
+		store_le(p + 0, header->block_size, 4);
+		store_le(p + 4, header->prime_size, 4);
+		p += 8;
+	}
+
+	if (header->flags & FRAME_FLAG_DICT) {
+		store_le(p, header->dict_id, 4);
+		p += 4;
+	}
+
+	if (header->flags & FRAME_FLAG_MEM_LIMIT) {
+		store_le(p, header->mem_limit, 4);
+		p += 4;
+	}
+
+	return header->header_size;
+}
+
+size_t frame_header_size(const void *ptr, size_t size)
+{
+	const unsigned char *p = ptr;
+
+	if (size < FRAME_HEADER_SIZE || memcmp(p, frame_magic, 4) != 0) {
+		return (size_t)-1;
+	}
+
+	unsigned version = (unsigned)load_le(p + 4, 1);
+	unsigned flags = (unsigned)load_le(p + 5, 1);
+	size_t header_size = (size_t)load_le(p + 6, 2);
+
+	if (version < 1 || version > FRAME_VERSION || (flags & ~FRAME_FLAGS) || header_size < frame_calc_header_size(flags)) {
+		return (size_t)-1;
+	}
+
+	return header_size;
+}
+
+size_t frame_read_header(struct frame_header *header, const void *ptr, size_t size)
+{
+	const unsigned char *p = ptr;
+
+	size_t header_size = frame_header_size(ptr, size);
+
+	if (header_size == (size_t)-1 || header_size > size) {
+		return (size_t)-1;
+	}
+
+	header->version = (unsigned)load_le(p + 4, 1);
+	header->flags = (unsigned)load_le(p + 5, 1);
+	header->header_size = header_size;
+
+	header->content_size = load_le(p + 8, 8);
+	header->forward_window = (uint32_t)load_le(p + 16, 4);
+	header->max_match_count = (uint32_t)load_le(p + 20, 4);
+	header->magic_factor1 = (uint32_t)load_le(p + 24, 4);
+	header->magic_factor2 = (uint32_t)load_le(p + 28, 4);
+
+	p += FRAME_HEADER_SIZE;
+
+	header->block_size = 0;
+	header->prime_size = 0;
+	header->dict_id = 0;
+	header->mem_limit = 0;
+
+	if (header->flags & FRAME_FLAG_BLOCKS) {
+		header->block_size = (uint32_t)load_le(p + 0, 4);
+		header->prime_size = (uint32_t)load_le(p + 4, 4);
+		p += 8;
+
+		if (header->block_size == 0 || header->block_size > FRAME_MAX_BLOCK_SIZE || header->prime_size > header->block_size) {
+			return (size_t)-1;
+		}
+	}
+
+	if (header->flags & FRAME_FLAG_DICT) {
+		header->dict_id = (uint32_t)load_le(p, 4);
+		p += 4;
+	}
+
+	if (header->flags & FRAME_FLAG_MEM_LIMIT) {
+		header->mem_limit = (uint32_t)load_le(p, 4);
+		p += 4;
+
+		if (header->mem_limit == 0) {
+			return (size_t)-1;
+		}
+	}
+
+	return header->header_size;
+}
+
+void frame_print_header(const struct frame_header *header, FILE *stream)
+{
+	fprintf(stream, "format version: %u\n", header->version);
+	fprintf(stream, "header size: %zu\n", header->header_size);
+	if (header->flags & FRAME_FLAG_CONTENT_SIZE) {
+		fprintf(stream, "content size: %llu\n", (unsigned long long)header->content_size);
+	} else {
+		fprintf(stream, "content size: unknown\n");
+	}
+	fprintf(stream, "max match count: %lu\n", (unsigned long)header->max_match_count);
+	fprintf(stream, "forward window: %lu\n", (unsigned long)header->forward_window);
+	fprintf(stream, "magic factor 1: %lu\n", (unsigned long)header->magic_factor1);
+	fprintf(stream, "magic factor 2: %lu\n", (unsigned long)header->magic_factor2);
+	if (header->flags & FRAME_FLAG_BLOCKS) {
+		fprintf(stream, "block size: %lu\n", (unsigned long)header->block_size);
+		fprintf(stream, "prime size: %lu\n", (unsigned long)header->prime_size);
+		fprintf(stream, "seek table: %s\n", (header->flags & FRAME_FLAG_SEEK_TABLE) ? "yes" : "no");
+	}
+	fprintf(stream, "checksum: %s\n", (header->flags & FRAME_FLAG_CHECKSUM) ? "yes" : "no");
+	if (header->flags & FRAME_FLAG_STORED) {
+		fprintf(stream, "stored: %s\n", (header->flags & FRAME_FLAG_BLOCKS) ? "incompressible blocks" : "yes");
+	}
+	if (header->flags & FRAME_FLAG_DICT) {
+		fprintf(stream, "dictionary: %08lx\n", (unsigned long)header->dict_id);
+	}
+	if (header->flags & FRAME_FLAG_MEM_LIMIT) {
+		fprintf(stream, "memory limit: %lu KiB per coder\n", (unsigned long)header->mem_limit);
+	}
+}
+
+size_t frame_bound(size_t size)
+{
+	/* at most 1 : 2 ratio, plus the header, the final bit-buffer flush and the checksum */
+	return FRAME_MAX_HEADER_SIZE + size * 2 + 64 + FRAME_CHECKSUM_SIZE;
+}
+
+void frame_write_block_header(void *ptr, size_t csize, size_t usize, int stored)
+{
+	unsigned char *p = ptr;
+
+	assert(usize < BLOCK_STORED);
+
+	store_le(p + 0, csize, 4);
+	store_le(p + 4, usize | (stored ? BLOCK_STORED : 0), 4);
+}
+
+void frame_read_block_header(const void *ptr, size_t *csize, size_t *usize, int *stored)
+{
+	const unsigned char *p = ptr;
+
+	uint64_t v = load_le(p + 4, 4);
+
+	*csize = (size_t)load_le(p + 0, 4);
+	*usize = (size_t)(v & ~BLOCK_STORED);
+	*stored = (v & BLOCK_STORED) != 0;
+}
+
+void frame_write_checksum(void *ptr, uint32_t crc)
+{
+	store_le(ptr, crc, 4);
+}
+
+uint32_t frame_read_checksum(const void *ptr)
+{
+	return (uint32_t)load_le(ptr, 4);
+}
+
+void frame_write_seek_footer(void *ptr, size_t blocks)
+{
+	unsigned char *p = ptr;
+
+	store_le(p, blocks, 4);
+	memcpy(p + 4, seek_magic, 4);
+}
+
+size_t frame_read_seek_footer(const void *ptr)
+{
+	const unsigned char *p = ptr;
+
+	if (memcmp(p + 4, seek_magic, 4) != 0) {
+		return (size_t)-1;
+	}
+
+	return (size_t)load_le(p, 4);
+}
@@ -0,0 +1,146 @@
+/*
+ * Frame (stream container) header
+ */
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* the version 3 adds the repeats of the preceding data to the bit stream, the version 4 the runs of a single byte; the earlier versions are decoded as well */
+#define FRAME_VERSION 4
+
+/* the size of the fixed part of the header */
+#define FRAME_HEADER_SIZE 32
+
+/* the size of the header with all the optional fields */
+#define FRAME_MAX_HEADER_SIZE (FRAME_HEADER_SIZE + 16)
+
+/* frame flags */
+enum {
+	FRAME_FLAG_CONTENT_SIZE = 1 << 0, /* the content size is known */
+	FRAME_FLAG_BLOCKS       = 1 << 1, /* sequence of independent blocks */
+	FRAME_FLAG_NL           = 1 << 2, /* the encoder used the -x heuristic (matters for priming) */
+	FRAME_FLAG_SEEK_TABLE   = 1 << 3, /* the blocks are followed by the seek table */
+	FRAME_FLAG_CHECKSUM     = 1 << 4, /* CRC-32C of the content and of each block */
+	FRAME_FLAG_DICT         = 1 << 5, /* the coders start from a trained dictionary */
+	FRAME_FLAG_STORED       = 1 << 6, /* the content is stored (or the blocks may be stored) uncompressed */
+	FRAME_FLAG_MEM_LIMIT    = 1 << 7, /* the coders stop growing at the memory limit */
+	FRAME_FLAGS             = (1 << 8) - 1 /* all known flags */
+};
+
+/*
+ * Each block is preceded by its compressed and uncompressed size (32-bit each), a zero-sized block ends the frame.
+ * The top bit of the uncompressed size marks a stored block, the data of which follow as they are (and the checksum).
+ */
+#define FRAME_BLOCK_HEADER_SIZE 8
+
+/*
+ * The seek table follows the empty block: the sizes of all the blocks (an entry is the same as the block header),
+ * and the footer with the number of blocks (32-bit) and the magic, so that the table can be read from the end of the file.
+ */
+#define FRAME_SEEK_ENTRY_SIZE FRAME_BLOCK_HEADER_SIZE
+#define FRAME_SEEK_FOOTER_SIZE 8
+
+/*
+ * With FRAME_FLAG_CHECKSUM, the 32-bit checksum of the content follows the bit stream (or the empty block),
+ * and the bit stream of each block is followed by the checksum of the block data (included in the compressed size).
+ */
+#define FRAME_CHECKSUM_SIZE 4
+
+/* the maximum size of the block */
+#define FRAME_MAX_BLOCK_SIZE ((size_t)1 << 30)
+
+/*
+ * Layout (all fields are little-endian):
+ *
+ *  0  4  magic "X3\x1a\x00"
+ *  4  1  format version
+ *  5  1  flags
+ *  6  2  header size in bytes (the bit stream or the first block starts here)
+ *  8  8  original (uncompressed) size
+ * 16  4  forward window
+ * 20  4  maximum match count
+ * 24  4  magic factor 1
+ * 28  4  magic factor 2
+ *
+ * Optional fields follow, in the order of their flags:
+ *
+ *     4  block size (FRAME_FLAG_BLOCKS)
+ *     4  prime size, the tail of the previous block fed to the model before each block (FRAME_FLAG_BLOCKS)
+ *     4  dictionary ID, the checksum of the dictionary file (FRAME_FLAG_DICT)
+ *     4  memory limit of each coder in kilobytes (FRAME_FLAG_MEM_LIMIT)
+ *
+ * The encoder parameters are informative, they affect decoding only when the blocks are primed.
+ */
+struct frame_header {
+	unsigned version;
+	unsigned flags;
+	size_t header_size;
+	uint64_t content_size;
+	uint32_t forward_window;
+	uint32_t max_match_count;
+	uint32_t magic_factor1;
+	uint32_t magic_factor2;
+	uint32_t block_size;
+	uint32_t prime_size;
+	uint32_t dict_id;
+	uint32_t mem_limit;
+};
+
+/* fill in the current version and the current encoder parameters */
+void frame_header_init(struct frame_header *header, size_t content_size);
+
+/* switch to the frame of blocks */
+void frame_header_set_blocks(struct frame_header *header, size_t block_size, size_t prime_size);
+
+/* the coders start from the dictionary */
+void frame_header_set_dict(struct frame_header *header, uint32_t dict_id);
+
+/* the coders stop growing at the limit (in kilobytes) */
+void frame_header_set_mem_limit(struct frame_header *header, uint32_t mem_limit);
+
+/* returns the number of bytes written (header->header_size) */
+size_t frame_write_header(const struct frame_header *header, void *ptr);
+
+/*
+ * Checks the magic and the version of the header at ptr (size >= FRAME_HEADER_SIZE).
+ *
+ * Returns the size of the whole header.
+ * If the buffer does not start with a supported header, the function returns (size_t)-1.
+ */
+size_t frame_header_size(const void *ptr, size_t size);
+
+/*
+ * Parses the header at ptr.
+ *
+ * Returns the number of bytes consumed.
+ * If the buffer does not start with a supported header, the function returns (size_t)-1.
+ */
+size_t frame_read_header(struct frame_header *header, const void *ptr, size_t size);
+
+void frame_print_header(const struct frame_header *header, FILE *stream);
+
+/* upper bound on the size of the frame holding size bytes of content */
+size_t frame_bound(size_t size);
+
+void frame_write_block_header(void *ptr, size_t csize, size_t usize, int stored);
+
+void frame_read_block_header(const void *ptr, size_t *csize, size_t *usize, int *stored);
+
+void frame_write_checksum(void *ptr, uint32_t crc);
+
+uint32_t frame_read_checksum(const void *ptr);
+
+void frame_write_seek_footer(void *ptr, size_t blocks);
+
+/*
+ * Parses the footer of the seek table.
+ *
+ * Returns the number of blocks.
+ * If the footer is not valid, the function returns (size_t)-1.
+ */
+size_t frame_read_seek_footer(const void *ptr);
+
+#endif /* FRAME_H */
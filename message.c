@@ -0,0 +1,143 @@
+#include "message.h"
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include "coder.h"
+#include "backend.h"
+#include "utils.h"
+
+struct message_buffers {
+	char *data; /* the message followed by the zero padding */
+	size_t capacity;
+	size_t dirty; /* the bytes of data past this are zero */
+	unsigned char *code; /* the bit stream, when the buffer of the caller may be too small */
+	size_t code_capacity;
+};
+
+static THREAD_LOCAL struct message_buffers message = { NULL, 0, 0, NULL, 0 };
+
+/* the storage for the fragments of a message of N bytes is allocated up front for N / 8 of them, more as needed */
+#define MESSAGE_BYTES_PER_FRAGMENT 8
+
+static void message_reserve(size_t size)
+{
+	size_t capacity = size + get_forward_padding();
+
+	if (capacity > message.capacity) {
+		message.data = realloc(message.data, capacity);
+
+		if (message.data == NULL) {
+			abort();
+		}
+
+		memset(message.data + message.capacity, 0, capacity - message.capacity);
+		message.capacity = capacity;
+	}
+
+	if (compress_bound(size) > message.code_capacity) {
+		free(message.code);
+
+		message.code_capacity = compress_bound(size);
+		message.code = malloc(message.code_capacity);
+
+		if (message.code == NULL) {
+			abort();
+		}
+	}
+}
+
+void message_open(size_t max_size)
+{
+	size_t capacity = 1;
+
+	while (capacity < max_size / MESSAGE_BYTES_PER_FRAGMENT) {
+		capacity <<= 1;
+	}
+
+	keep_storage(1);
+
+	/* the storage is grown past the doubling steps of the dictionary and of the contexts, the coder itself stays empty */
+	create();
+	preallocate_storage(capacity);
+	destroy();
+
+	message_reserve(max_size);
+}
+
+void message_close()
+{
+	keep_storage(0);
+
+	free(message.data);
+	free(message.code);
+
+	message.data = NULL;
+	message.capacity = 0;
+	message.dirty = 0;
+	message.code = NULL;
+	message.code_capacity = 0;
+}
+
+size_t message_bound(size_t size)
+{
+	return compress_bound(size);
+}
+
+size_t message_compress(const void *src, size_t size, void *dst, size_t capacity)
+{
+	message_reserve(size);
+
+	memcpy(message.data, src, size);
+
+	/* the padding, over what the previous message left */
+	if (message.dirty > size) {
+		memset(message.data + size, 0, message.dirty - size);
+	}
+
+	message.dirty = size;
+
+	/* directly into dst, unless the bit stream might overflow it */
+	unsigned char *optr = capacity >= compress_bound(size) ? dst : message.code;
+
+	create();
+
+	size_t csize = compress_buffer(message.data, size, optr);
+
+	destroy();
+
+	if (optr != dst) {
+		if (csize > capacity) {
+			return (size_t)-1;
+		}
+
+		memcpy(dst, optr, csize);
+	}
+
+	return csize;
+}
+
+int message_decompress(const void *src, size_t csize, void *dst, size_t size)
+{
+	jmp_buf recovery;
+
+	create();
+
+	/* a corrupted stream returns here, the coder is left as it was at that point and is reset by the next create() */
+	if (setjmp(recovery) != 0) {
+		set_recovery(NULL);
+		destroy();
+
+		return -1;
+	}
+
+	set_recovery(&recovery);
+
+	/* the bit stream is only read */
+	decompress_buffer((unsigned char *)src, csize, dst, size);
+
+	set_recovery(NULL);
+
+	destroy();
+
+	return 0;
+}
@@ -0,0 +1,33 @@
+/*
+ * Small messages (e.g., RPC payloads), each coded as a standalone bit stream without the frame
+ */
+#ifndef MESSAGE_H
+#define MESSAGE_H
+
+#include <stddef.h>
+
+/*
+ * The coder of this thread keeps its storage between message_open() and message_close(),
+ * so the setup of a message is a reset of the parts in use instead of the allocations.
+ * The messages are usually at most max_size bytes (the larger ones are coded as well).
+ */
+void message_open(size_t max_size);
+
+void message_close();
+
+/* the size of the buffer which always holds the bit stream of a message of size bytes */
+size_t message_bound(size_t size);
+
+/*
+ * Compress the message into dst (capacity bytes, message_bound(size) is always enough).
+ * Returns the size of the bit stream, or (size_t)-1 if it does not fit (the message may be stored as it is).
+ */
+size_t message_compress(const void *src, size_t size, void *dst, size_t capacity);
+
+/*
+ * Decompress the bit stream [src, src + csize) holding exactly size bytes into dst (the caller keeps the size).
+ * Returns 0, or -1 if the bit stream is corrupted (the content of dst is undefined then).
+ */
+int message_decompress(const void *src, size_t csize, void *dst, size_t size);
+
+#endif /* MESSAGE_H */
@@ -0,0 +1,80 @@
+#define _DEFAULT_SOURCE
+#include "perf.h"
+
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#	include <sys/syscall.h>
+#	include <linux/perf_event.h>
+
+static const uint64_t perf_config[PERF_LAST][2] = {
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES }
+};
+
+static int perf_open_counter(int c)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+
+	attr.size = sizeof(attr);
+	attr.type = (uint32_t)perf_config[c][0];
+	attr.config = perf_config[c][1];
+	attr.inherit = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	/* this process on any processor */
+	return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#else
+static int perf_open_counter(int c)
+{
+	(void)c;
+
+	return -1;
+}
+#endif
+
+int perf_open(struct perf *perf)
+{
+	int n = 0;
+
+	for (int c = 0; c < PERF_LAST; ++c) {
+		perf->fd[c] = perf_open_counter(c);
+
+		if (perf->fd[c] >= 0) {
+			n++;
+		}
+	}
+
+	return n;
+}
+
+void perf_read(const struct perf *perf, uint64_t values[PERF_LAST])
+{
+	for (int c = 0; c < PERF_LAST; ++c) {
+		uint64_t value;
+
+		if (perf->fd[c] < 0 || read(perf->fd[c], &value, sizeof(value)) != (ssize_t)sizeof(value)) {
+			value = PERF_NONE;
+		}
+
+		values[c] = value;
+	}
+}
+
+void perf_close(struct perf *perf)
+{
+	for (int c = 0; c < PERF_LAST; ++c) {
+		if (perf->fd[c] >= 0) {
+			close(perf->fd[c]);
+		}
+
+		perf->fd[c] = -1;
+	}
+}
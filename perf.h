@@ -0,0 +1,36 @@
+/*
+ * Hardware performance counters
+ */
+#ifndef PERF_H
+#define PERF_H
+
+#include <stdint.h>
+
+enum {
+	PERF_CYCLES = 0,
+	PERF_INSTRUCTIONS,
+	PERF_LLC_MISSES,
+	PERF_BRANCH_MISSES,
+	PERF_LAST
+};
+
+/* not available */
+#define PERF_NONE ((uint64_t)-1)
+
+struct perf {
+	int fd[PERF_LAST]; /* -1 if the counter could not be opened */
+};
+
+/*
+ * Starts counting in the process (including the threads created later), in the user space.
+ * The counters not permitted (or not supported) are left out.
+ * Returns the number of counters opened.
+ */
+int perf_open(struct perf *perf);
+
+/* the values counted so far, PERF_NONE for the counters not opened */
+void perf_read(const struct perf *perf, uint64_t values[PERF_LAST]);
+
+void perf_close(struct perf *perf);
+
+#endif /* PERF_H */
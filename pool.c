@@ -0,0 +1,103 @@
+#define _POSIX_C_SOURCE 200809L
+#include "pool.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <unistd.h>
+
+struct pool {
+	pthread_mutex_t mutex;
+	size_t next; /* next task */
+	size_t n;
+	void (*task)(void *arg, size_t i);
+	void (*cleanup)(void *arg);
+	void *arg;
+};
+
+static void *pool_worker(void *p)
+{
+	struct pool *pool = p;
+
+	for (;;) {
+		pthread_mutex_lock(&pool->mutex);
+		size_t i = pool->next;
+		if (i < pool->n) {
+			pool->next++;
+		}
+		pthread_mutex_unlock(&pool->mutex);
+
+		if (i >= pool->n) {
+			break;
+		}
+
+		pool->task(pool->arg, i);
+	}
+
+	if (pool->cleanup != NULL) {
+		pool->cleanup(pool->arg);
+	}
+
+	return NULL;
+}
+
+void pool_run(size_t threads, size_t n, void (*task)(void *arg, size_t i), void *arg)
+{
+	pool_run_cleanup(threads, n, task, NULL, arg);
+}
+
+void pool_run_cleanup(size_t threads, size_t n, void (*task)(void *arg, size_t i), void (*cleanup)(void *arg), void *arg)
+{
+	if (threads > n) {
+		threads = n;
+	}
+
+	if (threads <= 1) {
+		for (size_t i = 0; i < n; ++i) {
+			task(arg, i);
+		}
+		if (cleanup != NULL) {
+			cleanup(arg);
+		}
+		return;
+	}
+
+	struct pool pool;
+
+	pool.next = 0;
+	pool.n = n;
+	pool.task = task;
+	pool.cleanup = cleanup;
+	pool.arg = arg;
+
+	if (pthread_mutex_init(&pool.mutex, NULL)) {
+		abort();
+	}
+
+	pthread_t *thread = malloc(threads * sizeof(pthread_t));
+
+	if (thread == NULL) {
+		abort();
+	}
+
+	for (size_t t = 0; t < threads; ++t) {
+		if (pthread_create(&thread[t], NULL, pool_worker, &pool)) {
+			fprintf(stderr, "Cannot create thread\n");
+			abort();
+		}
+	}
+
+	for (size_t t = 0; t < threads; ++t) {
+		pthread_join(thread[t], NULL);
+	}
+
+	free(thread);
+
+	pthread_mutex_destroy(&pool.mutex);
+}
+
+size_t pool_get_cpus()
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return n > 0 ? (size_t)n : 1;
+}
@@ -0,0 +1,23 @@
+/*
+ * Worker threads
+ */
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+/*
+ * Runs task(arg, i) for each i in [0, n) on at most threads worker threads.
+ * The tasks are handed out in order of i, as the workers become free.
+ * Returns when all the tasks are done.
+ * With a single thread, the tasks run on the calling thread.
+ */
+void pool_run(size_t threads, size_t n, void (*task)(void *arg, size_t i), void *arg);
+
+/* the same, and each worker calls cleanup(arg) after its last task (on its own thread) */
+void pool_run_cleanup(size_t threads, size_t n, void (*task)(void *arg, size_t i), void (*cleanup)(void *arg), void *arg);
+
+/* number of online processors */
+size_t pool_get_cpus();
+
+#endif /* POOL_H */
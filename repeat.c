@@ -0,0 +1,132 @@
+#include "repeat.h"
+#include <stdlib.h>
+#include <string.h>
+#include "utils.h"
+
+/* every REP_STEP-th position of the stream is kept, so a repeat is looked up at REP_STEP positions */
+#define REP_STEP 4
+
+#define REP_HASH_LOG 18
+
+/* the hash covers this many bytes */
+#define REP_HASH_LEN 16
+
+/* an entry holds the generation in the high bits and the position + 1 in the low ones, 0 = empty */
+#define REP_POS_BITS 40
+#define REP_POS_MASK (((uint64_t)1 << REP_POS_BITS) - 1)
+#define REP_GENERATIONS ((uint64_t)1 << (64 - REP_POS_BITS))
+
+/* the last position of each hash, allocated on the first use (only the encoder uses it) */
+THREAD_LOCAL uint64_t *rep_table = NULL;
+
+/* the entries of the other generations are stale */
+THREAD_LOCAL uint64_t rep_generation = 1;
+
+void repeat_reset()
+{
+	rep_generation++;
+
+	/* wrapped around, the oldest entries would look current */
+	if (rep_generation == REP_GENERATIONS) {
+		if (rep_table != NULL) {
+			memset(rep_table, 0, ((size_t)1 << REP_HASH_LOG) * sizeof(uint64_t));
+		}
+
+		rep_generation = 1;
+	}
+}
+
+void repeat_destroy()
+{
+	free(rep_table);
+
+	rep_table = NULL;
+}
+
+static void repeat_alloc()
+{
+	if (rep_table == NULL) {
+		rep_table = calloc((size_t)1 << REP_HASH_LOG, sizeof(uint64_t));
+
+		if (rep_table == NULL) {
+			abort();
+		}
+	}
+}
+
+/* of the REP_HASH_LEN bytes at p */
+static size_t repeat_hash(const char *p)
+{
+	uint64_t a, b;
+
+	memcpy(&a, p, 8);
+	memcpy(&b, p + 8, 8);
+
+	return (size_t)(((a * 0x9e3779b97f4a7c15ULL) ^ (b * 0xc2b2ae3d27d4eb4fULL)) >> (64 - REP_HASH_LOG));
+}
+
+void repeat_insert(const char *p, size_t len, const char *limit, size_t pos)
+{
+	repeat_alloc();
+
+	/* the first position of the step */
+	size_t i = (REP_STEP - pos % REP_STEP) % REP_STEP;
+
+	for (; i < len && (size_t)(limit - p) >= i + REP_HASH_LEN && pos + i < REP_POS_MASK; i += REP_STEP) {
+		rep_table[repeat_hash(p + i)] = rep_generation << REP_POS_BITS | (pos + i + 1);
+	}
+}
+
+size_t repeat_find(const char *p, size_t max_len, size_t pos, size_t history, size_t *dist)
+{
+	if (max_len < REP_MIN_LEN) {
+		return 0;
+	}
+
+	repeat_alloc();
+
+	size_t best = 0;
+
+	/* one of the positions is at the step of the earlier occurrence */
+	for (size_t j = 0; j < REP_STEP; ++j) {
+		uint64_t e = rep_table[repeat_hash(p + j)];
+		size_t c = (size_t)(e & REP_POS_MASK);
+
+		if ((e >> REP_POS_BITS) != rep_generation || c == 0 || c - 1 >= pos + j) {
+			continue;
+		}
+
+		/* the same distance at p */
+		size_t d = pos + j - (c - 1);
+
+		if (d > history) {
+			continue;
+		}
+
+		const char *s = p - d;
+		size_t len = 0;
+
+		while (len < max_len && s[len] == p[len]) {
+			len++;
+		}
+
+		if (len > best) {
+			best = len;
+			*dist = d;
+		}
+	}
+
+	return best >= REP_MIN_LEN ? best : 0;
+}
+
+void repeat_get_state(struct repeat_state *state)
+{
+	state->table = rep_table;
+	state->generation = rep_generation;
+}
+
+void repeat_set_state(const struct repeat_state *state)
+{
+	rep_table = state->table;
+	rep_generation = state->generation;
+}
@@ -0,0 +1,51 @@
+/*
+ * Finder of the long repeats of the preceding data (E_REP)
+ */
+#ifndef REPEAT_H
+#define REPEAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* the repeats are at least this long, the shorter ones are cheaper as the fragments of the dictionary */
+#define REP_MIN_LEN 64
+
+/* and at most this long, a longer repeat takes several tokens */
+#define REP_MAX_LEN ((size_t)1 << 16)
+
+/* the repeat starts at most this far back */
+#define REP_WINDOW ((size_t)1 << 22)
+
+/* forgets the positions, in O(1) */
+void repeat_reset();
+
+void repeat_destroy();
+
+/*
+ * Keeps the positions of the fragment [p, p + len) at pos in the stream.
+ * The data (or the padding) up to limit are readable, the positions closer to it are skipped.
+ */
+void repeat_insert(const char *p, size_t len, const char *limit, size_t pos);
+
+/*
+ * Searches the positions for the longest repeat of the data at p (at pos in the stream),
+ * starting at most history bytes back, of at most max_len bytes (max_len bytes at p must be valid).
+ *
+ * Returns the length of the repeat, and its distance in *dist.
+ * If no repeat of at least REP_MIN_LEN bytes is found, the function returns 0.
+ */
+size_t repeat_find(const char *p, size_t max_len, size_t pos, size_t history, size_t *dist);
+
+/* the positions of this thread, handed over to another thread */
+struct repeat_state {
+	uint64_t *table;
+	uint64_t generation;
+};
+
+/* the positions of this thread are left as they are, they must not be used until they are replaced by repeat_set_state() */
+void repeat_get_state(struct repeat_state *state);
+
+/* replaces the positions of this thread (without freeing them) */
+void repeat_set_state(const struct repeat_state *state);
+
+#endif /* REPEAT_H */
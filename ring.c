@@ -0,0 +1,77 @@
+#define _POSIX_C_SOURCE 200809L
+#include "ring.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+
+/* busy-wait this many times before giving up the processor */
+#define RING_SPINS 256
+
+void ring_create(struct ring *r, size_t elem_size, size_t capacity)
+{
+	size_t c = 1;
+
+	while (c < capacity) {
+		c <<= 1;
+	}
+
+	r->buffer = malloc(c * elem_size);
+
+	if (r->buffer == NULL) {
+		abort();
+	}
+
+	r->elem_size = elem_size;
+	r->capacity = c;
+	r->head = 0;
+	r->tail_cache = 0;
+	r->tail = 0;
+	r->head_cache = 0;
+}
+
+void ring_destroy(struct ring *r)
+{
+	free(r->buffer);
+
+	r->buffer = NULL;
+}
+
+static void ring_wait(unsigned *spins)
+{
+	if (++*spins > RING_SPINS) {
+		sched_yield();
+	}
+}
+
+void ring_push(struct ring *r, const void *elem)
+{
+	size_t head = r->head;
+
+	/* the consumer is read only when the ring looks full */
+	if (head - r->tail_cache == r->capacity) {
+		for (unsigned spins = 0; head - (r->tail_cache = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE)) == r->capacity; ) {
+			ring_wait(&spins);
+		}
+	}
+
+	memcpy(r->buffer + (head & (r->capacity - 1)) * r->elem_size, elem, r->elem_size);
+
+	/* the element is written before it is published */
+	__atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void ring_pop(struct ring *r, void *elem)
+{
+	size_t tail = r->tail;
+
+	if (r->head_cache == tail) {
+		for (unsigned spins = 0; (r->head_cache = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE)) == tail; ) {
+			ring_wait(&spins);
+		}
+	}
+
+	memcpy(elem, r->buffer + (tail & (r->capacity - 1)) * r->elem_size, r->elem_size);
+
+	/* the element is read before the slot is handed back */
+	__atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,36 @@
+/*
+ * Lock-free ring between a single producer and a single consumer thread
+ */
+#ifndef RING_H
+#define RING_H
+
+#include <stddef.h>
+
+/* the indices are on their own cache lines, each is written by one side only */
+#define RING_LINE 64
+
+struct ring {
+	unsigned char *buffer;
+	size_t elem_size;
+	size_t capacity; /* in elements, a power of two */
+	char pad0[RING_LINE];
+	size_t head; /* elements pushed, written by the producer */
+	size_t tail_cache; /* the last tail seen by the producer */
+	char pad1[RING_LINE];
+	size_t tail; /* elements popped, written by the consumer */
+	size_t head_cache; /* the last head seen by the consumer */
+	char pad2[RING_LINE];
+};
+
+/* the capacity is rounded up to a power of two */
+void ring_create(struct ring *r, size_t elem_size, size_t capacity);
+
+void ring_destroy(struct ring *r);
+
+/* the producer side, waits while the ring is full */
+void ring_push(struct ring *r, const void *elem);
+
+/* the consumer side, waits while the ring is empty */
+void ring_pop(struct ring *r, void *elem);
+
+#endif /* RING_H */
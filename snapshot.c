@@ -0,0 +1,106 @@
+#include "snapshot.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+void snapshot_create(struct snapshot *s)
+{
+	s->ptr = NULL;
+	s->size = 0;
+	s->capacity = 0;
+	s->pos = 0;
+}
+
+void snapshot_open(struct snapshot *s, const void *ptr, size_t size)
+{
+	s->ptr = (unsigned char *)ptr;
+	s->size = size;
+	s->capacity = 0;
+	s->pos = 0;
+}
+
+void snapshot_destroy(struct snapshot *s)
+{
+	free(s->ptr);
+
+	snapshot_create(s);
+}
+
+static void snapshot_corrupted()
+{
+	fprintf(stderr, "Corrupted dictionary\n");
+	abort();
+}
+
+void snapshot_put_bytes(struct snapshot *s, const void *ptr, size_t size)
+{
+	if (s->size + size > s->capacity) {
+		s->capacity = 2 * (s->size + size);
+		s->ptr = realloc(s->ptr, s->capacity);
+
+		if (s->ptr == NULL) {
+			abort();
+		}
+	}
+
+	memcpy(s->ptr + s->size, ptr, size);
+	s->size += size;
+}
+
+void snapshot_put(struct snapshot *s, uint64_t v)
+{
+	unsigned char buf[10];
+	size_t n = 0;
+
+	/* 7 bits per byte, the high bit marks the continuation */
+	do {
+		buf[n++] = (unsigned char)((v & 0x7f) | (v > 0x7f ? 0x80 : 0));
+		v >>= 7;
+	} while (v > 0);
+
+	snapshot_put_bytes(s, buf, n);
+}
+
+void snapshot_get_bytes(struct snapshot *s, void *ptr, size_t size)
+{
+	if (size > s->size - s->pos) {
+		snapshot_corrupted();
+	}
+
+	memcpy(ptr, s->ptr + s->pos, size);
+	s->pos += size;
+}
+
+uint64_t snapshot_get(struct snapshot *s)
+{
+	uint64_t v = 0;
+
+	for (int shift = 0; shift < 64; shift += 7) {
+		if (s->pos == s->size) {
+			snapshot_corrupted();
+		}
+
+		unsigned char b = s->ptr[s->pos++];
+
+		v |= (uint64_t)(b & 0x7f) << shift;
+
+		if ((b & 0x80) == 0) {
+			return v;
+		}
+	}
+
+	snapshot_corrupted();
+
+	return 0;
+}
+
+size_t snapshot_get_size(struct snapshot *s, size_t limit)
+{
+	uint64_t v = snapshot_get(s);
+
+	if (v > limit) {
+		snapshot_corrupted();
+	}
+
+	return (size_t)v;
+}
@@ -0,0 +1,38 @@
+/*
+ * Serialization of the coder state
+ */
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct snapshot {
+	unsigned char *ptr; /* the data (not modified when reading) */
+	size_t size;     /* of the data */
+	size_t capacity; /* allocated, when writing */
+	size_t pos;      /* when reading */
+};
+
+/* an empty snapshot for writing */
+void snapshot_create(struct snapshot *s);
+
+/* read the snapshot from the memory (not copied) */
+void snapshot_open(struct snapshot *s, const void *ptr, size_t size);
+
+/* free the data of the snapshot created for writing */
+void snapshot_destroy(struct snapshot *s);
+
+/* the values are stored as variable-length integers (LEB128) */
+void snapshot_put(struct snapshot *s, uint64_t v);
+
+void snapshot_put_bytes(struct snapshot *s, const void *ptr, size_t size);
+
+uint64_t snapshot_get(struct snapshot *s);
+
+/* get a value, it must not exceed the limit (the snapshot is corrupted otherwise) */
+size_t snapshot_get_size(struct snapshot *s, size_t limit);
+
+void snapshot_get_bytes(struct snapshot *s, void *ptr, size_t size);
+
+#endif /* SNAPSHOT_H */
@@ -2,11 +2,15 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include "utils.h"
 
 /* map: (tag, tag) -> index */
-struct tag_pair *map0; /* root of tree */
-size_t tag_pair_elems;
-size_t tag_pair_size; /* allocated */
+THREAD_LOCAL struct tag_pair *map0; /* root of tree */
+THREAD_LOCAL size_t tag_pair_elems;
+THREAD_LOCAL size_t tag_pair_size; /* allocated */
+
+/* the nodes released by tag_pair_reset(), linked by l */
+THREAD_LOCAL struct tag_pair *tag_pair_pool = NULL;
 
 void tag_pair_create()
 {
@@ -92,6 +96,35 @@ void tag_pair_free(struct tag_pair *this)
 	}
 }
 
+static struct tag_pair *tag_pair_alloc()
+{
+	struct tag_pair *this = tag_pair_pool;
+
+	if (this != NULL) {
+		tag_pair_pool = this->l;
+
+		return this;
+	}
+
+	this = malloc(sizeof(struct tag_pair));
+
+	if (this == NULL) {
+		abort();
+	}
+
+	return this;
+}
+
+static void tag_pair_release(struct tag_pair *this)
+{
+	if (this != NULL) {
+		tag_pair_release(this->l);
+		tag_pair_release(this->r);
+		this->l = tag_pair_pool;
+		tag_pair_pool = this;
+	}
+}
+
 int tag_pair_can_add()
 {
 	return tag_pair_elems != tag_pair_size;
@@ -113,11 +146,7 @@ size_t tag_pair_add(struct tag_pair *pair)
 		}
 	}
 
-	*this = malloc(sizeof(struct tag_pair));
-
-	if (*this == NULL) {
-		abort();
-	}
+	*this = tag_pair_alloc();
 
 	**this = *pair;
 	(*this)->e = tag_pair_elems;
@@ -129,7 +158,131 @@ size_t tag_pair_add(struct tag_pair *pair)
 	return tag_pair_elems - 1;
 }
 
+void tag_pair_reset()
+{
+	tag_pair_release(map0);
+
+	tag_pair_create();
+}
+
+void tag_pair_preallocate(size_t count)
+{
+	for (size_t i = 0; i < count; ++i) {
+		struct tag_pair *this = malloc(sizeof(struct tag_pair));
+
+		if (this == NULL) {
+			abort();
+		}
+
+		this->l = tag_pair_pool;
+		tag_pair_pool = this;
+	}
+}
+
 void tag_pair_destroy()
 {
 	tag_pair_free(map0);
+
+	map0 = NULL;
+
+	while (tag_pair_pool != NULL) {
+		struct tag_pair *next = tag_pair_pool->l;
+
+		free(tag_pair_pool);
+
+		tag_pair_pool = next;
+	}
+}
+
+void tag_pair_get_state(struct tag_pair_state *state)
+{
+	state->map = map0;
+	state->elems = tag_pair_elems;
+	state->size = tag_pair_size;
+}
+
+void tag_pair_set_state(const struct tag_pair_state *state)
+{
+	map0 = state->map;
+	tag_pair_elems = state->elems;
+	tag_pair_size = state->size;
+}
+
+static struct tag_pair *tag_pair_copy_node(const struct tag_pair *that)
+{
+	if (that == NULL) {
+		return NULL;
+	}
+
+	struct tag_pair *this = tag_pair_alloc();
+
+	this->tag0 = that->tag0;
+	this->tag1 = that->tag1;
+	this->e = that->e;
+	this->l = tag_pair_copy_node(that->l);
+	this->r = tag_pair_copy_node(that->r);
+
+	return this;
+}
+
+void tag_pair_copy(const struct tag_pair_state *state)
+{
+	assert(map0 == NULL);
+
+	tag_pair_elems = state->elems;
+	tag_pair_size = state->size;
+
+	map0 = tag_pair_copy_node(state->map);
+}
+
+/* pre-order, each node is preceded by a flag */
+static void tag_pair_save_node(struct snapshot *s, const struct tag_pair *this)
+{
+	snapshot_put(s, this != NULL);
+
+	if (this != NULL) {
+		snapshot_put(s, this->tag0);
+		snapshot_put(s, this->tag1);
+		snapshot_put(s, this->e);
+		tag_pair_save_node(s, this->l);
+		tag_pair_save_node(s, this->r);
+	}
+}
+
+void tag_pair_save(struct snapshot *s)
+{
+	snapshot_put(s, tag_pair_elems);
+	snapshot_put(s, tag_pair_size);
+	tag_pair_save_node(s, map0);
+}
+
+static struct tag_pair *tag_pair_load_node(struct snapshot *s)
+{
+	if (snapshot_get_size(s, 1) == 0) {
+		return NULL;
+	}
+
+	struct tag_pair *this = tag_pair_alloc();
+
+	this->tag0 = (size_t)snapshot_get(s);
+	this->tag1 = (size_t)snapshot_get(s);
+	this->e = snapshot_get_size(s, tag_pair_elems - 1);
+	this->l = tag_pair_load_node(s);
+	this->r = tag_pair_load_node(s);
+
+	return this;
+}
+
+void tag_pair_load(struct snapshot *s)
+{
+	assert(map0 == NULL);
+
+	tag_pair_elems = (size_t)snapshot_get(s);
+	tag_pair_size = (size_t)snapshot_get(s);
+
+	if (tag_pair_elems > tag_pair_size) {
+		abort();
+	}
+
+	map0 = tag_pair_load_node(s);
 }
@@ -5,6 +5,7 @@
 #define TAG_PAIR
 
 #include <stddef.h>
+#include "snapshot.h"
 
 struct tag_pair {
 	size_t tag0;
@@ -29,4 +30,33 @@ size_t tag_pair_add(struct tag_pair *pair);
 void tag_pair_create();
 void tag_pair_destroy();
 
+/* frees the nodes of the tree */
+void tag_pair_free(struct tag_pair *this);
+
+/* empties the map, the nodes are kept for reuse */
+void tag_pair_reset();
+
+/* allocates count more nodes up front */
+void tag_pair_preallocate(size_t count);
+
+struct tag_pair_state {
+	struct tag_pair *map;
+	size_t elems;
+	size_t size;
+};
+
+/* the map of this thread is left as it is, it must not be used until it is replaced by tag_pair_set_state() */
+void tag_pair_get_state(struct tag_pair_state *state);
+
+/* replaces the map of this thread (without freeing it) */
+void tag_pair_set_state(const struct tag_pair_state *state);
+
+/* replaces the empty map by a copy of the state, the nodes are taken from those kept for reuse first */
+void tag_pair_copy(const struct tag_pair_state *state);
+
+void tag_pair_save(struct snapshot *s);
+
+/* replaces the empty map */
+void tag_pair_load(struct snapshot *s);
+
 #endif /* TAG_PAIR */
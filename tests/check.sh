@@ -0,0 +1,506 @@
+#!/bin/sh
+#
+# The regression cases of `make check`, run from the top directory after `make all bench_micro x3trace`.
+# Usage: tests/check.sh [CASE...] (all the cases by default)
+#
+
+X3=./x3
+TESTS=$(dirname "$0")
+TMP=$(mktemp -d)
+
+trap 'rm -rf "$TMP"' EXIT
+
+fail()
+{
+	echo "FAILED: $*"
+	exit 1
+}
+
+# pseudo-random words (an LCG, the same bytes on each run), $1 bytes with the seed $2
+gen_text()
+{
+	awk -v size="$1" -v seed="$2" 'BEGIN {
+		words = split("the of and to in is that for it as with was on be by this are from at or an have not", w, " ");
+		s = seed; n = 0;
+		while (n < size) {
+			s = (s * 69069 + 1) % 4294967296;
+			word = w[int(s / 65536) % words + 1];
+			if (int(s / 256) % 13 == 0) { word = word "\n"; } else { word = word " "; }
+			printf "%s", word;
+			n += length(word);
+		}
+	}' | head -c "$1"
+}
+
+gen_random()
+{
+	head -c "$1" /dev/urandom
+}
+
+gen_zero()
+{
+	head -c "$1" /dev/zero
+}
+
+# overwrite the byte at the offset $2 of the file $1 with another value
+corrupt()
+{
+	cp "$1" "$1.orig"
+	printf A | dd of="$1" bs=1 seek="$2" conv=notrunc 2> /dev/null
+	cmp -s "$1" "$1.orig" && printf B | dd of="$1" bs=1 seek="$2" conv=notrunc 2> /dev/null
+	rm "$1.orig"
+}
+
+# compress $1 with the options up to --, decompress it with the rest, the result must be the same
+roundtrip()
+{
+	input=$1
+	shift
+
+	zopts=
+	while [ $# -gt 0 ] && [ "$1" != "--" ]; do
+		zopts="$zopts $1"
+		shift
+	done
+	[ $# -gt 0 ] && shift
+
+	$X3 -zf $zopts "$input" "$TMP/rt.x3" > /dev/null 2>&1 || fail "compress $input ($zopts)"
+	$X3 -df "$@" "$TMP/rt.x3" "$TMP/rt.out" > /dev/null 2>&1 || fail "decompress $input ($zopts -- $*)"
+	cmp -s "$input" "$TMP/rt.out" || fail "round trip of $input ($zopts -- $*)"
+}
+
+# the inputs of the cases
+gen_text 32768 1 > "$TMP/text.bin"
+gen_random 16384 > "$TMP/random.bin"
+gen_zero 0 > "$TMP/empty.bin"
+printf x > "$TMP/one.bin"
+cat "$TMP/text.bin" "$TMP/random.bin" > "$TMP/mixed.bin"
+
+# the bit buffer: the edges of the bit stream, and the pending bits of the long runs of likely events
+check_bio()
+{
+	for f in text random empty one mixed; do
+		roundtrip "$TMP/$f.bin"
+	done
+
+	gen_zero 100000 > "$TMP/zero.bin"
+	roundtrip "$TMP/zero.bin"
+}
+
+# the statistics (on the standard error) do not change the output, the JSON counts the whole input
+check_stats()
+{
+	$X3 -zf "$TMP/text.bin" "$TMP/plain.x3" > /dev/null 2>&1 || fail "compress"
+	$X3 -zf -s "$TMP/text.bin" "$TMP/stats.x3" > /dev/null 2> "$TMP/stats.txt" || fail "compress with -s"
+	cmp -s "$TMP/plain.x3" "$TMP/stats.x3" || fail "-s changes the output"
+	grep -q "output stream size" "$TMP/stats.txt" || fail "-s prints no statistics"
+
+	$X3 -zf --stats=json "$TMP/text.bin" "$TMP/stats.x3" > /dev/null 2> "$TMP/stats.json" || fail "compress with --stats=json"
+	cmp -s "$TMP/plain.x3" "$TMP/stats.x3" || fail "--stats=json changes the output"
+	grep -q '"input_size":32768,' "$TMP/stats.json" || fail "--stats=json input size"
+
+	$X3 -df --stats=json "$TMP/stats.x3" "$TMP/stats.out" > /dev/null 2> "$TMP/stats.json" || fail "decompress with --stats=json"
+	grep -q '"mode":"decompress"' "$TMP/stats.json" || fail "--stats=json when decompressing"
+	cmp -s "$TMP/text.bin" "$TMP/stats.out" || fail "round trip with --stats=json"
+}
+
+# the header records the content size, the truncated and the foreign streams are rejected
+check_header()
+{
+	$X3 -zf "$TMP/text.bin" "$TMP/header.x3" > /dev/null 2>&1 || fail "compress"
+	$X3 -l "$TMP/header.x3" 2> /dev/null | grep -q "content size: 32768" || fail "-l content size"
+
+	size=$(wc -c < "$TMP/header.x3")
+	head -c $((size - 5)) "$TMP/header.x3" > "$TMP/truncated.x3"
+	$X3 -df "$TMP/truncated.x3" "$TMP/header.out" > /dev/null 2>&1 && fail "truncated stream accepted"
+	$X3 -df "$TMP/text.bin" "$TMP/header.out" > /dev/null 2>&1 && fail "not a stream accepted"
+	cp "$TMP/header.x3" "$TMP/version0.x3"
+	printf '\000' | dd of="$TMP/version0.x3" bs=1 seek=4 conv=notrunc 2> /dev/null
+	$X3 -df "$TMP/version0.x3" "$TMP/header.out" > /dev/null 2>&1 && fail "version 0 accepted"
+
+	# without the content size (from a pipe)
+	$X3 -z < "$TMP/text.bin" > "$TMP/header.x3" 2> /dev/null || fail "compress from a pipe"
+	$X3 -d < "$TMP/header.x3" > "$TMP/header.out" 2> /dev/null || fail "decompress into a pipe"
+	cmp -s "$TMP/text.bin" "$TMP/header.out" || fail "round trip through the pipes"
+}
+
+# the streaming mode gives the same output as the whole file, also across the edge of the 1 MiB chunk and without the window
+check_stream()
+{
+	{ gen_zero 1040000; head -c 16384 "$TMP/text.bin"; gen_zero 4000; tail -c 16384 "$TMP/text.bin"; } > "$TMP/edge.bin"
+
+	for w in 0 1 8; do
+		$X3 -zf -w $w "$TMP/edge.bin" "$TMP/whole.x3" > /dev/null 2>&1 || fail "compress -w $w"
+		$X3 -zf -w $w --stream "$TMP/edge.bin" "$TMP/stream.x3" > /dev/null 2>&1 || fail "compress --stream -w $w"
+		cmp -s "$TMP/whole.x3" "$TMP/stream.x3" || fail "--stream -w $w differs from the whole file"
+		$X3 -df --stream "$TMP/stream.x3" "$TMP/stream.out" > /dev/null 2>&1 || fail "decompress --stream -w $w"
+		cmp -s "$TMP/edge.bin" "$TMP/stream.out" || fail "round trip --stream -w $w"
+	done
+
+	roundtrip "$TMP/mixed.bin" --stream -w 0
+}
+
+# the blocks do not depend on the number of threads
+check_blocks()
+{
+	$X3 -zf -T 1 -B 8 "$TMP/mixed.bin" "$TMP/blocks1.x3" > /dev/null 2>&1 || fail "compress -T 1"
+	$X3 -zf -T 2 -B 8 "$TMP/mixed.bin" "$TMP/blocks2.x3" > /dev/null 2>&1 || fail "compress -T 2"
+	cmp -s "$TMP/blocks1.x3" "$TMP/blocks2.x3" || fail "-T 2 differs from -T 1"
+
+	roundtrip "$TMP/mixed.bin" -T 0 -B 4
+	roundtrip "$TMP/empty.bin" -T 2 -B 4
+	roundtrip "$TMP/one.bin" -T 2 -B 4
+
+	# the compressed size of the first block (after the 40-byte header) beyond the bound of its content
+	$X3 -zf -B 4 "$TMP/text.bin" "$TMP/bound.x3" > /dev/null 2>&1 || fail "compress -B 4"
+	printf '\377\377\377\177' | dd of="$TMP/bound.x3" bs=1 seek=40 conv=notrunc 2> /dev/null
+	$X3 -d -T 1 < "$TMP/bound.x3" 2>&1 > /dev/null | grep -q "Corrupted stream" || fail "block size beyond the bound accepted"
+}
+
+# the blocks are decoded on the threads through the seek table, the primed blocks in order
+check_parallel_decode()
+{
+	roundtrip "$TMP/mixed.bin" -T 2 -B 4 -- -T 2
+	roundtrip "$TMP/mixed.bin" -T 2 -B 4 -- -T 1
+	roundtrip "$TMP/mixed.bin" -T 2 -B 4 -P 4 -- -T 2
+}
+
+# the ranges within a block, across the blocks, up to the end (clipped), with and without priming
+check_range()
+{
+	for opts in "-B 4" "-B 4 -P 4"; do
+		$X3 -zf -T 2 $opts "$TMP/text.bin" "$TMP/range.x3" > /dev/null 2>&1 || fail "compress $opts"
+
+		for r in 0:100 5000:9000 4095:2 30000: 32760:100; do
+			offset=${r%%:*}
+			len=${r#*:}
+			$X3 -df --range $r "$TMP/range.x3" "$TMP/range.out" > /dev/null 2>&1 || fail "--range $r ($opts)"
+			tail -c +$((offset + 1)) "$TMP/text.bin" | head -c ${len:-32768} | cmp -s - "$TMP/range.out" || fail "--range $r ($opts)"
+		done
+	done
+}
+
+# the mapped and the stdio paths give the same output
+check_mmap()
+{
+	for opts in "" "-T 2 -B 4"; do
+		$X3 -zf $opts "$TMP/mixed.bin" "$TMP/mmap.x3" > /dev/null 2>&1 || fail "compress $opts"
+		$X3 -zf $opts --no-mmap "$TMP/mixed.bin" "$TMP/stdio.x3" > /dev/null 2>&1 || fail "compress --no-mmap $opts"
+		cmp -s "$TMP/mmap.x3" "$TMP/stdio.x3" || fail "--no-mmap $opts differs"
+		$X3 -df --no-mmap "$TMP/mmap.x3" "$TMP/stdio.out" > /dev/null 2>&1 || fail "decompress --no-mmap $opts"
+		cmp -s "$TMP/mixed.bin" "$TMP/stdio.out" || fail "round trip --no-mmap $opts"
+	done
+
+	roundtrip "$TMP/empty.bin" --no-mmap -- --no-mmap
+}
+
+# the reading and the writing threads, between the pipes and over several chunks
+check_async()
+{
+	{ gen_zero 1040000; head -c 16384 "$TMP/text.bin"; gen_zero 4000; tail -c 16384 "$TMP/text.bin"; } > "$TMP/edge.bin"
+
+	cat "$TMP/edge.bin" | $X3 -z 2> /dev/null | $X3 -d 2> /dev/null | cmp -s "$TMP/edge.bin" - || fail "round trip through the pipes"
+	$X3 -z < "$TMP/mixed.bin" 2> /dev/null | $X3 -d 2> /dev/null | cmp -s "$TMP/mixed.bin" - || fail "round trip of mixed.bin through the pipes"
+	$X3 -z < "$TMP/empty.bin" 2> /dev/null | $X3 -d 2> /dev/null | cmp -s "$TMP/empty.bin" - || fail "round trip of empty.bin through the pipes"
+}
+
+# a damaged stream or block is rejected, unless stored without the checksums
+check_checksum()
+{
+	for opts in "" "-T 2 -B 4"; do
+		$X3 -zf $opts "$TMP/text.bin" "$TMP/checksum.x3" > /dev/null 2>&1 || fail "compress $opts"
+		$X3 -l "$TMP/checksum.x3" 2> /dev/null | grep -q "checksum: yes" || fail "-l checksum $opts"
+
+		size=$(wc -c < "$TMP/checksum.x3")
+		corrupt "$TMP/checksum.x3" $((size / 2))
+		$X3 -df $opts "$TMP/checksum.x3" "$TMP/checksum.out" > /dev/null 2>&1 && fail "damaged stream accepted ($opts)"
+
+		roundtrip "$TMP/text.bin" $opts --no-checksum
+		$X3 -l "$TMP/rt.x3" 2> /dev/null | grep -q "checksum: no" || fail "-l --no-checksum $opts"
+	done
+}
+
+# the coders start from the trained dictionary, which the decoder needs as well
+check_dict()
+{
+	gen_text 16384 2 > "$TMP/sample.bin"
+	gen_text 4096 3 > "$TMP/small.bin"
+
+	$X3 --train "$TMP/train.x3d" "$TMP/sample.bin" > /dev/null 2>&1 || fail "--train"
+	$X3 --train "$TMP/other.x3d" "$TMP/random.bin" > /dev/null 2>&1 || fail "--train on other data"
+
+	for opts in "" "-T 2 -B 1" "--stream" "-T 2 -B 1 -P 1"; do
+		roundtrip "$TMP/small.bin" -D "$TMP/train.x3d" $opts -- -D "$TMP/train.x3d"
+	done
+
+	$X3 -zf "$TMP/small.bin" "$TMP/plain.x3" > /dev/null 2>&1 || fail "compress"
+	$X3 -zf -D "$TMP/train.x3d" "$TMP/small.bin" "$TMP/dict.x3" > /dev/null 2>&1 || fail "compress -D"
+	[ $(wc -c < "$TMP/dict.x3") -lt $(wc -c < "$TMP/plain.x3") ] || fail "the dictionary does not help"
+
+	$X3 -df "$TMP/dict.x3" "$TMP/dict.out" > /dev/null 2>&1 && fail "decompressed without the dictionary"
+	$X3 -df -D "$TMP/other.x3d" "$TMP/dict.x3" "$TMP/dict.out" > /dev/null 2>&1 && fail "decompressed with another dictionary"
+	true
+}
+
+# the appended stream is the same data as the parts compressed at once, and about as large (the repeats reach back into the checkpoint)
+check_append()
+{
+	head -c 8192 "$TMP/text.bin" > "$TMP/part.bin"
+	cat "$TMP/text.bin" "$TMP/text.bin" "$TMP/part.bin" > "$TMP/whole.bin"
+
+	for opts in "" "--pipeline"; do
+		rm -f "$TMP/append.x3" "$TMP/append.x3.ckpt"
+
+		$X3 -zf --checkpoint $opts "$TMP/text.bin" "$TMP/append.x3" > /dev/null 2>&1 || fail "compress --checkpoint $opts"
+		[ -f "$TMP/append.x3.ckpt" ] || fail "no checkpoint"
+		$X3 --append $opts "$TMP/text.bin" "$TMP/append.x3" > /dev/null 2>&1 || fail "--append $opts"
+		$X3 --append $opts "$TMP/append.x3" < "$TMP/part.bin" > /dev/null 2>&1 || fail "--append from the standard input $opts"
+
+		$X3 -l "$TMP/append.x3" 2> /dev/null | grep -q "content size: 73728" || fail "-l content size after --append $opts"
+		$X3 -df "$TMP/append.x3" "$TMP/append.out" > /dev/null 2>&1 || fail "decompress after --append $opts"
+		cmp -s "$TMP/whole.bin" "$TMP/append.out" || fail "round trip after --append $opts"
+	done
+
+	$X3 -zf "$TMP/whole.bin" "$TMP/whole.x3" > /dev/null 2>&1 || fail "compress"
+	[ $(wc -c < "$TMP/append.x3") -le $(($(wc -c < "$TMP/whole.x3") * 21 / 20)) ] || fail "the appended stream is too large"
+
+	# without a checkpoint, the compressed file is left as it was
+	rm "$TMP/append.x3.ckpt"
+	cp "$TMP/append.x3" "$TMP/before.x3"
+	$X3 --append "$TMP/part.bin" "$TMP/append.x3" > /dev/null 2>&1 && fail "--append without the checkpoint"
+	cmp -s "$TMP/before.x3" "$TMP/append.x3" || fail "failed --append changed the file"
+}
+
+# the files of a directory on the worker pool, decoded together whatever their headers (single stream, blocks, streaming)
+check_batch()
+{
+	mkdir "$TMP/batch"
+	cp "$TMP/text.bin" "$TMP/batch/a.bin"
+	cp "$TMP/mixed.bin" "$TMP/batch/b.bin"
+	cp "$TMP/empty.bin" "$TMP/batch/c.bin"
+	gen_text 8192 4 > "$TMP/batch/d.bin"
+
+	$X3 -zf -r -T 2 "$TMP/batch" > /dev/null 2>&1 || fail "compress -r -T 2"
+	$X3 -zf -T 2 -B 4 "$TMP/batch/b.bin" "$TMP/batch/b.bin.x3" > /dev/null 2>&1 || fail "compress -B 4"
+	$X3 -zf --stream "$TMP/batch/d.bin" "$TMP/batch/d.bin.x3" > /dev/null 2>&1 || fail "compress --stream"
+
+	mkdir "$TMP/batch.orig"
+	mv "$TMP/batch/"*.bin "$TMP/batch.orig/"
+
+	$X3 -df -r -T 2 "$TMP/batch" > /dev/null 2>&1 || fail "decompress -r -T 2"
+
+	for f in a b c d; do
+		cmp -s "$TMP/batch.orig/$f.bin" "$TMP/batch/$f.bin" || fail "round trip of $f.bin"
+	done
+
+	# the list of the files on the standard input, one thread
+	rm "$TMP/batch/"*.x3
+	ls "$TMP/batch/"*.bin | $X3 -zf -r > /dev/null 2>&1 || fail "compress -r from the list"
+	rm "$TMP/batch/"*.bin
+	ls "$TMP/batch/"*.x3 | $X3 -df -r > /dev/null 2>&1 || fail "decompress -r from the list"
+
+	for f in a b c d; do
+		cmp -s "$TMP/batch.orig/$f.bin" "$TMP/batch/$f.bin" || fail "round trip of $f.bin from the list"
+	done
+}
+
+# the incompressible content and blocks are stored, with a small overhead only
+check_stored()
+{
+	gen_random 262144 > "$TMP/stored.bin"
+
+	for opts in "" "-T 2 -B 16"; do
+		roundtrip "$TMP/stored.bin" $opts
+		[ $(wc -c < "$TMP/rt.x3") -le $((262144 + 1024)) ] || fail "random data not stored ($opts)"
+	done
+
+	# the stored blocks next to the compressed ones
+	cat "$TMP/stored.bin" "$TMP/text.bin" > "$TMP/stored2.bin"
+	roundtrip "$TMP/stored2.bin" -T 2 -B 16 -- -T 2
+}
+
+# the model stops growing at the memory limit recorded in the header, the decoder follows it
+check_mem_limit()
+{
+	for opts in "-M 256K" "-M 64K -T 2 -B 8" "-M 64K --stream"; do
+		roundtrip "$TMP/mixed.bin" $opts
+	done
+
+	$X3 -zf -M 256K "$TMP/text.bin" "$TMP/limit.x3" > /dev/null 2>&1 || fail "compress -M 256K"
+	$X3 -l "$TMP/limit.x3" 2> /dev/null | grep -q "memory limit: 256 KiB" || fail "-l memory limit"
+	$X3 -zf -M 0 "$TMP/text.bin" "$TMP/limit.x3" > /dev/null 2>&1 && fail "-M 0 accepted"
+	true
+}
+
+# the benchmark runs each pair of the values of the lists, the other modes take a single decimal value
+check_bench()
+{
+	$X3 -b -i 1 -t 4,15 -w 0,8 --format=csv "$TMP/text.bin" > "$TMP/bench.csv" 2> /dev/null || fail "-b"
+	[ $(wc -l < "$TMP/bench.csv") -eq 5 ] || fail "-b -t 4,15 -w 0,8 rows"
+	grep -q "^$TMP/text.bin,15,8192,1," "$TMP/bench.csv" || fail "-b -t 15 -w 8 row"
+
+	$X3 -b -i 1 --format=json "$TMP/empty.bin" "$TMP/one.bin" > /dev/null 2>&1 || fail "-b of the edge cases"
+
+	$X3 -zf -t 4,15 "$TMP/text.bin" "$TMP/bench.x3" > /dev/null 2>&1 && fail "a list of values outside -b"
+	$X3 -zf -w 010 "$TMP/text.bin" "$TMP/bench.x3" > /dev/null 2>&1 || fail "compress -w 010"
+	$X3 -zf -w 10 "$TMP/text.bin" "$TMP/bench10.x3" > /dev/null 2>&1 || fail "compress -w 10"
+	cmp -s "$TMP/bench.x3" "$TMP/bench10.x3" || fail "-w 010 is not -w 10"
+}
+
+# the microbenchmarks run on the synthetic data and on a file (one kernel each, the whole suite takes seconds)
+check_micro()
+{
+	./bench_micro -n 64 -s 16 -k dict_find_match > "$TMP/micro.txt" 2>&1 || fail "bench_micro"
+	grep -q "^dict_find_match .* ns/op .* cycles/op .* ops" "$TMP/micro.txt" || fail "bench_micro output"
+
+	./bench_micro -n 64 -k ctx_decode_tag "$TMP/text.bin" > "$TMP/micro.txt" 2>&1 || fail "bench_micro on a file"
+	grep -q "^ctx_decode_tag .* ns/op" "$TMP/micro.txt" || fail "bench_micro output on a file"
+}
+
+# the cycles of the phases are counted (summed over the blocks, x86 only), the hardware counters are reported even when unavailable
+check_phases()
+{
+	for opts in "" "-T 2 -B 8"; do
+		$X3 -zf $opts --stats=json "$TMP/text.bin" "$TMP/phases.x3" > /dev/null 2> "$TMP/phases.json" || fail "compress --stats=json $opts"
+		grep -q '"phases":{"match":' "$TMP/phases.json" || fail "no phases ($opts)"
+		case $(uname -m) in
+			x86_64|i?86) grep -q '"phases":{"match":[1-9]' "$TMP/phases.json" || fail "no cycles of the match finding ($opts)" ;;
+		esac
+		grep -q '"counters":{"cycles":' "$TMP/phases.json" || fail "no hardware counters ($opts)"
+	done
+
+	$X3 -zf -s "$TMP/text.bin" "$TMP/phases.x3" > /dev/null 2> "$TMP/phases.txt" || fail "compress -s"
+	grep -q "^phases (cycles): match finding" "$TMP/phases.txt" || fail "-s phases"
+}
+
+# the selected kernels are named, and the window scan and the dictionary comparison reach the end of the input at any alignment
+check_kernels()
+{
+	$X3 -zf -s "$TMP/text.bin" "$TMP/kernels.x3" > /dev/null 2> "$TMP/kernels.txt" || fail "compress -s"
+	grep -Eq "^kernels: (scalar|avx2|avx512)$" "$TMP/kernels.txt" || fail "-s kernels"
+
+	for size in 2 31 32 33 63 64 65 127 4097; do
+		head -c $size "$TMP/text.bin" > "$TMP/kernels.bin"
+		for w in 0 1 8; do
+			roundtrip "$TMP/kernels.bin" -w $w
+		done
+	done
+}
+
+# the speed governor lowers -t and -w per block, the blocks decode as usual
+check_governor()
+{
+	for speed in 0.01 1000; do
+		roundtrip "$TMP/mixed.bin" --target-speed=$speed -T 2 -B 4 -- -T 2
+		cp "$TMP/rt.x3" "$TMP/governor$speed.x3"
+	done
+
+	# an unreachable speed gives the fastest parameters
+	[ $(wc -c < "$TMP/governor1000.x3") -gt $(wc -c < "$TMP/governor0.01.x3") ] || fail "--target-speed=1000 kept the parameters"
+
+	$X3 -zf --target-speed=0 "$TMP/text.bin" "$TMP/governor.x3" > /dev/null 2>&1 && fail "--target-speed=0 accepted"
+	true
+}
+
+# the parse and the coding on two threads give the same output as a single thread
+check_pipeline()
+{
+	gen_text 16384 2 > "$TMP/sample.bin"
+	$X3 --train "$TMP/pipeline.x3d" "$TMP/sample.bin" > /dev/null 2>&1 || fail "--train"
+
+	for opts in "" "-w 0" "-t 4 -w 1" "--stream" "-D $TMP/pipeline.x3d"; do
+		$X3 -zf $opts "$TMP/mixed.bin" "$TMP/serial.x3" > /dev/null 2>&1 || fail "compress $opts"
+		$X3 -zf --pipeline $opts "$TMP/mixed.bin" "$TMP/pipeline.x3" > /dev/null 2>&1 || fail "compress --pipeline $opts"
+		cmp -s "$TMP/serial.x3" "$TMP/pipeline.x3" || fail "--pipeline $opts differs"
+	done
+
+	roundtrip "$TMP/empty.bin" --pipeline
+	roundtrip "$TMP/one.bin" --pipeline
+}
+
+# the trace does not change the output, and the analyzer accounts for the whole input
+check_trace()
+{
+	for opts in "" "--pipeline"; do
+		$X3 -zf $opts "$TMP/mixed.bin" "$TMP/plain.x3" > /dev/null 2>&1 || fail "compress $opts"
+		$X3 -zf $opts --trace "$TMP/trace.tr" "$TMP/mixed.bin" "$TMP/trace.x3" > /dev/null 2>&1 || fail "compress --trace $opts"
+		cmp -s "$TMP/plain.x3" "$TMP/trace.x3" || fail "--trace $opts changes the output"
+
+		./x3trace -r 4 -n 3 "$TMP/trace.tr" > "$TMP/trace.txt" 2>&1 || fail "x3trace $opts"
+		grep -q "^tokens: [1-9][0-9]*, data: 49152 bytes" "$TMP/trace.txt" || fail "x3trace $opts data"
+	done
+
+	head -c 100 "$TMP/trace.tr" > "$TMP/truncated.tr"
+	./x3trace "$TMP/truncated.tr" > /dev/null 2>&1 && fail "x3trace of a truncated trace"
+	true
+}
+
+# the messages round-trip through the message API (the benchmark checks each of them), also those that do not compress
+check_messages()
+{
+	$X3 -b -i 2 --messages=1,4,64 --format=csv "$TMP/text.bin" "$TMP/random.bin" > "$TMP/messages.csv" 2> /dev/null || fail "--messages"
+	[ $(wc -l < "$TMP/messages.csv") -eq 7 ] || fail "--messages rows"
+	grep -q "^$TMP/text.bin,15,8192,65536,1,32768," "$TMP/messages.csv" || fail "--messages larger than the file"
+
+	$X3 -b --messages=1,0 "$TMP/text.bin" > /dev/null 2>&1 && fail "--messages=0 accepted"
+	true
+}
+
+# the repeats reach past the dictionary (a second copy of random data costs almost nothing), and the streams of the versions 2 and 3 still decode
+check_repeats()
+{
+	head -c 32768 "$TMP/random.bin" > "$TMP/r.bin"
+	gen_random 16384 >> "$TMP/r.bin"
+	cat "$TMP/r.bin" "$TMP/text.bin" "$TMP/r.bin" > "$TMP/repeats.bin"
+
+	for opts in "" "--stream" "-T 2 -B 256 -- -T 2" "--pipeline"; do
+		roundtrip "$TMP/repeats.bin" $opts
+		[ $(wc -c < "$TMP/rt.x3") -lt $((49152 + 16384)) ] || fail "the repeat is not coded ($opts)"
+	done
+
+	# the fixtures of the earlier format versions, compressed from this input by the earlier versions of x3
+	{ gen_text 8192 5; gen_text 4096 6; gen_zero 3000; gen_text 8192 5; } > "$TMP/fixture.bin"
+
+	for f in v2 v2-blocks v3 v3-blocks; do
+		$X3 -df "$TESTS/$f.x3" "$TMP/fixture.out" > /dev/null 2>&1 || fail "decompress $f.x3"
+		cmp -s "$TMP/fixture.bin" "$TMP/fixture.out" || fail "round trip of $f.x3"
+	done
+
+	$X3 -df -T 2 "$TESTS/v3-blocks.x3" "$TMP/fixture.out" > /dev/null 2>&1 || fail "decompress -T 2 v3-blocks.x3"
+	cmp -s "$TMP/fixture.bin" "$TMP/fixture.out" || fail "round trip of v3-blocks.x3 on two threads"
+}
+
+# the runs of a single byte between short fragments, also at the lengths just around the minimum run and without the window
+check_runs()
+{
+	awk 'BEGIN {
+		s = 7;
+		for (i = 0; i < 64; ++i) {
+			s = (s * 69069 + 1) % 4294967296;
+			c = sprintf("%c", 65 + int(s / 65536) % 26);
+			len = i < 8 ? 28 + i : 32 + int(s / 256) % 4000;
+			for (j = 0; j < len; ++j) {
+				printf "%s", c;
+			}
+			printf "the %d of %d,", s % 1000, i;
+		}
+	}' > "$TMP/runs.bin"
+
+	for opts in "" "-w 0" "-w 1" "--stream" "-T 2 -B 16" "--pipeline"; do
+		roundtrip "$TMP/runs.bin" $opts
+		[ $(wc -c < "$TMP/rt.x3") -lt 8192 ] || fail "the runs are not coded ($opts)"
+	done
+
+	gen_zero 1048576 > "$TMP/zero.bin"
+	roundtrip "$TMP/zero.bin"
+	[ $(wc -c < "$TMP/rt.x3") -lt 1024 ] || fail "the zeros are not coded as a run"
+}
+
+CASES=${*:-"bio stats header stream blocks parallel_decode range mmap async checksum dict append batch stored mem_limit bench micro phases kernels governor pipeline trace messages repeats runs"}
+
+for c in $CASES; do
+	echo "$c"
+	check_$c
+done
+
+echo "all passed"
@@ -0,0 +1,78 @@
+#include "trace.h"
+#include <string.h>
+
+static const unsigned char trace_magic[4] = { 'X', '3', 0x1a, 'T' };
+
+static uint64_t load_le(const unsigned char *p, size_t n)
+{
+	uint64_t v = 0;
+
+	for (size_t i = 0; i < n; ++i) {
+		v |= (uint64_t)p[i] << (8 * i);
+	}
+
+	return v;
+}
+
+static void store_le(unsigned char *p, uint64_t v, size_t n)
+{
+	for (size_t i = 0; i < n; ++i) {
+		p[i] = (unsigned char)(v >> (8 * i));
+	}
+}
+
+void trace_write_header(void *ptr)
+{
+	unsigned char *p = ptr;
+
+	memset(p, 0, TRACE_HEADER_SIZE);
+	memcpy(p, trace_magic, 4);
+	store_le(p + 4, TRACE_VERSION, 1);
+	store_le(p + 5, TRACE_RECORD_SIZE, 1);
+}
+
+int trace_read_header(const void *ptr)
+{
+	const unsigned char *p = ptr;
+
+	if (memcmp(p, trace_magic, 4) != 0 || load_le(p + 4, 1) < 1 || load_le(p + 4, 1) > TRACE_VERSION || load_le(p + 5, 1) != TRACE_RECORD_SIZE) {
+		return -1;
+	}
+
+	return 0;
+}
+
+void trace_write_record(const struct trace_record *record, void *ptr)
+{
+	unsigned char *p = ptr;
+	uint32_t bits;
+
+	memcpy(&bits, &record->bits, 4);
+
+	store_le(p +  0, record->pos, 8);
+	store_le(p +  8, record->event, 1);
+	store_le(p +  9, record->len, 3);
+	store_le(p + 12, record->index, 4);
+	store_le(p + 16, record->tag, 4);
+	store_le(p + 20, record->prev_context1, 4);
+	store_le(p + 24, record->context1, 4);
+	store_le(p + 28, record->ctx0, 4);
+	store_le(p + 32, bits, 4);
+}
+
+void trace_read_record(struct trace_record *record, const void *ptr)
+{
+	const unsigned char *p = ptr;
+	uint32_t bits = (uint32_t)load_le(p + 32, 4);
+
+	record->pos = load_le(p + 0, 8);
+	record->event = (unsigned)load_le(p + 8, 1);
+	record->len = (unsigned)load_le(p + 9, 3);
+	record->index = (uint32_t)load_le(p + 12, 4);
+	record->tag = (uint32_t)load_le(p + 16, 4);
+	record->prev_context1 = (uint32_t)load_le(p + 20, 4);
+	record->context1 = (uint32_t)load_le(p + 24, 4);
+	record->ctx0 = (uint32_t)load_le(p + 28, 4);
+
+	memcpy(&record->bits, &bits, 4);
+}
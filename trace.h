@@ -0,0 +1,72 @@
+/*
+ * Parse trace (one record per token of the code stream)
+ */
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TRACE_VERSION 2
+
+/*
+ * The file starts with the header:
+ *
+ *  0  4  magic "X3\x1aT"
+ *  4  1  version
+ *  5  1  record size in bytes
+ *  6  2  reserved (zero)
+ */
+#define TRACE_HEADER_SIZE 8
+
+/*
+ * Each record (all fields are little-endian):
+ *
+ *  0  8  position of the fragment in the stream
+ *  8  1  event (TRACE_*)
+ *  9  3  length of the fragment (1 byte followed by 2 zero bytes in the version 1)
+ * 12  4  index in the dictionary (before the reordering), the distance of a repeat, the byte of a run, or TRACE_NONE for a new fragment
+ * 16  4  tag of the fragment, or TRACE_NONE for a new fragment not inserted into the dictionary (and for a repeat or a run)
+ * 20  4  tag before the previous one (prev_context1)
+ * 24  4  previous tag (context1)
+ * 28  4  ctx0 context id of the pair of tags, or TRACE_NONE for a new fragment (and for a repeat or a run)
+ * 32  4  estimated cost in bits (IEEE 754 single precision)
+ */
+#define TRACE_RECORD_SIZE 36
+
+#define TRACE_NONE UINT32_MAX
+
+/* the events of the code stream */
+enum {
+	TRACE_CTX0 = 0, /* tag in the context of the previous two tags */
+	TRACE_CTX1,     /* tag in the context of the previous tag */
+	TRACE_IDX1,     /* index in the dictionary */
+	TRACE_NEW,      /* new fragment (uncompressed) */
+	TRACE_EOF,      /* not recorded */
+	TRACE_REP,      /* repeat of the preceding data */
+	TRACE_RUN,      /* run of a single byte */
+	TRACE_EVENTS
+};
+
+struct trace_record {
+	uint64_t pos;
+	unsigned event;
+	unsigned len;
+	uint32_t index;
+	uint32_t tag;
+	uint32_t prev_context1;
+	uint32_t context1;
+	uint32_t ctx0;
+	float bits;
+};
+
+void trace_write_header(void *ptr);
+
+/* returns 0, or -1 if the buffer does not start with a supported header */
+int trace_read_header(const void *ptr);
+
+void trace_write_record(const struct trace_record *record, void *ptr);
+
+void trace_read_record(struct trace_record *record, const void *ptr);
+
+#endif /* TRACE_H */
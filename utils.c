@@ -1,16 +1,86 @@
-#include "utils.h"
 #define _POSIX_C_SOURCE 199309L
+#include "utils.h"
 #include <time.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#if defined(__x86_64__) || defined(__i386__)
+#	include <x86intrin.h>
+#endif
 
 long wall_clock()
 {
 	struct timespec t;
 
-	if (clock_gettime(CLOCK_REALTIME, &t) < 0) {
+	if (clock_gettime(CLOCK_MONOTONIC, &t) < 0) {
 		fprintf(stderr, "wall-clock error\n");
 		return 0;
 	}
 
 	return t.tv_sec * 1000000000L + t.tv_nsec;
 }
+
+void reset_peak_rss()
+{
+	FILE *stream = fopen("/proc/self/clear_refs", "w");
+
+	if (stream != NULL) {
+		fputs("5", stream);
+		fclose(stream);
+	}
+}
+
+size_t peak_rss()
+{
+	FILE *stream = fopen("/proc/self/status", "r");
+
+	if (stream != NULL) {
+		char line[256];
+		unsigned long kb;
+
+		while (fgets(line, sizeof line, stream) != NULL) {
+			if (sscanf(line, "VmHWM: %lu kB", &kb) == 1) {
+				fclose(stream);
+
+				return (size_t)kb << 10;
+			}
+		}
+
+		fclose(stream);
+	}
+
+	struct rusage usage;
+
+	if (getrusage(RUSAGE_SELF, &usage) < 0) {
+		return 0;
+	}
+
+	/* in kilobytes */
+	return (size_t)usage.ru_maxrss << 10;
+}
+
+uint64_t cycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+static THREAD_LOCAL jmp_buf *recovery = NULL;
+
+void set_recovery(jmp_buf *env)
+{
+	recovery = env;
+}
+
+void corrupted()
+{
+	if (recovery != NULL) {
+		longjmp(*recovery, 1);
+	}
+
+	fprintf(stderr, "Corrupted stream\n");
+	abort();
+}
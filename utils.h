@@ -1,9 +1,43 @@
 #ifndef UTIL_H
 #define UTIL_H
 
+#include <stddef.h>
+#include <stdint.h>
+#include <setjmp.h>
+
+/*
+ * The coder state (the dictionary, the contexts, the models) is thread-local,
+ * so that each thread runs its own coder.
+ */
+#define THREAD_LOCAL __thread
+
 /*
  * Measures real (wall-clock) time in nanoseconds.
+ * The clock is monotonic, the intervals are not affected by the adjustments of the system time.
  */
 long wall_clock();
 
+/*
+ * The peak resident set size of the process in bytes (0 if not available),
+ * since the last reset_peak_rss() on Linux, since the start of the process elsewhere.
+ */
+size_t peak_rss();
+
+/* the peak resident set size starts again from the current one (Linux only) */
+void reset_peak_rss();
+
+/*
+ * The time-stamp counter (the reference cycles at a constant rate), 0 if the processor has none.
+ */
+uint64_t cycles();
+
+/*
+ * Report a corrupted stream. Without a recovery point, prints a message and aborts.
+ * With one (set on this thread by set_recovery()), jumps there (longjmp) instead.
+ */
+__attribute__((noreturn)) void corrupted();
+
+/* the recovery point of this thread for corrupted(), NULL to abort again */
+void set_recovery(jmp_buf *env);
+
 #endif /* UTIL_H */
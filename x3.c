@@ -6,7 +6,9 @@
 #include <string.h>
 #include <stdint.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <math.h>
+#include <pthread.h>
 #include "backend.h"
 #include "file.h"
 #include "dict.h"
@@ -15,39 +17,319 @@
 #include "bio.h"
 #include "context.h"
 #include "ac.h"
-
-struct ctx *ctx0 = NULL; /* previous two tags */
-struct ctx *ctx1 = NULL; /* previous tag */
-
-void enlarge_ctx1()
+#include "frame.h"
+#include "pool.h"
+#include "async.h"
+#include "crc32c.h"
+#include "snapshot.h"
+#include "estimate.h"
+#include "perf.h"
+#include "ring.h"
+#include "trace.h"
+#include "repeat.h"
+#include "coder.h"
+#include "message.h"
+
+THREAD_LOCAL struct ctx *ctx0 = NULL; /* previous two tags */
+THREAD_LOCAL struct ctx *ctx1 = NULL; /* previous tag */
+
+/* allocated contexts, the storage is reused by the next coder (see destroy) */
+THREAD_LOCAL size_t ctx0_capacity = 0;
+THREAD_LOCAL size_t ctx1_capacity = 0;
+
+/* the new contexts are empty (the storage kept from the previous coder is cleared by create), size is that of the dictionary */
+void enlarge_ctx1(size_t size)
 {
-	ctx1 = ctx_enlarge(ctx1, dict_get_size(), dict_get_elems());
+	if (size > ctx1_capacity) {
+		ctx1 = ctx_enlarge(ctx1, size, ctx1_capacity);
+		ctx1_capacity = size;
+	}
 }
 
-void enlarge_ctx0()
+/* size is that of the map of the tag pairs */
+void enlarge_ctx0(size_t size)
 {
-	ctx0 = ctx_enlarge(ctx0, tag_pair_get_size(), tag_pair_get_elems());
+	if (size > ctx0_capacity) {
+		ctx0 = ctx_enlarge(ctx0, size, ctx0_capacity);
+		ctx0_capacity = size;
+	}
 }
 
-/* list of events */
+/* list of events (the trace records use the same codes) */
 enum {
 	E_CTX0 = 0, /* tag in ctx0 */
 	E_CTX1,     /* tag in ctx1 */
 	E_IDX1,     /* index in miss1 */
 	E_NEW,      /* new index/tag (uncompressed) */
 	E_EOF,      /* end of stream */
+	E_REP,      /* repeat of the preceding data (since the format version 3) */
+	E_RUN,      /* run of a single byte (since the format version 4) */
 	E_LAST
 };
 
-size_t events[E_LAST];
-float sizes[E_LAST] = { 0.f, 0.f, 0.f, 0.f, 0.f };
+/* the format version of the stream of the coder on this thread, the later versions add the events */
+THREAD_LOCAL unsigned format_version = FRAME_VERSION;
+
+/* the events of the format version, those of the earlier versions are a prefix */
+size_t event_count(unsigned version)
+{
+	return version >= 4 ? E_RUN + 1 : version >= 3 ? E_REP + 1 : E_EOF + 1;
+}
+
+#define REP_ENABLED (format_version >= 3)
+#define RUN_ENABLED (format_version >= 4)
+
+/* the runs are at least this long, the window scan of the shorter ones is cheap */
+#define RUN_MIN_LEN 32
+
+/* and at most this long (the forward window is usually shorter) */
+#define RUN_MAX_LEN ((size_t)1 << 20)
+
+/* statistics level */
+enum {
+	STATS_NONE = 0,
+	STATS_TEXT,
+	STATS_JSON
+};
+
+static int g_stats = STATS_NONE;
+
+/* the statistics are runtime-gated, define X3_NO_STATS to compile them out */
+#ifdef X3_NO_STATS
+#	define STATS_ENABLED 0
+#else
+#	define STATS_ENABLED (g_stats != STATS_NONE)
+#endif
+
+/* the parse trace of the coder on this thread (--trace), NULL = not traced */
+THREAD_LOCAL FILE *trace = NULL;
+
+/* the last token coded, for the trace */
+struct token_cost {
+	unsigned event;
+	uint32_t ctx0; /* context id */
+	float bits;
+};
+
+THREAD_LOCAL struct token_cost token_cost;
+
+/* the costs of the tokens are estimated for the statistics or for the trace */
+#define COST_ENABLED (STATS_ENABLED || trace != NULL)
+
+THREAD_LOCAL size_t events[E_LAST];
+THREAD_LOCAL float sizes[E_LAST] = { 0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f };
+
+/* sizes of the dictionaries and the contexts, summed over the coders (blocks) */
+struct state_stats {
+	size_t dict_elems;
+	size_t dict_size;
+	size_t ctx0_elems;
+};
+
+THREAD_LOCAL struct state_stats state_stats = { 0, 0, 0 };
+
+/* the phases of the coder, the cycles in between the switches are attributed to the current phase */
+enum {
+	P_MATCH = 0,   /* match finding */
+	P_DICT_LOOKUP, /* dictionary lookup (and insertion) */
+	P_DICT_SORT,   /* dictionary reordering */
+	P_MODEL,       /* context and tag modeling */
+	P_CODE,        /* entropy coding (the bit stream) */
+	P_OTHER,       /* copying the fragments, the loop */
+	P_LAST         /* not measured */
+};
+
+THREAD_LOCAL uint64_t phase_cycles[P_LAST];
+
+THREAD_LOCAL int phase = P_LAST;
+THREAD_LOCAL uint64_t phase_since = 0;
+
+void phase_switch(int next)
+{
+	if (STATS_ENABLED) {
+		uint64_t now = cycles();
+
+		if (phase != P_LAST) {
+			phase_cycles[phase] += now - phase_since;
+		}
+
+		phase = next;
+		phase_since = now;
+	}
+}
+
+THREAD_LOCAL struct ac ac;
+
+THREAD_LOCAL struct model model_events;
+THREAD_LOCAL struct model model_match_size;
+THREAD_LOCAL struct model model_chars;
+THREAD_LOCAL struct model model_index1;
+
+/* the lengths and the distances of the repeats (and the lengths of the runs), as the numbers of their bits (the bits below the top one follow as they are) */
+#define REP_BUCKETS 24
+
+THREAD_LOCAL struct model model_rep_len;
+THREAD_LOCAL struct model model_rep_dist;
+
+THREAD_LOCAL struct model model_run_len;
+THREAD_LOCAL struct model model_run_char;
+
+/* the state of the parser, kept across the chunks of a stream */
+struct stream {
+	size_t prev_context1; /* previous context1 */
+	size_t context1; /* last tag */
+	size_t pos; /* position of the current chunk in the stream */
+	size_t history; /* the bytes before the current chunk which are in memory (at most REP_WINDOW), for the repeats */
+	int eof; /* end of stream was decoded */
+};
+
+THREAD_LOCAL struct stream stream = { 0, 0, 0, 0, 0 };
+
+size_t minsize(size_t a, size_t b)
+{
+	return a < b ? a : b;
+}
+
+/* the repeats reach back into the data of this chunk up to p, and into the history before it */
+size_t rep_history(const char *ptr, const char *p)
+{
+	return minsize(stream.history + (size_t)(p - ptr), REP_WINDOW);
+}
+
+/* the history of the next chunk, which follows the data up to p */
+void rep_advance(const char *ptr, const char *p)
+{
+	stream.history = REP_ENABLED ? rep_history(ptr, p) : 0;
+}
+
+/*
+ * The state is measured in the nominal sizes of its parts (those of a 64-bit build),
+ * so that the encoder and the decoder stop growing it at the same point on any platform.
+ */
+enum {
+	MEM_DICT_SLOT = 64 + 24 + 24, /* struct elem, its ctx1 context and its model_index1 symbol */
+	MEM_PAIR_SLOT = 24,           /* ctx0 context */
+	MEM_PAIR      = 48,           /* struct tag_pair (with the allocator overhead) */
+	MEM_ITEM      = 16,           /* struct item */
+	MEM_ARRAY     = 16            /* allocator overhead of the items of the context */
+};
+
+/* the memory limit of the coders on this thread */
+struct mem_limit {
+	size_t size; /* in bytes, 0 = unlimited */
+	int strict; /* exceeding the limit is an error, rather than the point where the state stops growing */
+};
+
+THREAD_LOCAL struct mem_limit mem_limit = { 0, 0 };
+
+/* the items of the contexts */
+THREAD_LOCAL size_t ctx_memory = 0;
+
+size_t state_memory()
+{
+	return dict_get_size() * MEM_DICT_SLOT + tag_pair_get_size() * MEM_PAIR_SLOT + tag_pair_get_elems() * MEM_PAIR + ctx_memory;
+}
+
+/* the state can grow by more bytes */
+int mem_available(size_t more)
+{
+	if (mem_limit.size == 0 || state_memory() + more <= mem_limit.size) {
+		return 1;
+	}
+
+	if (mem_limit.strict) {
+		fprintf(stderr, "Memory limit exceeded\n");
+		abort();
+	}
+
+	return 0;
+}
+
+size_t ctx_count_memory(const struct ctx *c, size_t size)
+{
+	size_t memory = 0;
+
+	for (size_t e = 0; e < size; ++e) {
+		if (c[e].items > 0) {
+			memory += MEM_ARRAY + c[e].items * MEM_ITEM;
+		}
+	}
+
+	return memory;
+}
+
+/* at the memory limit, the new tags are not added */
+void update_ctx(struct ctx *c, size_t tag)
+{
+	if (ctx_query_tag_item(c, tag) == NULL) {
+		size_t more = MEM_ITEM + (c->items == 0 ? MEM_ARRAY : 0);
+
+		if (mem_available(more)) {
+			ctx_add_tag(c, tag);
+			ctx_memory += more;
+		}
+	} else {
+		ctx_item_inc_freq(c, tag);
+	}
+	ctx_sort(c);
+}
+
+/* (context1, tag) constitutes new pair of tags, unless at the memory limit */
+void update_tag_pairs(size_t context1, size_t tag)
+{
+	struct tag_pair pair = make_tag_pair(context1, tag);
+
+	if (tag_pair_query(&pair) == (size_t)-1) {
+		if (!mem_available(MEM_PAIR + (tag_pair_can_add() ? 0 : tag_pair_get_size() * MEM_PAIR_SLOT))) {
+			return;
+		}
+
+		// add new context
+		if (!tag_pair_can_add()) {
+			tag_pair_enlarge();
+			enlarge_ctx0(tag_pair_get_size());
+		}
+		tag_pair_add(&pair);
+	}
+}
+
+/* insert the new fragment, unless at the memory limit, returns whether it was inserted */
+int insert_dict(struct elem *e)
+{
+	if (dict_query_elem(e) == 0) {
+		if (!mem_available(dict_can_insert_elem() ? 0 : dict_get_size() * MEM_DICT_SLOT)) {
+			return 0;
+		}
+
+		if (!dict_can_insert_elem()) {
+			dict_enlarge();
+		}
+
+		dict_insert_elem(e);
+
+		return 1;
+	}
+
+	return 0;
+}
+
+/* the models follow the dictionary of the given size, after an insertion */
+void grow_models(size_t dict_size)
+{
+	enlarge_ctx1(dict_size);
+	model_enlarge(&model_index1);
+}
 
-struct ac ac;
+/* returns whether the fragment was inserted */
+int update_dict(struct elem *e)
+{
+	if (insert_dict(e)) {
+		grow_models(dict_get_size());
+		return 1;
+	}
 
-struct model model_events;
-struct model model_match_size;
-struct model model_chars;
-struct model model_index1;
+	return 0;
+}
 
 float prob_to_bits(float prob)
 {
@@ -71,70 +353,57 @@ size_t decode_tag(size_t decision, struct bio *bio, size_t prev_context1, size_t
 
 	size_t tag;
 	size_t index;
-	float size; /* for stats */
+
+	phase_switch(P_CODE);
+
 	switch (decision) {
 		case E_CTX0:
 			tag = ctx_decode_tag_without_update_ac(bio, &ac, c0);
-			size = prob_to_bits(ctx_encode_tag_without_update_ac_query_prob(c0, tag));
+			if (STATS_ENABLED) {
+				sizes[decision] += prob_to_bits(ctx_encode_tag_without_update_ac_query_prob(c0, tag));
+			}
 			index = dict_get_index_by_tag(tag);
 			break;
 		case E_CTX1:
 			tag = ctx_decode_tag_without_update_ac(bio, &ac, c1);
-			size = prob_to_bits(ctx_encode_tag_without_update_ac_query_prob(c1, tag));
+			if (STATS_ENABLED) {
+				sizes[decision] += prob_to_bits(ctx_encode_tag_without_update_ac_query_prob(c1, tag));
+			}
 			index = dict_get_index_by_tag(tag);
 			break;
 		case E_IDX1:
 			index = ac_decode_symbol_model(&ac, bio, &model_index1);
-			size = prob_to_bits(ac_encode_symbol_model_query_prob(index, &model_index1));
+			if (STATS_ENABLED) {
+				sizes[decision] += prob_to_bits(ac_encode_symbol_model_query_prob(index, &model_index1));
+			}
 			inc_model(&model_index1, index);
 			tag = dict_get_tag_by_index(index);
 			break;
 		default:
-			abort();
+			corrupted();
 	}
 
-	events[decision]++;
-	sizes[decision] += size;
-
-	// update contexts
-
-	if (ctx_query_tag_item(c0, tag) == NULL) {
-		ctx_add_tag(c0, tag);
-	} else {
-		ctx_item_inc_freq(c0, tag);
-	}
-	ctx_sort(c0);
+	phase_switch(P_MODEL);
 
-	if (ctx_query_tag_item(c1, tag) == NULL) {
-		ctx_add_tag(c1, tag);
-	} else {
-		ctx_item_inc_freq(c1, tag);
+	if (STATS_ENABLED) {
+		events[decision]++;
 	}
-	ctx_sort(c1);
 
-	/* (context1, tag) constitutes new pair of tags */
+	// update contexts
 
-	struct tag_pair pair = make_tag_pair(context1, tag);
+	update_ctx(c0, tag);
+	update_ctx(c1, tag);
 
-	if (tag_pair_query(&pair) == (size_t)-1) {
-		// add new context
-		if (!tag_pair_can_add()) {
-			tag_pair_enlarge();
-			enlarge_ctx0();
-		}
-		tag_pair_add(&pair);
-	}
+	update_tag_pairs(context1, tag);
 
 	return index;
 }
 
-/* encode dict[index].tag in context, rather than index */
-void encode_tag(struct bio *bio, size_t prev_context1, size_t context1, size_t index)
+/* encode the tag of dict[index] in context, rather than index (the dictionary is not accessed) */
+void encode_tag(struct bio *bio, size_t prev_context1, size_t context1, size_t index, size_t tag)
 {
 	assert(ctx1 != NULL);
 
-	size_t tag = dict_get_tag_by_index(index);
-
 	// order of tags is (prev_context1, context1, tag)
 	struct tag_pair ctx_pair = make_tag_pair(prev_context1, context1); /* previous two tags */
 
@@ -173,6 +442,8 @@ void encode_tag(struct bio *bio, size_t prev_context1, size_t context1, size_t i
 
 	// encode
 
+	phase_switch(P_CODE);
+
 	ac_encode_symbol_model(&ac, bio, mode, &model_events);
 	inc_model(&model_events, mode);
 
@@ -189,299 +460,4644 @@ void encode_tag(struct bio *bio, size_t prev_context1, size_t context1, size_t i
 			break;
 	}
 
-	events[mode]++;
-	sizes[mode] += prob_to_bits(prob);
+	phase_switch(P_MODEL);
 
-	// update contexts
-
-	if (ctx_query_tag_item(c0, tag) == NULL) {
-		ctx_add_tag(c0, tag);
-	} else {
-		ctx_item_inc_freq(c0, tag);
+	if (STATS_ENABLED) {
+		events[mode]++;
+		sizes[mode] += prob_to_bits(prob);
 	}
-	ctx_sort(c0);
 
-	if (ctx_query_tag_item(c1, tag) == NULL) {
-		ctx_add_tag(c1, tag);
-	} else {
-		ctx_item_inc_freq(c1, tag);
+	if (trace != NULL) {
+		token_cost.event = (unsigned)mode;
+		token_cost.ctx0 = (uint32_t)ctx0_id;
+		token_cost.bits = prob_to_bits(prob);
 	}
-	ctx_sort(c1);
 
-	/* (context1, tag) constitutes new pair of tags */
+	// update contexts
 
-	struct tag_pair pair = make_tag_pair(context1, tag);
+	update_ctx(c0, tag);
+	update_ctx(c1, tag);
 
-	if (tag_pair_query(&pair) == (size_t)-1) {
-		// add new context
-		if (!tag_pair_can_add()) {
-			tag_pair_enlarge();
-			enlarge_ctx0();
-		}
-		tag_pair_add(&pair);
-	}
+	update_tag_pairs(context1, tag);
 }
 
-void create()
+/* the trained state (the mapped dictionary file), the coders start from it instead of the empty state */
+static const unsigned char *g_dict = NULL;
+static size_t g_dict_size = 0;
+static uint32_t g_dict_id = 0;
+
+void save_state(struct snapshot *s)
 {
-	tag_pair_create();
+	snapshot_put(s, stream.prev_context1);
+	snapshot_put(s, stream.context1);
+	snapshot_put(s, stream.pos);
 
-	dict_enlarge();
-	enlarge_ctx1();
+	dict_save(s);
+	tag_pair_save(s);
 
-	tag_pair_enlarge();
-	enlarge_ctx0();
+	ctx_save(s, ctx1, dict_get_size());
+	ctx_save(s, ctx0, tag_pair_get_size());
 
-	/* initialize AC models */
-	model_create(&model_events, E_LAST);
+	model_save(s, &model_events);
+	model_save(s, &model_match_size);
+	model_save(s, &model_chars);
+	model_save(s, &model_index1);
 
-	/* initial frequencies in model_events */
-	model_events.table[E_CTX0].freq = 1024;
-	model_events.table[E_CTX1].freq = 1024;
-	model_events.table[E_IDX1].freq = 1;
-	model_events.table[E_NEW ].freq = 1;
-	count_cum_freqs(model_events.table, model_events.count);
-	model_events.total = calc_total_freq(model_events.table, model_events.count);
+	if (model_events.count > E_REP) {
+		model_save(s, &model_rep_len);
+		model_save(s, &model_rep_dist);
+	}
 
-	model_create(&model_match_size, 1 << MATCH_LOGSIZE);
-	model_create(&model_chars, 256);
-	model_create(&model_index1, 0);
+	if (model_events.count > E_RUN) {
+		model_save(s, &model_run_len);
+		model_save(s, &model_run_char);
+	}
 }
 
-void encode_match(struct bio *bio, char *p, size_t len)
+/* the state is parsed into the empty storage of this thread, the events are left as saved */
+void parse_state(struct snapshot *s)
 {
-	sizes[E_NEW] += prob_to_bits(ac_encode_symbol_model_query_prob(E_NEW, &model_events));
-	ac_encode_symbol_model(&ac, bio, E_NEW, &model_events);
-	inc_model(&model_events, E_NEW);
+	stream.prev_context1 = (size_t)snapshot_get(s);
+	stream.context1 = (size_t)snapshot_get(s);
+	stream.pos = (size_t)snapshot_get(s);
+	stream.history = 0;
+	stream.eof = 0;
 
-	assert(len > 0 && len <= (1 << MATCH_LOGSIZE));
+	tag_pair_create();
+	repeat_reset();
 
-	sizes[E_NEW] += prob_to_bits(ac_encode_symbol_model_query_prob(len - 1, &model_match_size));
-	ac_encode_symbol_model(&ac, bio, len - 1, &model_match_size);
-	inc_model(&model_match_size, len - 1);
+	dict_load(s);
+	tag_pair_load(s);
 
-	for (size_t c = 0; c < len; ++c) {
-		sizes[E_NEW] += prob_to_bits(ac_encode_symbol_model_query_prob((unsigned char)p[c], &model_chars));
-		ac_encode_symbol_model(&ac, bio, (unsigned char)p[c], &model_chars);
-		inc_model(&model_chars, (unsigned char)p[c]);
+	ctx1 = ctx_load(s, dict_get_size());
+	ctx0 = ctx_load(s, tag_pair_get_size());
+
+	ctx1_capacity = dict_get_size();
+	ctx0_capacity = tag_pair_get_size();
+
+	ctx_memory = ctx_count_memory(ctx1, dict_get_size()) + ctx_count_memory(ctx0, tag_pair_get_size());
+
+	model_load(s, &model_events);
+	model_load(s, &model_match_size);
+	model_load(s, &model_chars);
+	model_load(s, &model_index1);
+
+	/* the state of an earlier format version has fewer events */
+	size_t saved_events = model_events.count;
+
+	if (saved_events > E_REP) {
+		model_load(s, &model_rep_len);
+		model_load(s, &model_rep_dist);
+	} else {
+		model_reset(&model_rep_len, REP_BUCKETS);
+		model_reset(&model_rep_dist, REP_BUCKETS);
+	}
+
+	if (saved_events > E_RUN) {
+		model_load(s, &model_run_len);
+		model_load(s, &model_run_char);
+	} else {
+		model_reset(&model_run_len, REP_BUCKETS);
+		model_reset(&model_run_char, 256);
 	}
 
-	events[E_NEW]++;
+	if (saved_events < E_EOF + 1 || saved_events > E_LAST || model_match_size.count != (1 << MATCH_LOGSIZE) || model_chars.count != 256 || model_index1.count != dict_get_elems()
+		|| model_rep_len.count != REP_BUCKETS || model_rep_dist.count != REP_BUCKETS || model_run_len.count != REP_BUCKETS || model_run_char.count != 256) {
+		fprintf(stderr, "Corrupted dictionary\n");
+		abort();
+	}
 }
 
-void decode_match(struct bio *bio, char *p, size_t *p_len)
+/* the events of the state are those of the format version of the coder */
+void adapt_events()
 {
-	*p_len = ac_decode_symbol_model(&ac, bio, &model_match_size) + 1;
-	sizes[E_NEW] += prob_to_bits(ac_encode_symbol_model_query_prob(*p_len - 1, &model_match_size));
-	inc_model(&model_match_size, *p_len - 1);
+	if (model_events.count > event_count(format_version)) {
+		fprintf(stderr, "Corrupted dictionary\n");
+		abort();
+	}
 
-	for (size_t c = 0; c < *p_len; ++c) {
-		p[c] = (char)ac_decode_symbol_model(&ac, bio, &model_chars);
-		sizes[E_NEW] += prob_to_bits(ac_encode_symbol_model_query_prob((unsigned char)p[c], &model_chars));
-		inc_model(&model_chars, (unsigned char)p[c]);
+	/* the new events are the least likely */
+	while (model_events.count < event_count(format_version)) {
+		model_enlarge(&model_events);
 	}
 }
 
-char *decompress(char *ptr, struct bio *bio)
+void load_state(struct snapshot *s)
 {
-	size_t prev_context1 = 0; /* previous context1 */
-	size_t context1 = 0; /* last tag */
+	parse_state(s);
+	adapt_events();
+}
 
-	char *p = ptr;
+/* when set, destroy() keeps the storage of the coder for the next create() on this thread */
+static THREAD_LOCAL int g_keep_storage = 0;
 
-	for (;;) {
-		size_t decision = ac_decode_symbol_model(&ac, bio, &model_events);
-		sizes[decision] += prob_to_bits(ac_encode_symbol_model_query_prob(decision, &model_events));
-		inc_model(&model_events, decision);
+/* the storage has been kept by destroy() */
+static THREAD_LOCAL int g_storage_kept = 0;
 
-		if (decision == E_EOF) {
-			break;
-		} else if (decision == E_NEW) {
-			/* new match */
+void free_storage()
+{
+	for (size_t e = 0; e < ctx1_capacity; ++e) {
+		free(ctx1[e].arr);
+	}
+	free(ctx1);
+	ctx1 = NULL;
+	ctx1_capacity = 0;
+	dict_destroy();
 
-			size_t len;
+	for (size_t e = 0; e < ctx0_capacity; ++e) {
+		free(ctx0[e].arr);
+	}
+	free(ctx0);
+	ctx0 = NULL;
+	ctx0_capacity = 0;
+	tag_pair_destroy();
 
-			decode_match(bio, p, &len);
+	g_storage_kept = 0;
 
-			struct elem e;
-			elem_fill(&e, p, len);
+	model_destroy(&model_events);
+	model_destroy(&model_match_size);
+	model_destroy(&model_chars);
+	model_destroy(&model_index1);
+	model_destroy(&model_rep_len);
+	model_destroy(&model_rep_dist);
+	model_destroy(&model_run_len);
+	model_destroy(&model_run_char);
 
-			if (dict_query_elem(&e) == 0) {
-				if (!dict_can_insert_elem()) {
-					dict_enlarge();
-					enlarge_ctx1();
-				}
+	ctx_free_decoder();
 
-				dict_insert_elem(&e);
-				model_enlarge(&model_index1);
-			}
+	repeat_destroy();
+}
 
-			p += len;
+/* the trained state parsed from the dictionary once, the coders start from the copies of it */
+static struct {
+	size_t prev_context1;
+	size_t context1;
+	size_t pos;
+	struct dict_state dict;
+	struct tag_pair_state tag_pair;
+	struct ctx *ctx1; /* dict.size contexts */
+	struct ctx *ctx0; /* tag_pair.size contexts */
+	struct model events, match_size, chars, index1, rep_len, rep_dist, run_len, run_char;
+} g_trained;
+
+/* the empty dictionary, the map and the contexts, in the storage kept by destroy() if any */
+void clear_storage()
+{
+	if (g_storage_kept) {
+		g_storage_kept = 0;
 
-			prev_context1 = 0;
-			context1 = 0;
+		/* only the contexts in use are cleared, those beyond the sizes of the dictionary and of the map are empty */
+		ctx_clear(ctx1, dict_get_size() < ctx1_capacity ? dict_get_size() : ctx1_capacity);
+		dict_reset();
 
-			dict_update_costs(p);
+		ctx_clear(ctx0, tag_pair_get_size() < ctx0_capacity ? tag_pair_get_size() : ctx0_capacity);
+		tag_pair_reset();
+	} else {
+		tag_pair_create();
+	}
+}
 
-			events[E_NEW]++;
-		} else {
-			/* in dictionary */
+/* the trained state is parsed by this thread, which hands its storage over to it */
+void parse_trained_state()
+{
+	static const struct model no_model;
+	const struct dict_state no_dict = { 0, 1, 0, NULL, 0 };
+	const struct tag_pair_state no_map = { NULL, 0, 1 };
+	struct snapshot s;
+
+	free_storage();
+
+	snapshot_open(&s, g_dict, g_dict_size);
+	parse_state(&s);
+
+	g_trained.prev_context1 = stream.prev_context1;
+	g_trained.context1 = stream.context1;
+	g_trained.pos = stream.pos;
+
+	dict_get_state(&g_trained.dict);
+	tag_pair_get_state(&g_trained.tag_pair);
+
+	g_trained.ctx1 = ctx1;
+	g_trained.ctx0 = ctx0;
+
+	g_trained.events = model_events;
+	g_trained.match_size = model_match_size;
+	g_trained.chars = model_chars;
+	g_trained.index1 = model_index1;
+	g_trained.rep_len = model_rep_len;
+	g_trained.rep_dist = model_rep_dist;
+	g_trained.run_len = model_run_len;
+	g_trained.run_char = model_run_char;
+
+	dict_set_state(&no_dict);
+	tag_pair_set_state(&no_map);
+
+	ctx1 = NULL;
+	ctx0 = NULL;
+	ctx1_capacity = 0;
+	ctx0_capacity = 0;
+	ctx_memory = 0;
+
+	model_events = no_model;
+	model_match_size = no_model;
+	model_chars = no_model;
+	model_index1 = no_model;
+	model_rep_len = no_model;
+	model_rep_dist = no_model;
+	model_run_len = no_model;
+	model_run_char = no_model;
+}
 
-			size_t index = decode_tag(decision, bio, prev_context1, context1);
+void free_trained_state()
+{
+	free(g_trained.dict.dict);
+	tag_pair_free(g_trained.tag_pair.map);
 
-			size_t len = dict_get_len_by_index(index);
+	for (size_t e = 0; e < g_trained.dict.size; ++e) {
+		free(g_trained.ctx1[e].arr);
+	}
+	free(g_trained.ctx1);
 
-			prev_context1 = context1;
-			context1 = dict_get_tag_by_index(index);
+	for (size_t e = 0; e < g_trained.tag_pair.size; ++e) {
+		free(g_trained.ctx0[e].arr);
+	}
+	free(g_trained.ctx0);
+
+	model_destroy(&g_trained.events);
+	model_destroy(&g_trained.match_size);
+	model_destroy(&g_trained.chars);
+	model_destroy(&g_trained.index1);
+	model_destroy(&g_trained.rep_len);
+	model_destroy(&g_trained.rep_dist);
+	model_destroy(&g_trained.run_len);
+	model_destroy(&g_trained.run_char);
+}
 
-			dict_set_last_pos(index, p);
+/* the coder starts from a copy of the trained state, in the storage of this thread */
+void copy_trained_state()
+{
+	stream.prev_context1 = g_trained.prev_context1;
+	stream.context1 = g_trained.context1;
+	stream.pos = g_trained.pos;
+	stream.history = 0;
+	stream.eof = 0;
 
-			/* put uncompressed fragment */
-			const char *s = dict_get_str_by_index(index);
-			for (size_t c = 0; c < len; ++c) {
-				p[c] = s[c];
-			}
+	repeat_reset();
 
-			p += len;
+	clear_storage();
 
-			/* recalc all costs, sort */
-			dict_update_costs(p);
-		}
-	}
+	dict_copy(&g_trained.dict);
+	tag_pair_copy(&g_trained.tag_pair);
 
-	return p;
+	enlarge_ctx1(dict_get_size());
+	enlarge_ctx0(tag_pair_get_size());
+
+	ctx_copy(ctx1, g_trained.ctx1, dict_get_size());
+	ctx_copy(ctx0, g_trained.ctx0, tag_pair_get_size());
+
+	ctx_memory = ctx_count_memory(ctx1, dict_get_size()) + ctx_count_memory(ctx0, tag_pair_get_size());
+
+	model_copy(&model_events, &g_trained.events);
+	model_copy(&model_match_size, &g_trained.match_size);
+	model_copy(&model_chars, &g_trained.chars);
+	model_copy(&model_index1, &g_trained.index1);
+	model_copy(&model_rep_len, &g_trained.rep_len);
+	model_copy(&model_rep_dist, &g_trained.rep_dist);
+	model_copy(&model_run_len, &g_trained.run_len);
+	model_copy(&model_run_char, &g_trained.run_char);
+
+	adapt_events();
 }
 
-static int g_nl = 0;
+void create()
+{
+	if (g_dict != NULL) {
+		copy_trained_state();
 
-size_t nl(size_t len)
+		return;
+	}
+
+	stream.prev_context1 = 0;
+	stream.context1 = 0;
+	stream.pos = 0;
+	stream.history = 0;
+	stream.eof = 0;
+
+	ctx_memory = 0;
+
+	repeat_reset();
+
+	clear_storage();
+
+	dict_enlarge();
+	enlarge_ctx1(dict_get_size());
+
+	tag_pair_enlarge();
+	enlarge_ctx0(tag_pair_get_size());
+
+	/* initialize AC models */
+	model_reset(&model_events, event_count(format_version));
+
+	/* initial frequencies in model_events */
+	model_events.table[E_CTX0].freq = 1024;
+	model_events.table[E_CTX1].freq = 1024;
+	model_events.table[E_IDX1].freq = 1;
+	model_events.table[E_NEW ].freq = 1;
+	count_cum_freqs(model_events.table, model_events.count);
+	model_events.total = calc_total_freq(model_events.table, model_events.count);
+
+	model_reset(&model_match_size, 1 << MATCH_LOGSIZE);
+	model_reset(&model_chars, 256);
+	model_reset(&model_index1, 0);
+	model_reset(&model_rep_len, REP_BUCKETS);
+	model_reset(&model_rep_dist, REP_BUCKETS);
+	model_reset(&model_run_len, REP_BUCKETS);
+	model_reset(&model_run_char, 256);
+}
+
+/* the cost of the token goes to the statistics and to the trace */
+void add_token_bits(float bits)
 {
-	if (g_nl != 0) {
-		switch (len - 1) {
-			case 0: return 1;
-			case 1: return 4;
-			case 2: return 6;
-			case 3: return 8;
-			default: return 9999;
+	if (STATS_ENABLED) {
+		sizes[token_cost.event] += bits;
+	}
+
+	token_cost.bits += bits;
+}
+
+void encode_match(struct bio *bio, const char *p, size_t len)
+{
+	token_cost.event = E_NEW;
+	token_cost.ctx0 = TRACE_NONE;
+	token_cost.bits = 0.f;
+
+	if (COST_ENABLED) {
+		add_token_bits(prob_to_bits(ac_encode_symbol_model_query_prob(E_NEW, &model_events)));
+	}
+	ac_encode_symbol_model(&ac, bio, E_NEW, &model_events);
+	inc_model(&model_events, E_NEW);
+
+	assert(len > 0 && len <= (1 << MATCH_LOGSIZE));
+
+	if (COST_ENABLED) {
+		add_token_bits(prob_to_bits(ac_encode_symbol_model_query_prob(len - 1, &model_match_size)));
+	}
+	ac_encode_symbol_model(&ac, bio, len - 1, &model_match_size);
+	inc_model(&model_match_size, len - 1);
+
+	for (size_t c = 0; c < len; ++c) {
+		if (COST_ENABLED) {
+			add_token_bits(prob_to_bits(ac_encode_symbol_model_query_prob((unsigned char)p[c], &model_chars)));
 		}
-	} else {
-		return len;
+		ac_encode_symbol_model(&ac, bio, (unsigned char)p[c], &model_chars);
+		inc_model(&model_chars, (unsigned char)p[c]);
+	}
+
+	if (STATS_ENABLED) {
+		events[E_NEW]++;
 	}
 }
 
-void compress(char *ptr, size_t size, struct bio *bio)
+/* the number of the bits of the value, and the bits below the top one */
+void encode_number(struct bio *bio, size_t value, struct model *model)
 {
-	char *end = ptr + size;
+	size_t bucket = 0;
 
-	size_t prev_context1 = 0; /* previous context1 */
-	size_t context1 = 0; /* last tag */
+	while (value >> bucket) {
+		bucket++;
+	}
 
-	for (char *p = ptr; p < end; ) {
-		/* (1) look into dictionary */
-		size_t index = dict_find_match(p);
+	assert(bucket < REP_BUCKETS);
+
+	if (COST_ENABLED) {
+		add_token_bits(prob_to_bits(ac_encode_symbol_model_query_prob(bucket, model)) + (bucket > 1 ? bucket - 1 : 0));
+	}
+	ac_encode_symbol_model(&ac, bio, bucket, model);
+	inc_model(model, bucket);
+
+	for (size_t bits = bucket > 1 ? bucket - 1 : 0; bits > 0; ) {
+		size_t n = minsize(bits, 16);
+
+		bits -= n;
+
+		ac_encode_bits(&ac, bio, (value >> bits) & (((size_t)1 << n) - 1), n);
+	}
+}
+
+/* the repeat of len bytes from dist bytes back */
+void encode_repeat(struct bio *bio, size_t len, size_t dist)
+{
+	token_cost.event = E_REP;
+	token_cost.ctx0 = TRACE_NONE;
+	token_cost.bits = 0.f;
+
+	if (COST_ENABLED) {
+		add_token_bits(prob_to_bits(ac_encode_symbol_model_query_prob(E_REP, &model_events)));
+	}
+	ac_encode_symbol_model(&ac, bio, E_REP, &model_events);
+	inc_model(&model_events, E_REP);
+
+	assert(len >= REP_MIN_LEN && len <= REP_MAX_LEN && dist > 0 && dist <= REP_WINDOW);
+
+	encode_number(bio, len - REP_MIN_LEN, &model_rep_len);
+	encode_number(bio, dist - 1, &model_rep_dist);
+
+	if (STATS_ENABLED) {
+		events[E_REP]++;
+	}
+}
+
+/* the run of len bytes c */
+void encode_run(struct bio *bio, size_t len, unsigned char c)
+{
+	token_cost.event = E_RUN;
+	token_cost.ctx0 = TRACE_NONE;
+	token_cost.bits = 0.f;
+
+	if (COST_ENABLED) {
+		add_token_bits(prob_to_bits(ac_encode_symbol_model_query_prob(E_RUN, &model_events)));
+	}
+	ac_encode_symbol_model(&ac, bio, E_RUN, &model_events);
+	inc_model(&model_events, E_RUN);
+
+	assert(len >= RUN_MIN_LEN && len <= RUN_MAX_LEN);
+
+	if (COST_ENABLED) {
+		add_token_bits(prob_to_bits(ac_encode_symbol_model_query_prob(c, &model_run_char)));
+	}
+	ac_encode_symbol_model(&ac, bio, c, &model_run_char);
+	inc_model(&model_run_char, c);
+
+	encode_number(bio, len - RUN_MIN_LEN, &model_run_len);
+
+	if (STATS_ENABLED) {
+		events[E_RUN]++;
+	}
+}
+
+/* the record of the token just coded (the contexts are those it was coded in) */
+void trace_token(size_t pos, size_t len, size_t index, size_t tag, size_t prev_context1, size_t context1)
+{
+	struct trace_record record;
+	unsigned char buf[TRACE_RECORD_SIZE];
+
+	record.pos = pos;
+	record.event = token_cost.event;
+	record.len = (unsigned)len;
+	record.index = (uint32_t)index;
+	record.tag = (uint32_t)tag;
+	record.prev_context1 = (uint32_t)prev_context1;
+	record.context1 = (uint32_t)context1;
+	record.ctx0 = token_cost.ctx0;
+	record.bits = token_cost.bits;
+
+	trace_write_record(&record, buf);
+	fsave(buf, TRACE_RECORD_SIZE, trace);
+}
+
+/* compare the stored checksum with the one of the decoded data */
+void verify_checksum(const void *ptr, uint32_t crc)
+{
+	if (frame_read_checksum(ptr) != crc) {
+		fprintf(stderr, "Checksum mismatch\n");
+		abort();
+	}
+}
+
+void decode_match(struct bio *bio, char *p, const char *end, size_t *p_len)
+{
+	*p_len = ac_decode_symbol_model(&ac, bio, &model_match_size) + 1;
+	if (*p_len > (size_t)(end - p)) {
+		corrupted();
+	}
+	if (STATS_ENABLED) {
+		sizes[E_NEW] += prob_to_bits(ac_encode_symbol_model_query_prob(*p_len - 1, &model_match_size));
+	}
+	inc_model(&model_match_size, *p_len - 1);
+
+	for (size_t c = 0; c < *p_len; ++c) {
+		p[c] = (char)ac_decode_symbol_model(&ac, bio, &model_chars);
+		if (STATS_ENABLED) {
+			sizes[E_NEW] += prob_to_bits(ac_encode_symbol_model_query_prob((unsigned char)p[c], &model_chars));
+		}
+		inc_model(&model_chars, (unsigned char)p[c]);
+	}
+}
+
+size_t decode_number(struct bio *bio, struct model *model, size_t event)
+{
+	size_t bucket = ac_decode_symbol_model(&ac, bio, model);
+
+	if (STATS_ENABLED) {
+		sizes[event] += prob_to_bits(ac_encode_symbol_model_query_prob(bucket, model)) + (bucket > 1 ? bucket - 1 : 0);
+	}
+	inc_model(model, bucket);
+
+	if (bucket <= 1) {
+		return bucket;
+	}
+
+	size_t value = 1;
+
+	for (size_t bits = bucket - 1; bits > 0; ) {
+		size_t n = minsize(bits, 16);
+
+		bits -= n;
+
+		value = value << n | ac_decode_bits(&ac, bio, n);
+	}
+
+	return value;
+}
+
+/* the repeat fits into [p, end), and starts within the history */
+void decode_repeat(struct bio *bio, char *p, const char *end, size_t history, size_t *p_len)
+{
+	size_t len = decode_number(bio, &model_rep_len, E_REP) + REP_MIN_LEN;
+	size_t dist = decode_number(bio, &model_rep_dist, E_REP) + 1;
+
+	if (len > REP_MAX_LEN || len > (size_t)(end - p) || dist > history) {
+		corrupted();
+	}
+
+	/* byte by byte, the repeat may overlap itself */
+	const char *s = p - dist;
+
+	for (size_t c = 0; c < len; ++c) {
+		p[c] = s[c];
+	}
+
+	*p_len = len;
+}
+
+/* the run fits into [p, end) */
+void decode_run(struct bio *bio, char *p, const char *end, size_t *p_len)
+{
+	size_t c = ac_decode_symbol_model(&ac, bio, &model_run_char);
+
+	if (STATS_ENABLED) {
+		sizes[E_RUN] += prob_to_bits(ac_encode_symbol_model_query_prob(c, &model_run_char));
+	}
+	inc_model(&model_run_char, c);
+
+	size_t len = decode_number(bio, &model_run_len, E_RUN) + RUN_MIN_LEN;
+
+	if (len > RUN_MAX_LEN || len > (size_t)(end - p)) {
+		corrupted();
+	}
+
+	memset(p, (int)c, len);
+
+	*p_len = len;
+}
+
+/*
+ * Decompress into the buffer [ptr, end).
+ * Stops at the end of the stream, or once the decompressed data pass the stop.
+ * A fragment that does not fit into the buffer means a corrupted stream.
+ * Returns the end of the decompressed data.
+ */
+char *decompress(char *ptr, char *stop, char *end, struct bio *bio)
+{
+	size_t prev_context1 = stream.prev_context1;
+	size_t context1 = stream.context1;
+
+	char *p = ptr;
+
+	while (p <= stop) {
+		phase_switch(P_CODE);
+
+		size_t decision = ac_decode_symbol_model(&ac, bio, &model_events);
+		if (STATS_ENABLED) {
+			sizes[decision] += prob_to_bits(ac_encode_symbol_model_query_prob(decision, &model_events));
+		}
+		inc_model(&model_events, decision);
+
+		if (decision == E_EOF) {
+			stream.eof = 1;
+			break;
+		} else if (decision == E_RUN) {
+			size_t len;
+
+			phase_switch(P_OTHER);
+
+			decode_run(bio, p, end, &len);
+
+			p += len;
+
+			/* the dictionary is left as it is, the next fragment sorts it */
+			prev_context1 = 0;
+			context1 = 0;
+
+			if (STATS_ENABLED) {
+				events[E_RUN]++;
+			}
+		} else if (decision == E_REP) {
+			size_t len;
+
+			phase_switch(P_OTHER);
+
+			decode_repeat(bio, p, end, rep_history(ptr, p), &len);
+
+			p += len;
+
+			prev_context1 = 0;
+			context1 = 0;
+
+			phase_switch(P_DICT_SORT);
+
+			dict_update_costs(stream.pos + (p - ptr));
+
+			if (STATS_ENABLED) {
+				events[E_REP]++;
+			}
+		} else if (decision == E_NEW) {
+			/* new match */
+
+			size_t len;
+
+			decode_match(bio, p, end, &len);
+
+			phase_switch(P_DICT_LOOKUP);
+
+			struct elem e;
+			elem_fill(&e, p, len, stream.pos + (p - ptr));
+
+			update_dict(&e);
+
+			p += len;
+
+			prev_context1 = 0;
+			context1 = 0;
+
+			phase_switch(P_DICT_SORT);
+
+			dict_update_costs(stream.pos + (p - ptr));
+
+			if (STATS_ENABLED) {
+				events[E_NEW]++;
+			}
+		} else {
+			/* in dictionary */
+
+			phase_switch(P_MODEL);
+
+			size_t index = decode_tag(decision, bio, prev_context1, context1);
+
+			phase_switch(P_OTHER);
 
-		if (index != (size_t)-1 && nl(dict_get_len_by_index(index)) >= find_best_match(p) && p + dict_get_len_by_index(index) <= end) {
-			/* found in dictionary */
 			size_t len = dict_get_len_by_index(index);
 
-			encode_tag(bio, prev_context1, context1, index);
+			if (len > (size_t)(end - p)) {
+				corrupted();
+			}
 
 			prev_context1 = context1;
 			context1 = dict_get_tag_by_index(index);
 
-			dict_set_last_pos(index, p);
+			dict_set_last_pos(index, stream.pos + (p - ptr));
+
+			/* put uncompressed fragment */
+			const char *s = dict_get_str_by_index(index);
+			for (size_t c = 0; c < len; ++c) {
+				p[c] = s[c];
+			}
 
 			p += len;
 
+			phase_switch(P_DICT_SORT);
+
 			/* recalc all costs, sort */
-			dict_update_costs(p);
-		} else {
-			/* (2) else find best match and insert it into dictionary */
-			size_t len = find_best_match(p);
+			dict_update_costs(stream.pos + (p - ptr));
+		}
+	}
 
-			if (p + len > end) {
-				len = end - p;
-			}
+	phase_switch(P_LAST);
 
-			encode_match(bio, p, len);
+	rep_advance(ptr, p);
 
-			struct elem e;
-			elem_fill(&e, p, len);
+	stream.prev_context1 = prev_context1;
+	stream.context1 = context1;
+	stream.pos += p - ptr;
 
-			/* close to the 'end', the alg. tries to insert matches already stored in the dictionary */
-			if (dict_query_elem(&e) == 0) {
-				if (!dict_can_insert_elem()) {
-					dict_enlarge();
-					enlarge_ctx1();
-				}
+	return p;
+}
+
+/* the repeats are clipped to the end, and do not look past the forward window (as in the streaming mode) */
+size_t rep_max_len(const char *p, const char *end)
+{
+	return minsize(minsize(REP_MAX_LEN, get_forward_window()), (size_t)(end - p));
+}
+
+/* the length of the run of p[0] at p, clipped as the repeats, or 0 if shorter than RUN_MIN_LEN */
+size_t run_length(const char *p, const char *end)
+{
+	size_t max_len = minsize(minsize(RUN_MAX_LEN, get_forward_window()), (size_t)(end - p));
+
+	/* the common case, not a run */
+	if (max_len < RUN_MIN_LEN || p[1] != p[0] || p[RUN_MIN_LEN - 1] != p[0]) {
+		return 0;
+	}
+
+	/* by words */
+	uint64_t w = UINT64_C(0x0101010101010101) * (unsigned char)p[0];
+	size_t len = 0;
+
+	for (; len + 8 <= max_len; len += 8) {
+		uint64_t v;
+
+		memcpy(&v, p + len, 8);
+
+		if (v != w) {
+			break;
+		}
+	}
+
+	while (len < max_len && p[len] == p[0]) {
+		len++;
+	}
+
+	return len >= RUN_MIN_LEN ? len : 0;
+}
+
+static THREAD_LOCAL int g_nl = 0;
+
+size_t nl(size_t len)
+{
+	if (g_nl != 0) {
+		switch (len - 1) {
+			case 0: return 1;
+			case 1: return 4;
+			case 2: return 6;
+			case 3: return 8;
+			default: return 9999;
+		}
+	} else {
+		return len;
+	}
+}
+
+/* the parameters of the parser on this thread, handed over to the threads of the coders (they start with the defaults) */
+struct parser_params {
+	struct backend_params backend;
+	int nl;
+};
+
+void get_parser_params(struct parser_params *params)
+{
+	get_backend_params(&params->backend);
+	params->nl = g_nl;
+}
+
+void set_parser_params(const struct parser_params *params)
+{
+	set_backend_params(&params->backend);
+	g_nl = params->nl;
+}
+
+/* parse on a second thread, the coder consumes the tokens (--pipeline) */
+static int g_pipeline = 0;
+
+/* the parser hands the fragments over to the coder in this form */
+struct token {
+	const char *p; /* the new fragment (E_NEW) */
+	size_t index; /* in the dictionary (E_IDX1), the size of the dictionary after the insertion (E_NEW), the distance (E_REP), or the byte (E_RUN) */
+	size_t tag; /* of the fragment (E_IDX1), or of the inserted one (E_NEW, for the trace) */
+	unsigned len; /* of the fragment */
+	unsigned char event; /* E_IDX1 for a fragment in the dictionary (the coder chooses the context), E_NEW, E_REP, E_RUN, or E_EOF after the last one */
+	unsigned char inserted; /* the new fragment has been inserted into the dictionary (E_NEW) */
+};
+
+/* the tokens in flight */
+#define PIPELINE_TOKENS 4096
+
+/* the parser thread owns the dictionary until it is done */
+struct parser {
+	char *ptr;
+	char *stop;
+	char *end;
+	size_t pos; /* of the ptr in the stream */
+	size_t history; /* before the ptr, for the repeats */
+	struct parser_params params; /* of the coder thread */
+	unsigned version; /* the format version of the stream */
+	struct mem_limit mem_limit; /* of the coder */
+	struct dict_state dict;
+	struct repeat_state repeat;
+	struct ring ring;
+	char *p; /* past the last fragment */
+	uint64_t phase_cycles[P_LAST];
+};
+
+/* the same parsing as in compress(), the coding is replaced by the tokens */
+void *parse_thread(void *arg)
+{
+	struct parser *parser = arg;
+
+	char *ptr = parser->ptr;
+	char *stop = parser->stop;
+	char *end = parser->end;
+
+	/* the thread-locals the parser reads are those of the coder thread */
+	set_parser_params(&parser->params);
+	format_version = parser->version;
+	mem_limit = parser->mem_limit;
+	dict_set_state(&parser->dict);
+	repeat_set_state(&parser->repeat);
+
+	char *p;
+
+	for (p = ptr; p < stop; ) {
+		struct token t;
+
+		if (RUN_ENABLED) {
+			phase_switch(P_MATCH);
+
+			size_t len = run_length(p, end);
+
+			if (len > 0) {
+				phase_switch(P_OTHER);
+
+				t.event = E_RUN;
+				t.index = (unsigned char)p[0];
+				t.len = (unsigned)len;
+
+				ring_push(&parser->ring, &t);
+
+				p += len;
+
+				continue;
+			}
+		}
+
+		if (REP_ENABLED) {
+			phase_switch(P_MATCH);
+
+			size_t dist;
+			size_t len = repeat_find(p, rep_max_len(p, end), parser->pos + (p - ptr), minsize(parser->history + (p - ptr), REP_WINDOW), &dist);
+
+			if (len > 0) {
+				phase_switch(P_OTHER);
+
+				t.event = E_REP;
+				t.index = dist;
+				t.len = (unsigned)len;
+
+				ring_push(&parser->ring, &t);
+
+				repeat_insert(p, len, p + get_forward_window(), parser->pos + (p - ptr));
+
+				p += len;
+
+				phase_switch(P_DICT_SORT);
+
+				dict_update_costs(parser->pos + (p - ptr));
+
+				continue;
+			}
+		}
+
+		phase_switch(P_DICT_LOOKUP);
+
+		size_t index = dict_find_match(p);
+
+		phase_switch(P_MATCH);
+
+		if (index != (size_t)-1 && nl(dict_get_len_by_index(index)) >= find_best_match(p) && p + dict_get_len_by_index(index) <= end) {
+			size_t len = dict_get_len_by_index(index);
+
+			phase_switch(P_OTHER);
+
+			t.event = E_IDX1;
+			t.index = index;
+			t.tag = dict_get_tag_by_index(index);
+			t.len = (unsigned)len;
+
+			ring_push(&parser->ring, &t);
+
+			dict_set_last_pos(index, parser->pos + (p - ptr));
+
+			if (REP_ENABLED) {
+				repeat_insert(p, len, p + get_forward_window(), parser->pos + (p - ptr));
+			}
+
+			p += len;
+
+			phase_switch(P_DICT_SORT);
+
+			dict_update_costs(parser->pos + (p - ptr));
+		} else {
+			size_t len = find_best_match(p);
+
+			if (p + len > end) {
+				len = end - p;
+			}
+
+			phase_switch(P_DICT_LOOKUP);
+
+			struct elem e;
+			elem_fill(&e, p, len, parser->pos + (p - ptr));
+
+			t.event = E_NEW;
+			t.p = p;
+			t.len = (unsigned)len;
+			t.inserted = (unsigned char)insert_dict(&e);
+			t.index = dict_get_size();
+			t.tag = t.inserted ? dict_get_elems() - 1 : TRACE_NONE;
+
+			ring_push(&parser->ring, &t);
+
+			if (REP_ENABLED) {
+				repeat_insert(p, len, p + get_forward_window(), parser->pos + (p - ptr));
+			}
+
+			p += len;
+
+			phase_switch(P_DICT_SORT);
+
+			dict_update_costs(parser->pos + (p - ptr));
+		}
+	}
+
+	phase_switch(P_LAST);
+
+	dict_get_state(&parser->dict);
+	repeat_get_state(&parser->repeat);
+
+	parser->p = p;
+	memcpy(parser->phase_cycles, phase_cycles, sizeof(phase_cycles));
+
+	struct token t;
+
+	t.event = E_EOF;
+
+	ring_push(&parser->ring, &t);
+
+	return NULL;
+}
+
+/*
+ * The parser (match finding and the dictionary) runs on its own thread, and this thread models and codes its tokens.
+ * The coder does not depend on the parser otherwise, so the output is the same as that of the serial compress().
+ */
+char *compress_pipelined(char *ptr, char *stop, char *end, struct bio *bio)
+{
+	struct parser parser;
+
+	parser.ptr = ptr;
+	parser.stop = stop;
+	parser.end = end;
+	parser.pos = stream.pos;
+	parser.history = stream.history;
+
+	get_parser_params(&parser.params);
+	parser.version = format_version;
+	parser.mem_limit = mem_limit;
+
+	/* the dictionary (and the positions of the repeats) must not be used on this thread until they are returned */
+	dict_get_state(&parser.dict);
+	repeat_get_state(&parser.repeat);
+
+	ring_create(&parser.ring, sizeof(struct token), PIPELINE_TOKENS);
+
+	pthread_t thread;
+
+	if (pthread_create(&thread, NULL, parse_thread, &parser)) {
+		fprintf(stderr, "Cannot create thread\n");
+		abort();
+	}
+
+	size_t prev_context1 = stream.prev_context1;
+	size_t context1 = stream.context1;
+
+	/* of the token, for the trace */
+	size_t pos = stream.pos;
+
+	for (;;) {
+		struct token t;
+
+		/* waiting for the parser */
+		phase_switch(P_OTHER);
+
+		ring_pop(&parser.ring, &t);
+
+		if (t.event == E_EOF) {
+			break;
+		}
+
+		if (t.event == E_RUN) {
+			phase_switch(P_CODE);
+
+			encode_run(bio, t.len, (unsigned char)t.index);
+
+			if (trace != NULL) {
+				trace_token(pos, t.len, t.index, TRACE_NONE, prev_context1, context1);
+			}
+
+			prev_context1 = 0;
+			context1 = 0;
+		} else if (t.event == E_REP) {
+			phase_switch(P_CODE);
+
+			encode_repeat(bio, t.len, t.index);
+
+			if (trace != NULL) {
+				trace_token(pos, t.len, t.index, TRACE_NONE, prev_context1, context1);
+			}
+
+			prev_context1 = 0;
+			context1 = 0;
+		} else if (t.event == E_NEW) {
+			phase_switch(P_CODE);
+
+			encode_match(bio, t.p, t.len);
+
+			if (t.inserted) {
+				phase_switch(P_MODEL);
+
+				grow_models(t.index);
+			}
+
+			if (trace != NULL) {
+				trace_token(pos, t.len, TRACE_NONE, t.tag, prev_context1, context1);
+			}
+
+			prev_context1 = 0;
+			context1 = 0;
+		} else {
+			phase_switch(P_MODEL);
+
+			encode_tag(bio, prev_context1, context1, t.index, t.tag);
+
+			if (trace != NULL) {
+				trace_token(pos, t.len, t.index, t.tag, prev_context1, context1);
+			}
+
+			prev_context1 = context1;
+			context1 = t.tag;
+		}
+
+		pos += t.len;
+	}
+
+	phase_switch(P_LAST);
+
+	pthread_join(thread, NULL);
+
+	dict_set_state(&parser.dict);
+	repeat_set_state(&parser.repeat);
+
+	ring_destroy(&parser.ring);
+
+	for (int ph = 0; ph < P_LAST; ++ph) {
+		phase_cycles[ph] += parser.phase_cycles[ph];
+	}
+
+	rep_advance(ptr, parser.p);
+
+	stream.prev_context1 = prev_context1;
+	stream.context1 = context1;
+	stream.pos += parser.p - ptr;
+
+	return parser.p;
+}
+
+/*
+ * Compress the fragments starting in [ptr, stop).
+ * The data up to the end are valid, the fragments are clipped to the end.
+ * At least get_forward_padding() bytes after the stop must be readable (the data or zero padding).
+ * Returns the pointer past the last fragment.
+ */
+char *compress(char *ptr, char *stop, char *end, struct bio *bio)
+{
+	/* with the memory limit, the parser depends on the size of the models */
+	if (g_pipeline && mem_limit.size == 0) {
+		return compress_pipelined(ptr, stop, end, bio);
+	}
+
+	size_t prev_context1 = stream.prev_context1;
+	size_t context1 = stream.context1;
+
+	char *p;
+
+	for (p = ptr; p < stop; ) {
+		/* (0) a run of a single byte, without the window scan and the dictionary */
+		if (RUN_ENABLED) {
+			phase_switch(P_MATCH);
+
+			size_t len = run_length(p, end);
+
+			if (len > 0) {
+				phase_switch(P_CODE);
+
+				encode_run(bio, len, (unsigned char)p[0]);
+
+				phase_switch(P_OTHER);
+
+				if (trace != NULL) {
+					trace_token(stream.pos + (p - ptr), len, (unsigned char)p[0], TRACE_NONE, prev_context1, context1);
+				}
+
+				p += len;
+
+				prev_context1 = 0;
+				context1 = 0;
+
+				continue;
+			}
+		}
+
+		/* or a long repeat of the preceding data */
+		if (REP_ENABLED) {
+			phase_switch(P_MATCH);
+
+			size_t dist;
+			size_t len = repeat_find(p, rep_max_len(p, end), stream.pos + (p - ptr), rep_history(ptr, p), &dist);
+
+			if (len > 0) {
+				phase_switch(P_CODE);
+
+				encode_repeat(bio, len, dist);
+
+				phase_switch(P_OTHER);
+
+				if (trace != NULL) {
+					trace_token(stream.pos + (p - ptr), len, dist, TRACE_NONE, prev_context1, context1);
+				}
+
+				repeat_insert(p, len, p + get_forward_window(), stream.pos + (p - ptr));
+
+				p += len;
+
+				prev_context1 = 0;
+				context1 = 0;
+
+				phase_switch(P_DICT_SORT);
+
+				dict_update_costs(stream.pos + (p - ptr));
+
+				continue;
+			}
+		}
+
+		/* (1) look into dictionary */
+		phase_switch(P_DICT_LOOKUP);
+
+		size_t index = dict_find_match(p);
+
+		phase_switch(P_MATCH);
+
+		if (index != (size_t)-1 && nl(dict_get_len_by_index(index)) >= find_best_match(p) && p + dict_get_len_by_index(index) <= end) {
+			/* found in dictionary */
+			size_t len = dict_get_len_by_index(index);
+
+			phase_switch(P_MODEL);
+
+			encode_tag(bio, prev_context1, context1, index, dict_get_tag_by_index(index));
+
+			phase_switch(P_OTHER);
+
+			if (trace != NULL) {
+				trace_token(stream.pos + (p - ptr), len, index, dict_get_tag_by_index(index), prev_context1, context1);
+			}
+
+			prev_context1 = context1;
+			context1 = dict_get_tag_by_index(index);
+
+			dict_set_last_pos(index, stream.pos + (p - ptr));
+
+			if (REP_ENABLED) {
+				repeat_insert(p, len, p + get_forward_window(), stream.pos + (p - ptr));
+			}
+
+			p += len;
+
+			phase_switch(P_DICT_SORT);
+
+			/* recalc all costs, sort */
+			dict_update_costs(stream.pos + (p - ptr));
+		} else {
+			/* (2) else find best match and insert it into dictionary */
+			size_t len = find_best_match(p);
+
+			if (p + len > end) {
+				len = end - p;
+			}
+
+			phase_switch(P_CODE);
+
+			encode_match(bio, p, len);
+
+			phase_switch(P_DICT_LOOKUP);
+
+			struct elem e;
+			elem_fill(&e, p, len, stream.pos + (p - ptr));
+
+			/* close to the 'end', the alg. tries to insert matches already stored in the dictionary */
+			int inserted = update_dict(&e);
+
+			if (trace != NULL) {
+				trace_token(stream.pos + (p - ptr), len, TRACE_NONE, inserted ? dict_get_elems() - 1 : TRACE_NONE, prev_context1, context1);
+			}
+
+			if (REP_ENABLED) {
+				repeat_insert(p, len, p + get_forward_window(), stream.pos + (p - ptr));
+			}
+
+			p += len;
+
+			prev_context1 = 0;
+			context1 = 0;
+
+			phase_switch(P_DICT_SORT);
+
+			dict_update_costs(stream.pos + (p - ptr));
+		}
+	}
+
+	phase_switch(P_LAST);
+
+	rep_advance(ptr, p);
+
+	stream.prev_context1 = prev_context1;
+	stream.context1 = context1;
+	stream.pos += p - ptr;
+
+	return p;
+}
+
+void compress_eof(struct bio *bio)
+{
+	/* signal end of input */
+	ac_encode_symbol_model(&ac, bio, E_EOF, &model_events);
+	inc_model(&model_events, E_EOF);
+}
+
+/* the sizes of the state of this coder */
+void get_state_stats(struct state_stats *stats)
+{
+	stats->dict_elems = dict_get_elems();
+	stats->dict_size = dict_get_size();
+	stats->ctx0_elems = tag_pair_get_elems();
+}
+
+void add_state_stats(const struct state_stats *stats)
+{
+	state_stats.dict_elems += stats->dict_elems;
+	state_stats.dict_size += stats->dict_size;
+	state_stats.ctx0_elems += stats->ctx0_elems;
+}
+
+void destroy()
+{
+#if 0
+	dict_dump();
+#endif
+
+	if (g_keep_storage) {
+		g_storage_kept = 1;
+		return;
+	}
+
+	free_storage();
+}
+
+/* keep the storage across the coders on this thread (or free it when the thread is done) */
+void keep_storage(int keep)
+{
+	g_keep_storage = keep;
+
+	if (!keep && g_storage_kept) {
+		g_storage_kept = 0;
+		free_storage();
+	}
+}
+
+enum {
+	COMPRESS,
+	DECOMPRESS,
+	LIST,
+	TRAIN,
+	APPEND,
+	BENCH
+};
+
+void print_help(char *path)
+{
+	fprintf(stderr, "Usage :\n\t%s [arguments] [input-file] [output-file]\n\n", path);
+	fprintf(stderr, "Arguments :\n");
+	fprintf(stderr, " -d     : force decompression\n");
+	fprintf(stderr, " -z     : force compression\n");
+	fprintf(stderr, " -f     : overwrite existing output file\n");
+	fprintf(stderr, " -l     : print the stream header of the compressed file\n");
+	fprintf(stderr, " -k     : keep (don't delete) input file (default)\n");
+	fprintf(stderr, " -h     : print this message\n");
+	fprintf(stderr, " -b     : benchmark, compress and decompress the files in memory (-t and -w take comma-separated lists)\n");
+	fprintf(stderr, " -i NUM : number of benchmark runs of each file and parameter set (default 5)\n");
+	fprintf(stderr, " --format=FORMAT : print the benchmark results in the text, csv or json format\n");
+	fprintf(stderr, " --messages=LIST : benchmark the latency of the messages of these sizes (in kilobytes, comma-separated)\n");
+	fprintf(stderr, " -r     : process the files in the directories (or in the list on the standard input), -T files at once\n");
+	fprintf(stderr, " -t NUM : maximum number of matches (affects compression ratio and speed)\n");
+	fprintf(stderr, " -w NUM : window size (in kilobytes, affects compression ratio and speed)\n");
+	fprintf(stderr, " -m NUM : magic factor (affects compression ratio and speed)\n");
+	fprintf(stderr, " -s     : print statistics (same as --stats=text)\n");
+	fprintf(stderr, " --stats=FORMAT : print statistics in the text or json format\n");
+	fprintf(stderr, " -T NUM : compress (or decompress) independent blocks on NUM threads (0 = all processors)\n");
+	fprintf(stderr, " -B NUM : block size (in kilobytes, default 4096)\n");
+	fprintf(stderr, " -P NUM : prime each block with NUM kilobytes of the previous block (better ratio, serial decoding)\n");
+	fprintf(stderr, " --target-speed=MBS : compress the blocks at MBS megabytes per second, -t and -w are lowered as needed\n");
+	fprintf(stderr, " --stream : process the input in chunks with bounded memory (default for non-seekable input)\n");
+	fprintf(stderr, " --trace FILE : write a record of each token of the parse to FILE (see x3trace)\n");
+	fprintf(stderr, " --pipeline : compress on two threads, one finds the fragments and the other codes them (same output)\n");
+	fprintf(stderr, " --range OFFSET:LEN : decompress only LEN bytes at OFFSET (needs the blocks, reads only those covering the range)\n");
+	fprintf(stderr, " --no-mmap : read and write the files through stdio instead of mapping them\n");
+	fprintf(stderr, " --no-checksum : do not store the CRC-32C checksums of the content and of the blocks\n");
+	fprintf(stderr, " -M SIZE, --memory=SIZE : memory limit of the coders (in megabytes, or with the K/M/G suffix), the model stops growing at it\n");
+	fprintf(stderr, " -D FILE : start from the trained dictionary (needed for decompression as well)\n");
+	fprintf(stderr, " --train DICT [SAMPLE...] : train the dictionary on the samples (or the standard input)\n");
+	fprintf(stderr, " --checkpoint : save the encoder state next to the output file (OUTPUT.ckpt), so that it can be appended to\n");
+	fprintf(stderr, " --append [INPUT] OUTPUT : continue the compressed file with the input, using its checkpoint\n");
+}
+
+float seconds(long ns)
+{
+	return ns / (float)1000000000L;
+}
+
+float mb_per_s(size_t size, long ns)
+{
+	return ns > 0 ? size / 1e6f / seconds(ns) : 0.f;
+}
+
+/* timings of the individual phases, in nanoseconds */
+struct timing {
+	long load;
+	long code;
+	long save;
+};
+
+static const char *phase_names[P_LAST] = { "match finding", "dictionary lookup", "dictionary reordering", "context modeling", "entropy coding", "other" };
+static const char *phase_keys[P_LAST] = { "match", "dict_lookup", "dict_sort", "model", "code", "other" };
+
+static const char *perf_names[PERF_LAST] = { "cycles", "instructions", "LLC misses", "branch misses" };
+static const char *perf_keys[PERF_LAST] = { "cycles", "instructions", "llc_misses", "branch_misses" };
+
+/* the hardware counters of the whole run, opened with the statistics */
+static struct perf g_perf = { { -1, -1, -1, -1 } };
+
+void print_stats_text(size_t size, size_t asize, const struct timing *timing)
+{
+	size_t dict_hit_count = events[E_CTX0] + events[E_CTX1] + events[E_IDX1];
+
+	size_t stream_size_dict = (size_t)ceil(sizes[E_CTX0] + sizes[E_CTX1] + sizes[E_IDX1]);
+	size_t stream_size      = (size_t)ceil(sizes[E_CTX0] + sizes[E_CTX1] + sizes[E_IDX1] + sizes[E_NEW] + sizes[E_REP] + sizes[E_RUN]);
+
+	fprintf(stderr, "input stream size: %zu\n", size);
+	fprintf(stderr, "output stream size: %zu\n", (stream_size + 7) / 8);
+	fprintf(stderr, "dictionary: hit %zu, miss %zu\n", dict_hit_count, events[E_NEW]);
+
+	fprintf(stderr, "codestream size: dictionary %zu / %f%%, new fragment %zu / %f%%, repeat %zu / %f%%, run %zu / %f%%\n",
+		(stream_size_dict + 7) / 8, 100.f * stream_size_dict / stream_size,
+		((size_t)ceil(sizes[E_NEW]) + 7) / 8, 100.f * (size_t)ceil(sizes[E_NEW]) / stream_size,
+		((size_t)ceil(sizes[E_REP]) + 7) / 8, 100.f * (size_t)ceil(sizes[E_REP]) / stream_size,
+		((size_t)ceil(sizes[E_RUN]) + 7) / 8, 100.f * (size_t)ceil(sizes[E_RUN]) / stream_size
+	);
+
+#if 1
+	fprintf(stderr, "\x1b[37;1mest. compression ratio: %f\x1b[0m\n", size / (float)((stream_size + 7) / 8));
+	fprintf(stderr, "\x1b[37;1mreal compression ratio: %f\x1b[0m\n", size / (float)asize);
+#else
+	fprintf(stderr, "est. compression ratio: %f\n", size / (float)((stream_size + 7) / 8));
+	fprintf(stderr, "real compression ratio: %f\n", size / (float)asize);
+#endif
+
+	fprintf(stderr, "number of events: ctx0 %zu, ctx1 %zu, miss1 %zu, new %zu, rep %zu, run %zu\n",
+		events[E_CTX0], events[E_CTX1], events[E_IDX1], events[E_NEW], events[E_REP], events[E_RUN]);
+	fprintf(stderr, "event sizes: ctx0 %f%%, ctx1 %f%%, miss1 %f%%, new %f%%, rep %f%%, run %f%%\n",
+		100.f * (size_t)ceil(sizes[E_CTX0]) / stream_size,
+		100.f * (size_t)ceil(sizes[E_CTX1]) / stream_size,
+		100.f * (size_t)ceil(sizes[E_IDX1]) / stream_size,
+		100.f * (size_t)ceil(sizes[E_NEW] ) / stream_size,
+		100.f * (size_t)ceil(sizes[E_REP] ) / stream_size,
+		100.f * (size_t)ceil(sizes[E_RUN] ) / stream_size
+	);
+
+	fprintf(stderr, "context entries: ctx0 %zu, ctx1 %zu\n", state_stats.ctx0_elems, state_stats.dict_elems);
+
+	uint64_t phase_total = 0;
+
+	for (int ph = 0; ph < P_LAST; ++ph) {
+		phase_total += phase_cycles[ph];
+	}
+
+	fprintf(stderr, "phases (cycles):");
+	for (int ph = 0; ph < P_LAST; ++ph) {
+		fprintf(stderr, "%s %s %llu / %f%%", ph ? "," : "", phase_names[ph], (unsigned long long)phase_cycles[ph],
+			phase_total > 0 ? 100.f * phase_cycles[ph] / phase_total : 0.f);
+	}
+	fprintf(stderr, "\n");
+
+	fprintf(stderr, "I/O: load %f s, save %f s\n", seconds(timing->load), seconds(timing->save));
+
+	fprintf(stderr, "kernels: %s\n", get_isa());
+
+	uint64_t counters[PERF_LAST];
+
+	perf_read(&g_perf, counters);
+
+	fprintf(stderr, "hardware counters:");
+	for (int c = 0; c < PERF_LAST; ++c) {
+		if (counters[c] == PERF_NONE) {
+			fprintf(stderr, "%s %s n/a", c ? "," : "", perf_names[c]);
+		} else {
+			fprintf(stderr, "%s %s %llu", c ? "," : "", perf_names[c], (unsigned long long)counters[c]);
+		}
+	}
+	if (counters[PERF_CYCLES] != PERF_NONE && counters[PERF_INSTRUCTIONS] != PERF_NONE && counters[PERF_CYCLES] > 0) {
+		fprintf(stderr, ", IPC %f", counters[PERF_INSTRUCTIONS] / (float)counters[PERF_CYCLES]);
+	}
+	fprintf(stderr, "\n");
+
+#if 0
+	fprintf(stderr, "float PROB_CTX0 = %f;\n", ac_encode_symbol_model_query_prob(E_CTX0, &model_events));
+	fprintf(stderr, "float PROB_CTX1 = %f;\n", ac_encode_symbol_model_query_prob(E_CTX1, &model_events));
+	fprintf(stderr, "float PROB_IDX1 = %f;\n", ac_encode_symbol_model_query_prob(E_IDX1, &model_events));
+#endif
+}
+
+/* a single JSON object, for the metrics pipelines */
+void print_stats_json(int mode, size_t size, size_t asize, const struct timing *timing)
+{
+	fprintf(stderr, "{\"mode\":\"%s\",", mode == COMPRESS ? "compress" : mode == APPEND ? "append" : "decompress");
+	fprintf(stderr, "\"params\":{\"max_match_count\":%i,\"forward_window\":%zu,\"magic_factor1\":%zu,\"magic_factor2\":%zu},",
+		get_max_match_count(), get_forward_window(), get_magic_factor1(), get_magic_factor2());
+	fprintf(stderr, "\"isa\":\"%s\",", get_isa());
+	fprintf(stderr, "\"input_size\":%zu,\"compressed_size\":%zu,\"ratio\":%f,",
+		size, asize, asize > 0 ? size / (float)asize : 0.f);
+	fprintf(stderr, "\"events\":{\"ctx0\":%zu,\"ctx1\":%zu,\"miss1\":%zu,\"new\":%zu,\"rep\":%zu,\"run\":%zu},",
+		events[E_CTX0], events[E_CTX1], events[E_IDX1], events[E_NEW], events[E_REP], events[E_RUN]);
+	fprintf(stderr, "\"bits\":{\"ctx0\":%.0f,\"ctx1\":%.0f,\"miss1\":%.0f,\"new\":%.0f,\"rep\":%.0f,\"run\":%.0f},",
+		ceil(sizes[E_CTX0]), ceil(sizes[E_CTX1]), ceil(sizes[E_IDX1]), ceil(sizes[E_NEW]), ceil(sizes[E_REP]), ceil(sizes[E_RUN]));
+	fprintf(stderr, "\"dictionary\":{\"entries\":%zu,\"size\":%zu},",
+		state_stats.dict_elems, state_stats.dict_size);
+	fprintf(stderr, "\"contexts\":{\"ctx0\":%zu,\"ctx1\":%zu},",
+		state_stats.ctx0_elems, state_stats.dict_elems);
+	fprintf(stderr, "\"phases\":{");
+	for (int ph = 0; ph < P_LAST; ++ph) {
+		fprintf(stderr, "%s\"%s\":%llu", ph ? "," : "", phase_keys[ph], (unsigned long long)phase_cycles[ph]);
+	}
+	fprintf(stderr, "},");
+
+	uint64_t counters[PERF_LAST];
+
+	perf_read(&g_perf, counters);
+
+	fprintf(stderr, "\"counters\":{");
+	for (int c = 0; c < PERF_LAST; ++c) {
+		if (counters[c] == PERF_NONE) {
+			fprintf(stderr, "%s\"%s\":null", c ? "," : "", perf_keys[c]);
+		} else {
+			fprintf(stderr, "%s\"%s\":%llu", c ? "," : "", perf_keys[c], (unsigned long long)counters[c]);
+		}
+	}
+	fprintf(stderr, "},");
+	fprintf(stderr, "\"time\":{\"load\":%f,\"code\":%f,\"save\":%f}}\n",
+		seconds(timing->load), seconds(timing->code), seconds(timing->save));
+}
+
+/* print the header, without decoding the stream */
+void list(FILE *istream)
+{
+	unsigned char buf[65536];
+
+	size_t size = fread(buf, 1, sizeof(buf), istream);
+
+	struct frame_header header;
+
+	if (frame_read_header(&header, buf, size) == (size_t)-1) {
+		fprintf(stderr, "Not an x3 stream\n");
+		abort();
+	}
+
+	frame_print_header(&header, stdout);
+}
+
+/* input chunk of the streaming mode */
+#define STREAM_CHUNK (1 << 20)
+
+static int g_stream = 0;
+
+/* map the files instead of reading them through stdio */
+static int g_mmap = 1;
+
+/* store the checksums of the content and of the blocks */
+static int g_checksum = 1;
+
+/* block mode */
+static size_t g_block_size = 0;
+static size_t g_prime_size = 0;
+static size_t g_threads = 1;
+static int g_blocks = 0;
+
+/* the default block size, if only the number of threads is given */
+#define DEFAULT_BLOCK_SIZE ((size_t)4 << 20)
+
+/* the compression speed to keep in the block mode (in MB/s), 0 = the parameters are fixed */
+static float g_target_speed = 0.f;
+
+/* the single coder on this thread is traced, the blocks are not */
+void open_trace(const char *path, int mode, int force)
+{
+	if (mode != COMPRESS && mode != APPEND) {
+		fprintf(stderr, "The trace is written when compressing\n");
+		abort();
+	}
+
+	if (g_blocks) {
+		fprintf(stderr, "The trace cannot be written with blocks\n");
+		abort();
+	}
+
+	trace = force_fopen(path, "w", force);
+
+	if (trace == NULL) {
+		fprintf(stderr, "Cannot open trace file\n");
+		abort();
+	}
+
+	unsigned char buf[TRACE_HEADER_SIZE];
+
+	trace_write_header(buf);
+	fsave(buf, TRACE_HEADER_SIZE, trace);
+}
+
+void close_trace()
+{
+	if (trace != NULL && fclose(trace)) {
+		fprintf(stderr, "Cannot write trace file\n");
+		abort();
+	}
+
+	trace = NULL;
+}
+
+/* the memory of all the coders running at once (-M), 0 = unlimited */
+static size_t g_mem_budget = 0;
+
+/* SIZE[K|M|G], in megabytes without the suffix */
+void parse_mem_budget(const char *arg)
+{
+	char *end;
+
+	g_mem_budget = (size_t)strtoull(arg, &end, 0);
+
+	switch (*end) {
+		case 'K': case 'k':
+			g_mem_budget <<= 10;
+			end++;
+			break;
+		case 'G': case 'g':
+			g_mem_budget <<= 30;
+			end++;
+			break;
+		case 'M': case 'm':
+			end++;
+			/* fall through */
+		default:
+			g_mem_budget <<= 20;
+	}
+
+	if (end == arg || *end != 0 || g_mem_budget == 0) {
+		fprintf(stderr, "Invalid memory limit\n");
+		abort();
+	}
+}
+
+/* each of the coders running at once gets its share of the budget, in whole kilobytes (as recorded in the stream) */
+void set_encoder_mem_limit(size_t coders)
+{
+	if (g_mem_budget == 0) {
+		return;
+	}
+
+	size_t limit = (g_mem_budget / coders) >> 10;
+
+	if (limit == 0) {
+		fprintf(stderr, "Memory limit too low\n");
+		abort();
+	}
+
+	if (limit > UINT32_MAX) {
+		limit = UINT32_MAX;
+	}
+
+	mem_limit.size = limit << 10;
+	mem_limit.strict = 0;
+}
+
+/* the decoder reproduces the limit of the stream, the streams without it fail at the share of the budget */
+void set_decoder_mem_limit(const struct frame_header *header, size_t coders)
+{
+	mem_limit.size = g_mem_budget / coders;
+	mem_limit.strict = 1;
+
+	if (header->flags & FRAME_FLAG_MEM_LIMIT) {
+		size_t limit = (size_t)header->mem_limit << 10;
+
+		if (mem_limit.size > 0 && limit > mem_limit.size) {
+			fprintf(stderr, "The stream needs more memory than the limit (-M)\n");
+			abort();
+		}
+
+		mem_limit.size = limit;
+		mem_limit.strict = 0;
+	}
+}
+
+/* the coders of the stream stop growing at the limit */
+void set_header_mem_limit(struct frame_header *header)
+{
+	if (mem_limit.size > 0) {
+		frame_header_set_mem_limit(header, (uint32_t)(mem_limit.size >> 10));
+	}
+}
+
+/* upper bound on the size of the bit stream holding size bytes */
+size_t compress_bound(size_t size)
+{
+	/* at most 1 : 2 ratio, plus the final bit-buffer flush */
+	return size * 2 + 64;
+}
+
+/*
+ * Compress [iptr, iptr + isize) into a standalone bit stream at optr (at least compress_bound(isize) bytes).
+ * The input must be followed by get_forward_padding() bytes of zero padding.
+ * Returns the size of the bit stream.
+ */
+size_t compress_buffer(char *iptr, size_t isize, unsigned char *optr)
+{
+	struct bio bio;
+
+	bio_open(&bio, optr, optr + compress_bound(isize), BIO_MODE_WRITE);
+
+	ac_init(&ac);
+
+	/* the data before the buffer are not in memory (e.g., those of the priming) */
+	stream.history = 0;
+
+	compress(iptr, iptr + isize, iptr + isize, &bio);
+	compress_eof(&bio);
+
+	ac_encode_flush(&ac, &bio);
+	bio_close(&bio, BIO_MODE_WRITE);
+
+	return bio.ptr - optr;
+}
+
+/*
+ * Decompress the bit stream [iptr, iptr + isize) holding exactly osize bytes.
+ */
+void decompress_buffer(unsigned char *iptr, size_t isize, char *optr, size_t osize)
+{
+	struct bio bio;
+
+	bio_open(&bio, iptr, iptr + isize, BIO_MODE_READ);
+
+	ac_init(&ac);
+
+	ac_decode_init(&ac, &bio);
+
+	stream.history = 0;
+
+	char *oend = decompress(optr, optr + osize, optr + osize, &bio);
+
+	if (!stream.eof || oend != optr + osize) {
+		corrupted();
+	}
+
+	bio_close(&bio, BIO_MODE_READ);
+}
+
+/* grow the storage of the coder for capacity fragments, past the doubling steps of the dictionary and of the contexts */
+void preallocate_storage(size_t capacity)
+{
+	dict_preallocate(capacity);
+	enlarge_ctx1(capacity);
+	tag_pair_preallocate(capacity);
+	enlarge_ctx0(capacity);
+	model_preallocate(&model_index1, capacity);
+}
+
+/*
+ * Feed the model with the data preceding the block, without producing any output.
+ * The decoder does the same with the decoded data, so the parser must be configured the same way.
+ */
+void prime(const char *ptr, size_t size)
+{
+	size_t padding = get_forward_padding();
+
+	char *iptr = malloc(size + padding);
+	unsigned char *optr = malloc(compress_bound(size));
+
+	if (iptr == NULL) {
+		abort();
+	}
+
+	if (optr == NULL) {
+		abort();
+	}
+
+	memcpy(iptr, ptr, size);
+	memset(iptr + size, 0, padding);
+
+	/* the priming is not a part of the statistics */
+	size_t saved_events[E_LAST];
+	float saved_sizes[E_LAST];
+
+	memcpy(saved_events, events, sizeof(events));
+	memcpy(saved_sizes, sizes, sizeof(sizes));
+
+	compress_buffer(iptr, size, optr);
+
+	memcpy(events, saved_events, sizeof(events));
+	memcpy(sizes, saved_sizes, sizeof(sizes));
+
+	free(iptr);
+	free(optr);
+}
+
+static const unsigned char dict_magic[4] = { 'X', '3', 0x1a, 'D' };
+
+/*
+ * The dictionary file holds the magic, the snapshot of the state after compressing the samples,
+ * and the checksum of the snapshot, which is the dictionary ID.
+ */
+void train(FILE **samples, size_t n, FILE *ostream, int verbose)
+{
+	char *ptr = NULL;
+	size_t size = 0;
+
+	/* the samples are concatenated */
+	for (size_t i = 0; i < n; ++i) {
+		for (;;) {
+			ptr = realloc(ptr, size + STREAM_CHUNK);
+
+			if (ptr == NULL) {
+				abort();
+			}
+
+			size_t m = fload_partial(ptr + size, STREAM_CHUNK, samples[i]);
+
+			size += m;
+
+			if (m < STREAM_CHUNK) {
+				break;
+			}
+		}
+	}
+
+	create();
+
+	prime(ptr, size);
+
+	struct snapshot s;
+
+	snapshot_create(&s);
+	snapshot_put_bytes(&s, dict_magic, 4);
+
+	save_state(&s);
+
+	unsigned char buf[FRAME_CHECKSUM_SIZE];
+	uint32_t id = crc32c(0, s.ptr + 4, s.size - 4);
+
+	frame_write_checksum(buf, id);
+	snapshot_put_bytes(&s, buf, FRAME_CHECKSUM_SIZE);
+
+	fsave(s.ptr, s.size, ostream);
+
+	if (verbose) {
+		fprintf(stderr, "samples: %zu bytes\n", size);
+		fprintf(stderr, "dictionary: %zu entries, %zu bytes, ID %08lx\n", dict_get_elems(), s.size, (unsigned long)id);
+	}
+
+	destroy();
+
+	snapshot_destroy(&s);
+	free(ptr);
+}
+
+static struct fmapping g_dict_map = { NULL, 0 };
+static unsigned char *g_dict_file = NULL;
+
+void load_dict(const char *path)
+{
+	FILE *stream = fopen(path, "r");
+
+	if (stream == NULL) {
+		fprintf(stderr, "Cannot open dictionary file\n");
+		abort();
+	}
+
+	size_t size = fsize(stream);
+
+	unsigned char *ptr = g_mmap ? fmap_input(&g_dict_map, stream, size, 0) : NULL;
+
+	if (ptr == NULL) {
+		ptr = g_dict_file = malloc(size + 1);
+
+		if (ptr == NULL) {
+			abort();
+		}
+
+		fload(ptr, size, stream);
+	}
+
+	fclose(stream);
+
+	if (size < 4 + FRAME_CHECKSUM_SIZE || memcmp(ptr, dict_magic, 4) != 0 || frame_read_checksum(ptr + size - FRAME_CHECKSUM_SIZE) != crc32c(0, ptr + 4, size - 4 - FRAME_CHECKSUM_SIZE)) {
+		fprintf(stderr, "Not an x3 dictionary\n");
+		abort();
+	}
+
+	g_dict = ptr + 4;
+	g_dict_size = size - 4 - FRAME_CHECKSUM_SIZE;
+	g_dict_id = frame_read_checksum(ptr + size - FRAME_CHECKSUM_SIZE);
+
+	parse_trained_state();
+}
+
+void unload_dict()
+{
+	if (g_dict != NULL) {
+		free_trained_state();
+	}
+
+	g_dict = NULL;
+
+	funmap(&g_dict_map);
+	free(g_dict_file);
+	g_dict_file = NULL;
+}
+
+void compress_file(FILE *istream, FILE *ostream, size_t *size, size_t *asize, struct timing *timing)
+{
+	size_t isize = fsize(istream);
+
+	long start = wall_clock();
+
+	/* the mapping is followed by the zero padding */
+	struct fmapping imap = { NULL, 0 };
+	char *iptr = g_mmap ? fmap_input(&imap, istream, isize, get_forward_padding()) : NULL;
+
+	if (iptr == NULL) {
+		iptr = malloc(isize + get_forward_padding());
+
+		if (iptr == NULL) {
+			abort();
+		}
+
+		memset(iptr + isize, 0, get_forward_padding());
+		fload(iptr, isize, istream);
+	}
+
+	timing->load += wall_clock() - start;
+
+	unsigned char *optr = malloc(frame_bound(isize));
+
+	if (optr == NULL) {
+		abort();
+	}
+
+	struct frame_header header;
+
+	frame_header_init(&header, isize);
+
+	if (g_dict != NULL) {
+		frame_header_set_dict(&header, g_dict_id);
+	}
+
+	set_header_mem_limit(&header);
+
+	if (g_checksum) {
+		header.flags |= FRAME_FLAG_CHECKSUM;
+	}
+
+	size_t hsize = frame_write_header(&header, optr);
+
+	start = wall_clock();
+
+	/* the incompressible data are not modeled at all */
+	int stored = estimate_incompressible(iptr, isize);
+
+	if (!stored) {
+		create();
+
+		*asize = hsize + compress_buffer(iptr, isize, optr + hsize);
+
+		get_state_stats(&state_stats);
+		destroy();
+
+		stored = *asize - hsize > isize;
+	}
+
+	if (stored) {
+		header.flags |= FRAME_FLAG_STORED;
+		frame_write_header(&header, optr);
+
+		memcpy(optr + hsize, iptr, isize);
+		*asize = hsize + isize;
+	}
+
+	if (g_checksum) {
+		frame_write_checksum(optr + *asize, crc32c(0, iptr, isize));
+		*asize += FRAME_CHECKSUM_SIZE;
+	}
+
+	timing->code += wall_clock() - start;
+
+	*size = isize;
+
+	start = wall_clock();
+
+	fsave(optr, *asize, ostream);
+
+	timing->save += wall_clock() - start;
+
+	if (imap.base == NULL) {
+		free(iptr);
+	}
+
+	funmap(&imap);
+	free(optr);
+}
+
+/* write out the complete words of the bit stream */
+void flush_output(struct bio *bio, unsigned char *optr, struct async *writer, size_t *asize, struct timing *timing)
+{
+	long start = wall_clock();
+
+	async_save(writer, optr, bio->ptr - optr);
+
+	timing->save += wall_clock() - start;
+
+	*asize += bio->ptr - optr;
+	bio->ptr = optr;
+}
+
+static const unsigned char checkpoint_magic[4] = { 'X', '3', 0x1a, 'C' };
+
+/* write the checkpoint of the encoder to this file (the path of the compressed file with CHECKPOINT_SUFFIX) */
+static const char *g_checkpoint = NULL;
+
+#define CHECKPOINT_SUFFIX ".ckpt"
+
+/*
+ * The state of the encoder just before the end of the stream, so that the stream can be continued with more data.
+ * The end of the stream (the EOF event, the flush of the coder and the checksum) is cut off and written again.
+ */
+struct checkpoint {
+	struct frame_header header;
+	size_t offset;       /* the bit stream continues here (all the data before it are written) */
+	size_t file_size;    /* of the compressed file, to detect a modified file */
+	size_t content_size; /* so far */
+	uint32_t crc;        /* of the content so far */
+	uint64_t bits;       /* the bits pending in the bit buffer */
+	size_t count;
+	struct ac ac;        /* the registers of the arithmetic coder */
+	struct snapshot state; /* the dictionary, the contexts and the models */
+	unsigned char *file;
+};
+
+/*
+ * The checkpoint file holds the magic, the fields, the state, and the checksum of all but the magic.
+ */
+void save_checkpoint(const char *path, struct checkpoint *c)
+{
+	FILE *stream = fopen(path, "w");
+
+	if (stream == NULL) {
+		fprintf(stderr, "Cannot open checkpoint file\n");
+		abort();
+	}
+
+	struct snapshot s;
+
+	snapshot_create(&s);
+	snapshot_put_bytes(&s, checkpoint_magic, 4);
+
+	snapshot_put(&s, c->offset);
+	snapshot_put(&s, c->file_size);
+	snapshot_put(&s, c->content_size);
+	snapshot_put(&s, c->crc);
+	snapshot_put(&s, c->bits);
+	snapshot_put(&s, c->count);
+	snapshot_put(&s, c->ac.mLow);
+	snapshot_put(&s, c->ac.mHigh);
+	snapshot_put(&s, c->ac.mScale);
+
+	snapshot_put_bytes(&s, c->state.ptr, c->state.size);
+
+	unsigned char buf[FRAME_CHECKSUM_SIZE];
+
+	frame_write_checksum(buf, crc32c(0, s.ptr + 4, s.size - 4));
+	snapshot_put_bytes(&s, buf, FRAME_CHECKSUM_SIZE);
+
+	fsave(s.ptr, s.size, stream);
+
+	fclose(stream);
+
+	snapshot_destroy(&s);
+}
+
+/* the state is left open for load_state() */
+void load_checkpoint(struct checkpoint *c, const char *path)
+{
+	FILE *stream = fopen(path, "r");
+
+	if (stream == NULL) {
+		fprintf(stderr, "Cannot open checkpoint file\n");
+		abort();
+	}
+
+	size_t size = fsize(stream);
+
+	c->file = malloc(size + 1);
+
+	if (c->file == NULL) {
+		abort();
+	}
+
+	fload(c->file, size, stream);
+
+	fclose(stream);
+
+	if (size < 4 + FRAME_CHECKSUM_SIZE || memcmp(c->file, checkpoint_magic, 4) != 0 || frame_read_checksum(c->file + size - FRAME_CHECKSUM_SIZE) != crc32c(0, c->file + 4, size - 4 - FRAME_CHECKSUM_SIZE)) {
+		fprintf(stderr, "Not an x3 checkpoint\n");
+		abort();
+	}
+
+	struct snapshot *s = &c->state;
+
+	snapshot_open(s, c->file + 4, size - 4 - FRAME_CHECKSUM_SIZE);
+
+	c->offset = (size_t)snapshot_get(s);
+	c->file_size = (size_t)snapshot_get(s);
+	c->content_size = (size_t)snapshot_get(s);
+	c->crc = (uint32_t)snapshot_get(s);
+	c->bits = snapshot_get(s);
+	c->count = snapshot_get_size(s, 63);
+	c->ac.mLow = (size_t)snapshot_get(s);
+	c->ac.mHigh = (size_t)snapshot_get(s);
+	c->ac.mBuffer = 0;
+	c->ac.mScale = (size_t)snapshot_get(s);
+}
+
+/*
+ * The input is read in chunks into a sliding buffer holding the chunk and the forward window.
+ * The dictionary and the contexts are kept across the chunks, so the output is the same as for the whole file,
+ * except that the original size is recorded in the header only if the output is seekable.
+ *
+ * With the checkpoint (resume), the stream is continued from its state: the output receives the bit stream
+ * from the offset of the checkpoint on, and the header is left to the caller.
+ */
+void compress_stream(FILE *istream, FILE *ostream, struct checkpoint *resume, size_t *size, size_t *asize, struct timing *timing)
+{
+	size_t window = get_forward_window();
+
+	/* the parser reads this far past the start of a fragment (the forward window, or the string loaded by the dictionary kernel) */
+	size_t lookahead = window > MAX_MATCH_LEN ? window : MAX_MATCH_LEN;
+
+	/* the chunk, the lookahead (the forward window and the overlapping fragment), and the zero padding after the end of input */
+	size_t data_size = STREAM_CHUNK + window + MAX_MATCH_LEN;
+
+	/* the chunks are preceded by the history of the repeats */
+	size_t history = REP_ENABLED ? REP_WINDOW : 0;
+
+	char *hptr = malloc(history + data_size + get_forward_padding());
+	unsigned char *optr = malloc(frame_bound(data_size));
+
+	if (hptr == NULL) {
+		abort();
+	}
+
+	if (optr == NULL) {
+		abort();
+	}
+
+	char *iptr = hptr + history;
+
+	long header_pos = fseekable(ostream) ? ftell(ostream) : -1;
+
+	/* the input is read and the output written by the threads, while the chunks are being compressed */
+	struct async reader, writer;
+
+	async_reader_open(&reader, istream, STREAM_CHUNK);
+	async_writer_open(&writer, ostream, STREAM_CHUNK);
+
+	struct frame_header header;
+
+	uint32_t crc = 0;
+
+	size_t hsize = 0;
+
+	struct bio bio;
+
+	if (resume != NULL) {
+		header = resume->header;
+		hsize = header.header_size;
+		header_pos = -1;
+
+		crc = resume->crc;
+
+		load_state(&resume->state);
+
+		/* the history of the repeats follows the state (not in the checkpoints of the earlier versions) */
+		struct snapshot *s = &resume->state;
+
+		if (s->pos < s->size) {
+			size_t len = snapshot_get_size(s, minsize(history, stream.pos));
+
+			snapshot_get_bytes(s, iptr - len, len);
+			repeat_insert(iptr - len, len, iptr, stream.pos - len);
+
+			stream.history = len;
+		}
+
+		bio_open(&bio, optr, optr + frame_bound(data_size), BIO_MODE_WRITE);
+
+		bio.b = resume->bits;
+		bio.c = resume->count;
+
+		ac = resume->ac;
+
+		*size = resume->content_size;
+		*asize = resume->offset;
+	} else {
+		frame_header_init(&header, 0);
+
+		if (g_dict != NULL) {
+			frame_header_set_dict(&header, g_dict_id);
+		}
+
+		set_header_mem_limit(&header);
+
+		header.flags &= ~FRAME_FLAG_CONTENT_SIZE;
+
+		if (g_checksum) {
+			header.flags |= FRAME_FLAG_CHECKSUM;
+		}
+
+		hsize = frame_write_header(&header, optr);
+
+		create();
+
+		bio_open(&bio, optr + hsize, optr + frame_bound(data_size), BIO_MODE_WRITE);
+
+		ac_init(&ac);
+
+		*size = 0;
+		*asize = 0;
+	}
+
+	char *p = iptr;
+	char *fill = iptr;
+
+	for (int eof = 0; !eof; ) {
+		/* keep the unprocessed data, and the history before them */
+		size_t kept = fill - p;
+
+		memmove(iptr - stream.history, p - stream.history, stream.history + kept);
+
+		p = iptr;
+		fill = iptr + kept;
+
+		long start = wall_clock();
+
+		size_t want = data_size - kept;
+		size_t n = async_load_partial(&reader, fill, want);
+
+		timing->load += wall_clock() - start;
+
+		if (g_checksum) {
+			crc = crc32c(crc, fill, n);
+		}
+
+		fill += n;
+		*size += n;
+
+		char *stop;
+
+		if (n < want) {
+			eof = 1;
+			memset(fill, 0, get_forward_padding());
+			stop = fill;
+		} else {
+			stop = fill - lookahead;
+		}
+
+		start = wall_clock();
+
+		p = compress(p, stop, fill, &bio);
+
+		timing->code += wall_clock() - start;
+
+		flush_output(&bio, optr, &writer, asize, timing);
+	}
+
+	struct checkpoint checkpoint;
+
+	if (g_checkpoint != NULL) {
+		/* everything up to the pending bits has been written */
+		checkpoint.offset = *asize;
+		checkpoint.content_size = *size;
+		checkpoint.crc = crc;
+		checkpoint.bits = bio.b;
+		checkpoint.count = bio.c;
+		checkpoint.ac = ac;
+
+		snapshot_create(&checkpoint.state);
+		save_state(&checkpoint.state);
+
+		/* the appended data may repeat those before them */
+		snapshot_put(&checkpoint.state, stream.history);
+		snapshot_put_bytes(&checkpoint.state, p - stream.history, stream.history);
+	}
+
+	compress_eof(&bio);
+
+	ac_encode_flush(&ac, &bio);
+	bio_close(&bio, BIO_MODE_WRITE);
+
+	if (g_checksum) {
+		frame_write_checksum(bio.ptr, crc);
+		bio.ptr += FRAME_CHECKSUM_SIZE;
+	}
+
+	flush_output(&bio, optr, &writer, asize, timing);
+
+	get_state_stats(&state_stats);
+	destroy();
+
+	async_reader_close(&reader);
+
+	long start = wall_clock();
+
+	async_writer_close(&writer);
+
+	timing->save += wall_clock() - start;
+
+	/* now the size is known */
+	if (header_pos != -1) {
+		header.content_size = *size;
+		header.flags |= FRAME_FLAG_CONTENT_SIZE;
+
+		frame_write_header(&header, optr);
+
+		if (fseek(ostream, header_pos, SEEK_SET)) {
+			abort();
+		}
+
+		fsave(optr, hsize, ostream);
+
+		if (fseek(ostream, 0, SEEK_END)) {
+			abort();
+		}
+	}
+
+	if (g_checkpoint != NULL) {
+		checkpoint.file_size = *asize;
+
+		save_checkpoint(g_checkpoint, &checkpoint);
+
+		snapshot_destroy(&checkpoint.state);
+	}
+
+	free(hptr);
+	free(optr);
+}
+
+void read_header(struct frame_header *header, FILE *istream)
+{
+	unsigned char buf[65536];
+
+	fload(buf, FRAME_HEADER_SIZE, istream);
+
+	size_t hsize = frame_header_size(buf, FRAME_HEADER_SIZE);
+
+	if (hsize == (size_t)-1) {
+		fprintf(stderr, "Not an x3 stream\n");
+		abort();
+	}
+
+	fload(buf + FRAME_HEADER_SIZE, hsize - FRAME_HEADER_SIZE, istream);
+
+	frame_read_header(header, buf, hsize);
+}
+
+void decompress_file(const struct frame_header *header, FILE *istream, FILE *ostream, size_t *size, size_t *asize, struct timing *timing)
+{
+	size_t isize = fsize(istream);
+
+	*asize = header->header_size + isize;
+
+	long start = wall_clock();
+
+	struct fmapping imap = { NULL, 0 };
+	unsigned char *iptr = g_mmap ? fmap_input(&imap, istream, isize, 0) : NULL;
+
+	if (iptr == NULL) {
+		iptr = malloc(isize);
+
+		if (iptr == NULL && isize > 0) {
+			abort();
+		}
+
+		fload(iptr, isize, istream);
+	}
+
+	timing->load += wall_clock() - start;
+
+	if (header->content_size > SIZE_MAX) {
+		fprintf(stderr, "Unsupported stream\n");
+		abort();
+	}
+
+	size_t code_size = isize;
+
+	if (header->flags & FRAME_FLAG_CHECKSUM) {
+		if (isize < FRAME_CHECKSUM_SIZE) {
+			corrupted();
+		}
+
+		code_size -= FRAME_CHECKSUM_SIZE;
+	}
+
+	/* the exact size of the output is known, the data are decoded right into the file */
+	size_t osize = (size_t)header->content_size;
+
+	struct fmapping omap = { NULL, 0 };
+	char *optr = g_mmap ? fmap_output(&omap, ostream, osize) : NULL;
+
+	if (optr == NULL) {
+		optr = malloc(osize);
+
+		if (optr == NULL && osize > 0) {
+			abort();
+		}
+	}
+
+	create();
+
+	start = wall_clock();
+
+	decompress_buffer(iptr, code_size, optr, osize);
+
+	if (header->flags & FRAME_FLAG_CHECKSUM) {
+		verify_checksum(iptr + code_size, crc32c(0, optr, osize));
+	}
+
+	timing->code += wall_clock() - start;
+
+	*size = osize;
+
+	get_state_stats(&state_stats);
+	destroy();
+
+	start = wall_clock();
+
+	if (omap.base == NULL) {
+		fsave(optr, *size, ostream);
+		free(optr);
+	}
+
+	funmap(&omap);
+
+	timing->save += wall_clock() - start;
+
+	if (imap.base == NULL) {
+		free(iptr);
+	}
+
+	funmap(&imap);
+}
+
+struct input {
+	struct async *reader;
+	unsigned char *ptr;
+	size_t size;
+	size_t total;
+	size_t trailer; /* the bytes at the end of the input, which are not a part of the bit stream */
+	size_t held; /* the bytes after bio->end, withheld from the decoder */
+	struct timing *timing;
+};
+
+/* the bio fill callback */
+void fill_input(struct bio *bio)
+{
+	struct input *input = bio->arg;
+
+	size_t kept = bio->end - bio->ptr + input->held;
+
+	memmove(input->ptr, bio->ptr, kept);
+
+	long start = wall_clock();
+
+	size_t n = async_load_partial(input->reader, input->ptr + kept, input->size - kept);
+
+	input->timing->load += wall_clock() - start;
+
+	input->total += n;
+
+	/* the last bytes read may be the trailer */
+	input->held = minsize(input->trailer, kept + n);
+
+	bio->ptr = input->ptr;
+	bio->end = input->ptr + kept + n - input->held;
+}
+
+/* read the rest of the input, returns the trailer */
+const unsigned char *drain_input(struct bio *bio)
+{
+	struct input *input = bio->arg;
+
+	do {
+		bio->ptr = bio->end;
+		fill_input(bio);
+	} while (bio->end != bio->ptr);
+
+	if (input->held < input->trailer) {
+		corrupted();
+	}
+
+	return bio->end;
+}
+
+void decompress_stream(const struct frame_header *header, FILE *istream, FILE *ostream, size_t *size, size_t *asize, struct timing *timing)
+{
+	struct async reader, writer;
+
+	async_reader_open(&reader, istream, STREAM_CHUNK);
+	async_writer_open(&writer, ostream, STREAM_CHUNK);
+
+	struct input input;
+
+	input.reader = &reader;
+	input.size = STREAM_CHUNK;
+	input.ptr = malloc(input.size);
+	input.total = 0;
+	input.trailer = (header->flags & FRAME_FLAG_CHECKSUM) ? FRAME_CHECKSUM_SIZE : 0;
+	input.held = 0;
+	input.timing = timing;
+
+	/* the chunks are preceded by the history of the repeats, and followed by the room for the last repeat */
+	size_t history = REP_ENABLED ? REP_WINDOW : 0;
+
+	char *hptr = malloc(history + STREAM_CHUNK + REP_MAX_LEN);
+
+	if (input.ptr == NULL) {
+		abort();
+	}
+
+	if (hptr == NULL) {
+		abort();
+	}
+
+	char *optr = hptr + history;
+
+	create();
+
+	struct bio bio;
+
+	bio_open(&bio, input.ptr, input.ptr, BIO_MODE_READ);
+
+	bio.fill = fill_input;
+	bio.arg = &input;
+
+	ac_init(&ac);
+
+	ac_decode_init(&ac, &bio);
+
+	*size = 0;
+
+	uint32_t crc = 0;
+
+	do {
+		long start = wall_clock();
+
+		/* any fragment fits, and any repeat */
+		char *oend = decompress(optr, optr + STREAM_CHUNK - MAX_MATCH_LEN, optr + STREAM_CHUNK + REP_MAX_LEN, &bio);
+
+		timing->code += wall_clock() - start;
+
+		start = wall_clock();
+
+		async_save(&writer, optr, oend - optr);
+
+		if (input.trailer > 0) {
+			crc = crc32c(crc, optr, oend - optr);
+		}
+
+		timing->save += wall_clock() - start;
+
+		*size += oend - optr;
+
+		/* the next chunk follows the history */
+		memmove(optr - stream.history, oend - stream.history, stream.history);
+	} while (!stream.eof);
+
+	if (input.trailer > 0) {
+		verify_checksum(drain_input(&bio), crc);
+	}
+
+	bio_close(&bio, BIO_MODE_READ);
+
+	get_state_stats(&state_stats);
+	destroy();
+
+	async_reader_close(&reader);
+
+	long start = wall_clock();
+
+	async_writer_close(&writer);
+
+	timing->save += wall_clock() - start;
+
+	if ((header->flags & FRAME_FLAG_CONTENT_SIZE) && header->content_size != *size) {
+		corrupted();
+	}
+
+	*asize = header->header_size + input.total;
+
+	free(input.ptr);
+	free(hptr);
+}
+
+/* the stored content is copied up to the checksum */
+void decompress_stored(const struct frame_header *header, FILE *istream, FILE *ostream, size_t *size, size_t *asize, struct timing *timing)
+{
+	struct async reader, writer;
+
+	async_reader_open(&reader, istream, STREAM_CHUNK);
+	async_writer_open(&writer, ostream, STREAM_CHUNK);
+
+	size_t trailer = (header->flags & FRAME_FLAG_CHECKSUM) ? FRAME_CHECKSUM_SIZE : 0;
+
+	unsigned char *ptr = malloc(STREAM_CHUNK + trailer);
+
+	if (ptr == NULL) {
+		abort();
+	}
+
+	/* the last bytes read may be the trailer */
+	size_t held = 0;
+	size_t total = 0;
+	uint32_t crc = 0;
+
+	*size = 0;
+
+	for (size_t n = STREAM_CHUNK; n == STREAM_CHUNK; ) {
+		long start = wall_clock();
+
+		n = async_load_partial(&reader, ptr + held, STREAM_CHUNK);
+
+		timing->load += wall_clock() - start;
+
+		total += n;
+
+		size_t avail = held + n;
+		size_t out = avail > trailer ? avail - trailer : 0;
+
+		start = wall_clock();
+
+		if (trailer > 0) {
+			crc = crc32c(crc, ptr, out);
+		}
+
+		async_save(&writer, ptr, out);
+
+		timing->save += wall_clock() - start;
+
+		*size += out;
+
+		held = avail - out;
+		memmove(ptr, ptr + out, held);
+	}
+
+	if (trailer > 0) {
+		if (held < trailer) {
+			corrupted();
+		}
+
+		verify_checksum(ptr, crc);
+	}
+
+	async_reader_close(&reader);
+
+	long start = wall_clock();
+
+	async_writer_close(&writer);
+
+	timing->save += wall_clock() - start;
+
+	if ((header->flags & FRAME_FLAG_CONTENT_SIZE) && header->content_size != *size) {
+		corrupted();
+	}
+
+	*asize = header->header_size + total;
+
+	free(ptr);
+}
+
+/* the stored block holds exactly its data */
+int valid_stored_block(const struct frame_header *header, size_t code_size, size_t usize)
+{
+	return (header->flags & FRAME_FLAG_STORED) && code_size == usize;
+}
+
+struct block {
+	char *data; /* uncompressed data, followed by the zero padding when compressing */
+	size_t size;
+	const char *prefix; /* the tail of the previous block, for priming */
+	size_t psize;
+	unsigned char *code; /* the bit stream */
+	size_t code_size; /* including the checksum */
+	int checksum; /* the bit stream is followed by the checksum of the data */
+	int stored; /* the data are stored in place of the bit stream */
+	struct mem_limit mem_limit; /* of the coder on the pool thread */
+	unsigned version; /* the format version of the coder */
+	struct parser_params params; /* of the coder (for the priming as well) */
+	/* statistics */
+	size_t events[E_LAST];
+	float sizes[E_LAST];
+	uint64_t phase_cycles[P_LAST];
+	struct state_stats state_stats;
+};
+
+/* the pool task, each block is compressed by its own coder */
+void compress_block_task(void *arg, size_t i)
+{
+	struct block *block = (struct block *)arg + i;
+
+	mem_limit = block->mem_limit;
+	format_version = block->version;
+	set_parser_params(&block->params);
+
+	memset(events, 0, sizeof(events));
+	memset(sizes, 0, sizeof(sizes));
+	memset(phase_cycles, 0, sizeof(phase_cycles));
+	memset(&block->state_stats, 0, sizeof(block->state_stats));
+
+	/* the incompressible data are not modeled at all */
+	block->stored = estimate_incompressible(block->data, block->size);
+
+	if (!block->stored) {
+		create();
+
+		if (block->psize > 0) {
+			prime(block->prefix, block->psize);
+		}
+
+		block->code_size = compress_buffer(block->data, block->size, block->code);
+
+		get_state_stats(&block->state_stats);
+
+		destroy();
+
+		block->stored = block->code_size > block->size;
+	}
+
+	if (block->stored) {
+		memcpy(block->code, block->data, block->size);
+		block->code_size = block->size;
+	}
+
+	if (block->checksum) {
+		frame_write_checksum(block->code + block->code_size, crc32c(0, block->data, block->size));
+		block->code_size += FRAME_CHECKSUM_SIZE;
+	}
+
+	memcpy(block->events, events, sizeof(events));
+	memcpy(block->sizes, sizes, sizeof(sizes));
+	memcpy(block->phase_cycles, phase_cycles, sizeof(phase_cycles));
+}
+
+/* the pool task, for the blocks which are not primed */
+void decompress_block_task(void *arg, size_t i)
+{
+	struct block *block = (struct block *)arg + i;
+
+	mem_limit = block->mem_limit;
+	format_version = block->version;
+	set_parser_params(&block->params);
+
+	memset(events, 0, sizeof(events));
+	memset(sizes, 0, sizeof(sizes));
+	memset(phase_cycles, 0, sizeof(phase_cycles));
+	memset(&block->state_stats, 0, sizeof(block->state_stats));
+
+	size_t code_size = block->code_size - (block->checksum ? FRAME_CHECKSUM_SIZE : 0);
+
+	if (block->stored) {
+		memcpy(block->data, block->code, block->size);
+	} else {
+		create();
+
+		decompress_buffer(block->code, code_size, block->data, block->size);
+
+		get_state_stats(&block->state_stats);
+
+		destroy();
+	}
+
+	if (block->checksum) {
+		verify_checksum(block->code + code_size, crc32c(0, block->data, block->size));
+	}
+
+	memcpy(block->events, events, sizeof(events));
+	memcpy(block->sizes, sizes, sizeof(sizes));
+	memcpy(block->phase_cycles, phase_cycles, sizeof(phase_cycles));
+}
+
+/* sum up the statistics of the blocks (with a single thread, the block tasks ran on this thread and left their counts here) */
+void add_block_stats(const struct block *blocks, size_t n)
+{
+	memset(events, 0, sizeof(events));
+	memset(sizes, 0, sizeof(sizes));
+	memset(phase_cycles, 0, sizeof(phase_cycles));
+	memset(&state_stats, 0, sizeof(state_stats));
+
+	for (size_t b = 0; b < n; ++b) {
+		for (int e = 0; e < E_LAST; ++e) {
+			events[e] += blocks[b].events[e];
+			sizes[e] += blocks[b].sizes[e];
+		}
+
+		for (int ph = 0; ph < P_LAST; ++ph) {
+			phase_cycles[ph] += blocks[b].phase_cycles[ph];
+		}
+
+		add_state_stats(&blocks[b].state_stats);
+	}
+}
+
+/*
+ * The speed governor chooses the parameters of each batch of blocks from the speed of the previous ones.
+ * The levels go from the fastest parameters to those given by -t and -w: the window is halved down to 1 KiB,
+ * then the number of matches is halved down to one.
+ * The decoder does not depend on the parameters (unless the blocks are primed).
+ */
+#define GOVERNOR_MAX_LEVELS 64
+
+struct governor {
+	size_t levels;
+	size_t window[GOVERNOR_MAX_LEVELS];
+	int match_count[GOVERNOR_MAX_LEVELS];
+	float speed[GOVERNOR_MAX_LEVELS]; /* recently measured at the level (in MB/s), 0 = not yet */
+	size_t level;
+	/* the number of blocks compressed at each level */
+	size_t blocks[GOVERNOR_MAX_LEVELS];
+};
+
+void governor_init(struct governor *g)
+{
+	size_t window = get_forward_window();
+	int match_count = get_max_match_count();
+
+	/* from the slowest */
+	size_t n = 0;
+
+	for (;;) {
+		assert(n < GOVERNOR_MAX_LEVELS);
+
+		g->window[n] = window;
+		g->match_count[n] = match_count;
+		n++;
+
+		if (window > 1024) {
+			window = window / 2 > 1024 ? window / 2 : 1024;
+		} else if (match_count > 1) {
+			match_count /= 2;
+		} else {
+			break;
+		}
+	}
+
+	/* the fastest first */
+	for (size_t l = 0; l < n / 2; ++l) {
+		size_t w = g->window[l];
+		int t = g->match_count[l];
+
+		g->window[l] = g->window[n - 1 - l];
+		g->match_count[l] = g->match_count[n - 1 - l];
+		g->window[n - 1 - l] = w;
+		g->match_count[n - 1 - l] = t;
+	}
+
+	for (size_t l = 0; l < n; ++l) {
+		g->speed[l] = 0.f;
+		g->blocks[l] = 0;
+	}
+
+	g->levels = n;
+	g->level = n - 1;
+}
+
+void governor_apply(const struct governor *g)
+{
+	set_forward_window(g->window[g->level]);
+	set_max_match_count(g->match_count[g->level]);
+}
+
+/*
+ * The batch of the blocks was compressed in the given time.
+ * The level goes down when the target is missed, and up when the next level is known to be fast enough,
+ * or when there is twice the needed speed (the next level roughly doubles the work).
+ */
+void governor_update(struct governor *g, size_t blocks, size_t size, long ns)
+{
+	float speed = mb_per_s(size, ns);
+	size_t l = g->level;
+
+	g->blocks[l] += blocks;
+
+	if (size == 0 || ns <= 0) {
+		return;
+	}
+
+	/* smoothed, the blocks differ */
+	g->speed[l] = g->speed[l] > 0.f ? (g->speed[l] + speed) / 2 : speed;
+
+	if (g->speed[l] < g_target_speed) {
+		if (l > 0) {
+			g->level--;
+		}
+	} else if (l + 1 < g->levels) {
+		if (g->speed[l + 1] >= g_target_speed || g->speed[l] >= 2 * g_target_speed) {
+			g->level++;
+		}
+	}
+}
+
+void governor_print(const struct governor *g, FILE *stream)
+{
+	fprintf(stream, "target speed: %f MB/s, blocks at -t/-w:", g_target_speed);
+
+	for (size_t l = g->levels; l-- > 0; ) {
+		if (g->blocks[l] > 0) {
+			fprintf(stream, " %i/%zu %zu", g->match_count[l], g->window[l] >> 10, g->blocks[l]);
+		}
+	}
+
+	fprintf(stream, "\n");
+}
+
+/*
+ * The input is split into independent blocks, each with its own dictionary, contexts and models.
+ * A batch of blocks is compressed on the worker threads, the blocks are written in order.
+ * The output does not depend on the number of threads.
+ */
+void compress_blocks(FILE *istream, FILE *ostream, size_t *size, size_t *asize, struct timing *timing, int verbose)
+{
+	size_t block_size = g_block_size > 0 ? g_block_size : DEFAULT_BLOCK_SIZE;
+	size_t prime_size = minsize(g_prime_size, block_size);
+	size_t padding = get_forward_padding(); /* the largest, the governor only lowers the window */
+
+	/* the parameters of the header are those of -t and -w */
+	struct governor governor;
+
+	governor_init(&governor);
+
+	/* the blocks read at once */
+	size_t batch = g_threads;
+
+	struct block *blocks = malloc(batch * sizeof(struct block));
+	char *tail = malloc(prime_size + 1);
+
+	if (blocks == NULL || tail == NULL) {
+		abort();
+	}
+
+	for (size_t b = 0; b < batch; ++b) {
+		blocks[b].data = malloc(block_size + padding);
+		blocks[b].code = malloc(compress_bound(block_size) + FRAME_CHECKSUM_SIZE);
+		blocks[b].checksum = g_checksum;
+		blocks[b].mem_limit = mem_limit;
+		blocks[b].version = format_version;
+		get_parser_params(&blocks[b].params);
+
+		if (blocks[b].data == NULL || blocks[b].code == NULL) {
+			abort();
+		}
+	}
+
+	/* the seek table */
+	unsigned char *table = NULL;
+	size_t table_blocks = 0;
+
+	/* tail of the last block of the previous batch */
+	size_t tail_size = 0;
+
+	struct frame_header header;
+
+	frame_header_init(&header, fseekable(istream) ? fsize(istream) : 0);
+
+	if (g_dict != NULL) {
+		frame_header_set_dict(&header, g_dict_id);
+	}
+
+	set_header_mem_limit(&header);
+
+	if (!fseekable(istream)) {
+		header.flags &= ~FRAME_FLAG_CONTENT_SIZE;
+	}
+
+	if (g_nl) {
+		header.flags |= FRAME_FLAG_NL;
+	}
+
+	frame_header_set_blocks(&header, block_size, prime_size);
+
+	header.flags |= FRAME_FLAG_SEEK_TABLE | FRAME_FLAG_STORED;
+
+	if (g_checksum) {
+		header.flags |= FRAME_FLAG_CHECKSUM;
+	}
+
+	uint32_t crc = 0;
+
+	long header_pos = fseekable(ostream) ? ftell(ostream) : -1;
+
+	/* the input is read and the output written by the threads, while the batches are being compressed */
+	struct async reader, writer;
+
+	async_reader_open(&reader, istream, STREAM_CHUNK);
+	async_writer_open(&writer, ostream, STREAM_CHUNK);
+
+	unsigned char buf[FRAME_MAX_HEADER_SIZE];
+
+	size_t hsize = frame_write_header(&header, buf);
+
+	async_save(&writer, buf, hsize);
+
+	*size = 0;
+	*asize = hsize;
+
+	/* the statistics of the coders are summed up at the end */
+	struct block *done = NULL;
+
+	for (int eof = 0; !eof; ) {
+		size_t n = 0; /* blocks in this batch */
+
+		long start = wall_clock();
+
+		while (n < batch) {
+			struct block *block = &blocks[n];
+
+			block->size = async_load_partial(&reader, block->data, block_size);
+
+			if (block->size < block_size) {
+				eof = 1;
+			}
+
+			if (block->size == 0) {
+				break;
+			}
+
+			memset(block->data + block->size, 0, padding);
+
+			if (n == 0) {
+				block->prefix = tail;
+				block->psize = tail_size;
+			} else {
+				struct block *prev = &blocks[n - 1];
+
+				block->psize = minsize(prime_size, prev->size);
+				block->prefix = prev->data + prev->size - block->psize;
+			}
+
+			*size += block->size;
+
+			n++;
+
+			if (eof) {
+				break;
+			}
+		}
+
+		timing->load += wall_clock() - start;
+
+		if (g_target_speed > 0.f) {
+			governor_apply(&governor);
+
+			/* the blocks of this batch are parsed with the parameters of the level */
+			for (size_t b = 0; b < n; ++b) {
+				get_parser_params(&blocks[b].params);
+			}
+		}
+
+		start = wall_clock();
+
+		pool_run(g_threads, n, compress_block_task, blocks);
+
+		long code_time = wall_clock() - start;
+
+		timing->code += code_time;
+
+		if (g_target_speed > 0.f) {
+			size_t batch_size = 0;
+
+			for (size_t b = 0; b < n; ++b) {
+				batch_size += blocks[b].size;
+			}
+
+			governor_update(&governor, n, batch_size, code_time);
+		}
+
+		start = wall_clock();
+
+		table = realloc(table, (table_blocks + n) * FRAME_SEEK_ENTRY_SIZE + FRAME_SEEK_FOOTER_SIZE);
+		done = realloc(done, (table_blocks + n) * sizeof(struct block));
+
+		if (table == NULL || done == NULL) {
+			abort();
+		}
+
+		for (size_t b = 0; b < n; ++b) {
+			struct block *block = &blocks[b];
+
+			frame_write_block_header(buf, block->code_size, block->size, block->stored);
+			async_save(&writer, buf, FRAME_BLOCK_HEADER_SIZE);
+			async_save(&writer, block->code, block->code_size);
+
+			if (g_checksum) {
+				crc = crc32c(crc, block->data, block->size);
+			}
+
+			*asize += FRAME_BLOCK_HEADER_SIZE + block->code_size;
+
+			memcpy(table + table_blocks * FRAME_SEEK_ENTRY_SIZE, buf, FRAME_SEEK_ENTRY_SIZE);
+			done[table_blocks] = *block;
+			table_blocks++;
+		}
+
+		timing->save += wall_clock() - start;
+
+		if (n > 0) {
+			struct block *last = &blocks[n - 1];
+
+			tail_size = minsize(prime_size, last->size);
+			memcpy(tail, last->data + last->size - tail_size, tail_size);
+		}
+	}
+
+	/* end of frame */
+	frame_write_block_header(buf, 0, 0, 0);
+	async_save(&writer, buf, FRAME_BLOCK_HEADER_SIZE);
+
+	*asize += FRAME_BLOCK_HEADER_SIZE;
+
+	if (g_checksum) {
+		frame_write_checksum(buf, crc);
+		async_save(&writer, buf, FRAME_CHECKSUM_SIZE);
+
+		*asize += FRAME_CHECKSUM_SIZE;
+	}
+
+	size_t table_size = table_blocks * FRAME_SEEK_ENTRY_SIZE + FRAME_SEEK_FOOTER_SIZE;
+
+	frame_write_seek_footer(table + table_blocks * FRAME_SEEK_ENTRY_SIZE, table_blocks);
+	async_save(&writer, table, table_size);
+
+	*asize += table_size;
+
+	async_reader_close(&reader);
+
+	long start = wall_clock();
+
+	async_writer_close(&writer);
+
+	timing->save += wall_clock() - start;
+
+	if (header_pos != -1 && !(header.flags & FRAME_FLAG_CONTENT_SIZE)) {
+		header.content_size = *size;
+		header.flags |= FRAME_FLAG_CONTENT_SIZE;
+
+		frame_write_header(&header, buf);
+
+		if (fseek(ostream, header_pos, SEEK_SET)) {
+			abort();
+		}
+
+		fsave(buf, hsize, ostream);
+
+		if (fseek(ostream, 0, SEEK_END)) {
+			abort();
+		}
+	}
+
+	add_block_stats(done, table_blocks);
+
+	if (g_target_speed > 0.f) {
+		if (verbose) {
+			governor_print(&governor, stderr);
+		}
+
+		/* back to -t and -w */
+		governor.level = governor.levels - 1;
+		governor_apply(&governor);
+	}
+
+	for (size_t b = 0; b < batch; ++b) {
+		free(blocks[b].data);
+		free(blocks[b].code);
+	}
+
+	free(blocks);
+	free(tail);
+	free(table);
+	free(done);
+}
+
+/* the priming runs the parser, configure it the same way as the encoder */
+void configure_parser(const struct frame_header *header)
+{
+	set_forward_window(header->forward_window);
+	set_max_match_count((int)header->max_match_count);
+	set_magic_factor1(header->magic_factor1);
+	set_magic_factor2(header->magic_factor2);
+	g_nl = (header->flags & FRAME_FLAG_NL) != 0;
+}
+
+void decompress_blocks(const struct frame_header *header, FILE *istream, FILE *ostream, size_t *size, size_t *asize, struct timing *timing)
+{
+	size_t block_size = header->block_size;
+	size_t prime_size = header->prime_size;
+
+	if (prime_size > 0) {
+		configure_parser(header);
+	}
+
+	unsigned char *iptr = NULL;
+	size_t icapacity = 0;
+
+	char *optr = malloc(block_size);
+	char *tail = malloc(prime_size + 1);
+
+	if (optr == NULL || tail == NULL) {
+		abort();
+	}
+
+	size_t tail_size = 0;
+	size_t blocks = 0;
+
+	/* the checksum of each block, and of the content after the empty block */
+	size_t trailer = (header->flags & FRAME_FLAG_CHECKSUM) ? FRAME_CHECKSUM_SIZE : 0;
+	uint32_t crc = 0;
+
+	/* the input is read and the output written by the threads, while the blocks are being decompressed */
+	struct async reader, writer;
+
+	async_reader_open(&reader, istream, STREAM_CHUNK);
+	async_writer_open(&writer, ostream, STREAM_CHUNK);
+
+	*size = 0;
+	*asize = header->header_size;
+
+	for (;;) {
+		unsigned char buf[FRAME_BLOCK_HEADER_SIZE];
+
+		long start = wall_clock();
+
+		async_load(&reader, buf, FRAME_BLOCK_HEADER_SIZE);
+
+		size_t csize, usize;
+		int stored;
+
+		frame_read_block_header(buf, &csize, &usize, &stored);
+
+		*asize += FRAME_BLOCK_HEADER_SIZE;
+
+		if (csize == 0) {
+			break;
+		}
+
+		if (usize > block_size || csize < trailer || csize > compress_bound(usize) + trailer || (stored && !valid_stored_block(header, csize - trailer, usize))) {
+			corrupted();
+		}
+
+		if (csize > icapacity) {
+			icapacity = csize;
+			iptr = realloc(iptr, icapacity);
+
+			if (iptr == NULL) {
+				abort();
+			}
+		}
+
+		async_load(&reader, iptr, csize);
+
+		*asize += csize;
+
+		timing->load += wall_clock() - start;
+
+		start = wall_clock();
+
+		if (stored) {
+			memcpy(optr, iptr, usize);
+		} else {
+			create();
+
+			if (tail_size > 0) {
+				prime(tail, tail_size);
+			}
+
+			decompress_buffer(iptr, csize - trailer, optr, usize);
+
+			struct state_stats block_state_stats;
+
+			get_state_stats(&block_state_stats);
+			add_state_stats(&block_state_stats);
+
+			destroy();
+		}
+
+		if (trailer > 0) {
+			uint32_t block_crc = crc32c(0, optr, usize);
+
+			verify_checksum(iptr + csize - trailer, block_crc);
+
+			crc = crc32c(crc, optr, usize);
+		}
+
+		timing->code += wall_clock() - start;
+
+		start = wall_clock();
+
+		async_save(&writer, optr, usize);
+
+		timing->save += wall_clock() - start;
+
+		*size += usize;
+
+		tail_size = minsize(prime_size, usize);
+		memcpy(tail, optr + usize - tail_size, tail_size);
+
+		blocks++;
+	}
+
+	if (trailer > 0) {
+		unsigned char buf[FRAME_CHECKSUM_SIZE];
+
+		async_load(&reader, buf, FRAME_CHECKSUM_SIZE);
+
+		verify_checksum(buf, crc);
+
+		*asize += FRAME_CHECKSUM_SIZE;
+	}
+
+	if (header->flags & FRAME_FLAG_SEEK_TABLE) {
+		/* only the footer is checked, the entries are the same as the block headers */
+		size_t table_size = blocks * FRAME_SEEK_ENTRY_SIZE + FRAME_SEEK_FOOTER_SIZE;
+
+		if (table_size > icapacity) {
+			iptr = realloc(iptr, table_size);
+
+			if (iptr == NULL) {
+				abort();
+			}
+		}
+
+		async_load(&reader, iptr, table_size);
+
+		if (frame_read_seek_footer(iptr + table_size - FRAME_SEEK_FOOTER_SIZE) != blocks) {
+			corrupted();
+		}
+
+		*asize += table_size;
+	}
+
+	async_reader_close(&reader);
+
+	long start = wall_clock();
+
+	async_writer_close(&writer);
+
+	timing->save += wall_clock() - start;
+
+	if ((header->flags & FRAME_FLAG_CONTENT_SIZE) && header->content_size != *size) {
+		corrupted();
+	}
+
+	free(iptr);
+	free(optr);
+	free(tail);
+}
+
+/* the location of a block, from the seek table */
+struct seek_entry {
+	size_t pos;   /* of the block header, relative to the end of the stream header */
+	size_t csize;
+	size_t upos;  /* in the decompressed data */
+	size_t usize;
+	int stored;
+};
+
+/* the index of the blocks */
+struct seek_table {
+	size_t n;
+	struct seek_entry *entries;
+	size_t size; /* of the decompressed data */
+	size_t isize; /* of the frame past the stream header */
+	long base; /* the file position of the first block */
+};
+
+/* the number of blocks, from the footer at the end of the isize bytes following the stream header */
+size_t seek_table_blocks(const unsigned char *footer, size_t isize)
+{
+	if (isize < FRAME_BLOCK_HEADER_SIZE + FRAME_SEEK_FOOTER_SIZE) {
+		corrupted();
+	}
+
+	size_t n = frame_read_seek_footer(footer);
+
+	/* the blocks, the empty block, the table and the footer */
+	if (n == (size_t)-1 || n > (isize - FRAME_BLOCK_HEADER_SIZE - FRAME_SEEK_FOOTER_SIZE) / FRAME_SEEK_ENTRY_SIZE) {
+		corrupted();
+	}
+
+	return n;
+}
+
+/* compute the positions of the n blocks, the table follows limit bytes of the blocks */
+void seek_table_parse(struct seek_table *table, const struct frame_header *header, const unsigned char *ptr, size_t n, size_t limit)
+{
+	table->n = n;
+	table->entries = malloc(n * sizeof(struct seek_entry) + 1);
+
+	if (table->entries == NULL) {
+		abort();
+	}
+
+	size_t ipos = 0;
+	size_t opos = 0;
+
+	/* the checksum of each block, and of the content after the empty block */
+	size_t trailer = (header->flags & FRAME_FLAG_CHECKSUM) ? FRAME_CHECKSUM_SIZE : 0;
+
+	for (size_t b = 0; b < n; ++b) {
+		struct seek_entry *entry = &table->entries[b];
+
+		frame_read_block_header(ptr + b * FRAME_SEEK_ENTRY_SIZE, &entry->csize, &entry->usize, &entry->stored);
+
+		/* room for the block, the empty block and the checksum */
+		size_t avail = limit - ipos;
+		size_t overhead = 2 * FRAME_BLOCK_HEADER_SIZE + trailer;
+
+		if (entry->csize == 0 || entry->csize < trailer || entry->usize > header->block_size || avail < overhead || entry->csize > avail - overhead) {
+			corrupted();
+		}
+
+		if (entry->stored && !valid_stored_block(header, entry->csize - trailer, entry->usize)) {
+			corrupted();
+		}
+
+		/* no block of the encoder is larger */
+		if (entry->csize > compress_bound(entry->usize) + trailer) {
+			corrupted();
+		}
+
+		entry->pos = ipos;
+		entry->upos = opos;
+
+		ipos += FRAME_BLOCK_HEADER_SIZE + entry->csize;
+		opos += entry->usize;
+	}
+
+	/* the empty block (and the checksum) is followed by the table */
+	if (ipos + FRAME_BLOCK_HEADER_SIZE + trailer != limit) {
+		corrupted();
+	}
+
+	if ((header->flags & FRAME_FLAG_CONTENT_SIZE) && header->content_size != opos) {
+		corrupted();
+	}
+
+	table->size = opos;
+}
+
+/* read the seek table from the end of the file, the stream stays at the first block */
+void seek_table_load(struct seek_table *table, const struct frame_header *header, FILE *istream)
+{
+	if (!(header->flags & FRAME_FLAG_BLOCKS) || !(header->flags & FRAME_FLAG_SEEK_TABLE)) {
+		fprintf(stderr, "The stream has no seek table (compress it with -B or -T)\n");
+		abort();
+	}
+
+	table->isize = fsize(istream);
+	table->base = ftell(istream);
+
+	unsigned char footer[FRAME_SEEK_FOOTER_SIZE];
+
+	if (table->isize < FRAME_SEEK_FOOTER_SIZE || fseek(istream, table->base + (long)table->isize - FRAME_SEEK_FOOTER_SIZE, SEEK_SET)) {
+		corrupted();
+	}
+
+	fload(footer, FRAME_SEEK_FOOTER_SIZE, istream);
+
+	size_t n = seek_table_blocks(footer, table->isize);
+	size_t limit = table->isize - FRAME_SEEK_FOOTER_SIZE - n * FRAME_SEEK_ENTRY_SIZE;
+
+	unsigned char *ptr = malloc(n * FRAME_SEEK_ENTRY_SIZE + 1);
+
+	if (ptr == NULL) {
+		abort();
+	}
+
+	if (fseek(istream, table->base + (long)limit, SEEK_SET)) {
+		abort();
+	}
+
+	fload(ptr, n * FRAME_SEEK_ENTRY_SIZE, istream);
+
+	seek_table_parse(table, header, ptr, n, limit);
+
+	if (fseek(istream, table->base, SEEK_SET)) {
+		abort();
+	}
+
+	free(ptr);
+}
+
+void seek_table_free(struct seek_table *table)
+{
+	free(table->entries);
+	table->entries = NULL;
+}
+
+/* the blocks which are not primed are decoded in parallel, located by the seek table at the end of the file */
+void decompress_blocks_parallel(const struct frame_header *header, FILE *istream, FILE *ostream, size_t *size, size_t *asize, struct timing *timing)
+{
+	long start = wall_clock();
+
+	size_t isize = fsize(istream);
+
+	struct fmapping imap = { NULL, 0 };
+	unsigned char *iptr = g_mmap ? fmap_input(&imap, istream, isize, 0) : NULL;
+
+	if (iptr == NULL) {
+		iptr = malloc(isize + 1);
+
+		if (iptr == NULL) {
+			abort();
+		}
+
+		fload(iptr, isize, istream);
+	}
+
+	timing->load += wall_clock() - start;
+
+	size_t n = seek_table_blocks(iptr + isize - FRAME_SEEK_FOOTER_SIZE, isize);
+	size_t limit = isize - FRAME_SEEK_FOOTER_SIZE - n * FRAME_SEEK_ENTRY_SIZE;
+
+	struct seek_table table;
+
+	seek_table_parse(&table, header, iptr + limit, n, limit);
+
+	/* the table must agree with the block headers */
+	for (size_t b = 0; b < n; ++b) {
+		if (memcmp(iptr + table.entries[b].pos, iptr + limit + b * FRAME_SEEK_ENTRY_SIZE, FRAME_BLOCK_HEADER_SIZE) != 0) {
+			corrupted();
+		}
+	}
+
+	/* the empty block */
+	size_t trailer = (header->flags & FRAME_FLAG_CHECKSUM) ? FRAME_CHECKSUM_SIZE : 0;
+
+	for (size_t i = limit - trailer - FRAME_BLOCK_HEADER_SIZE; i < limit - trailer; ++i) {
+		if (iptr[i] != 0) {
+			corrupted();
+		}
+	}
+
+	struct block *blocks = malloc(n * sizeof(struct block) + 1);
+
+	struct fmapping omap = { NULL, 0 };
+	char *optr = g_mmap ? fmap_output(&omap, ostream, table.size) : NULL;
+
+	if (optr == NULL) {
+		optr = malloc(table.size + 1);
+	}
+
+	if (blocks == NULL || optr == NULL) {
+		abort();
+	}
+
+	for (size_t b = 0; b < n; ++b) {
+		blocks[b].code = iptr + table.entries[b].pos + FRAME_BLOCK_HEADER_SIZE;
+		blocks[b].code_size = table.entries[b].csize;
+		blocks[b].data = optr + table.entries[b].upos;
+		blocks[b].size = table.entries[b].usize;
+		blocks[b].checksum = trailer > 0;
+		blocks[b].stored = table.entries[b].stored;
+		blocks[b].mem_limit = mem_limit;
+		blocks[b].version = format_version;
+		get_parser_params(&blocks[b].params);
+	}
+
+	start = wall_clock();
+
+	pool_run(g_threads, n, decompress_block_task, blocks);
+
+	timing->code += wall_clock() - start;
+
+	add_block_stats(blocks, n);
+
+	if (trailer > 0) {
+		verify_checksum(iptr + limit - trailer, crc32c(0, optr, table.size));
+	}
+
+	start = wall_clock();
+
+	if (omap.base == NULL) {
+		fsave(optr, table.size, ostream);
+		free(optr);
+	}
+
+	funmap(&omap);
+
+	timing->save += wall_clock() - start;
+
+	*size = table.size;
+	*asize = header->header_size + isize;
+
+	seek_table_free(&table);
+
+	if (imap.base == NULL) {
+		free(iptr);
+	}
+
+	funmap(&imap);
+	free(blocks);
+}
+
+/*
+ * Decodes len bytes starting at the offset of the decompressed data, only the blocks covering the range are read.
+ * The range is clipped to the end of the data, the function returns its length.
+ * If the blocks are primed, the blocks preceding the range are decoded as well.
+ */
+size_t decompress_range(const struct frame_header *header, FILE *istream, const struct seek_table *table, size_t offset, size_t len, char *optr)
+{
+	if (offset >= table->size) {
+		return 0;
+	}
+
+	len = minsize(len, table->size - offset);
+
+	if (len == 0) {
+		return 0;
+	}
+
+	/* the blocks covering the range */
+	size_t first = 0;
+
+	while (table->entries[first].upos + table->entries[first].usize <= offset) {
+		first++;
+	}
+
+	size_t last = first;
+
+	while (table->entries[last].upos + table->entries[last].usize < offset + len) {
+		last++;
+	}
+
+	size_t prime_size = header->prime_size;
+
+	/* a primed block depends on all the preceding ones */
+	if (prime_size > 0) {
+		configure_parser(header);
+		first = 0;
+	}
+
+	unsigned char *iptr = NULL;
+	size_t icapacity = 0;
+
+	char *data = malloc(header->block_size);
+	char *tail = malloc(prime_size + 1);
+
+	if (data == NULL || tail == NULL) {
+		abort();
+	}
+
+	size_t tail_size = 0;
+
+	for (size_t b = first; b <= last; ++b) {
+		const struct seek_entry *entry = &table->entries[b];
+
+		if (entry->csize > icapacity) {
+			icapacity = entry->csize;
+			iptr = realloc(iptr, icapacity);
+
+			if (iptr == NULL) {
+				abort();
+			}
+		}
+
+		if (fseek(istream, table->base + (long)(entry->pos + FRAME_BLOCK_HEADER_SIZE), SEEK_SET)) {
+			abort();
+		}
+
+		fload(iptr, entry->csize, istream);
+
+		size_t code_size = entry->csize - ((header->flags & FRAME_FLAG_CHECKSUM) ? FRAME_CHECKSUM_SIZE : 0);
+
+		if (entry->stored) {
+			memcpy(data, iptr, entry->usize);
+		} else {
+			create();
+
+			if (tail_size > 0) {
+				prime(tail, tail_size);
+			}
+
+			decompress_buffer(iptr, code_size, data, entry->usize);
+
+			struct state_stats block_state_stats;
+
+			get_state_stats(&block_state_stats);
+			add_state_stats(&block_state_stats);
+
+			destroy();
+		}
+
+		/* only the checksums of the blocks can be verified */
+		if (header->flags & FRAME_FLAG_CHECKSUM) {
+			verify_checksum(iptr + code_size, crc32c(0, data, entry->usize));
+		}
+
+		/* the intersection with the range */
+		size_t lo = offset > entry->upos ? offset : entry->upos;
+		size_t hi = minsize(offset + len, entry->upos + entry->usize);
+
+		if (lo < hi) {
+			memcpy(optr + (lo - offset), data + (lo - entry->upos), hi - lo);
+		}
+
+		tail_size = minsize(prime_size, entry->usize);
+		memcpy(tail, data + entry->usize - tail_size, tail_size);
+	}
+
+	free(iptr);
+	free(data);
+	free(tail);
+
+	return len;
+}
+
+static size_t g_range_offset = 0;
+static size_t g_range_len = 0;
+static int g_range = 0;
+
+/* parse OFFSET:LEN, an empty length means up to the end */
+void parse_range(const char *arg)
+{
+	char *end;
+
+	g_range_offset = (size_t)strtoull(arg, &end, 0);
+
+	if (end == arg || *end != ':') {
+		fprintf(stderr, "Invalid range (expected OFFSET:LEN)\n");
+		abort();
+	}
+
+	arg = end + 1;
+
+	if (*arg == 0) {
+		g_range_len = SIZE_MAX;
+	} else {
+		g_range_len = (size_t)strtoull(arg, &end, 0);
+
+		if (*end != 0) {
+			fprintf(stderr, "Invalid range (expected OFFSET:LEN)\n");
+			abort();
+		}
+	}
+
+	g_range = 1;
+}
+
+void decompress_range_file(const struct frame_header *header, FILE *istream, FILE *ostream, size_t *size, size_t *asize, struct timing *timing)
+{
+	long start = wall_clock();
+
+	struct seek_table table;
+
+	seek_table_load(&table, header, istream);
+
+	timing->load += wall_clock() - start;
+
+	size_t len = g_range_offset < table.size ? minsize(g_range_len, table.size - g_range_offset) : 0;
+
+	char *optr = malloc(len + 1);
+
+	if (optr == NULL) {
+		abort();
+	}
+
+	start = wall_clock();
+
+	*size = decompress_range(header, istream, &table, g_range_offset, len, optr);
+
+	timing->code += wall_clock() - start;
+
+	start = wall_clock();
+
+	fsave(optr, *size, ostream);
+
+	timing->save += wall_clock() - start;
+
+	*asize = header->header_size + table.isize;
+
+	seek_table_free(&table);
+
+	free(optr);
+}
+
+/* the file is cut off at the offset and continued with the content of the tail */
+void splice_tail(FILE *ostream, size_t offset, FILE *tail)
+{
+	unsigned char buf[65536];
+
+	if (fflush(tail) || fseek(tail, 0, SEEK_SET) || fseek(ostream, (long)offset, SEEK_SET)) {
+		abort();
+	}
+
+	for (size_t n; (n = fload_partial(buf, sizeof(buf), tail)) > 0; offset += n) {
+		fsave(buf, n, ostream);
+	}
+
+	/* the old end might have been longer */
+	ftruncate_at(ostream, offset);
+}
+
+/*
+ * Continues the compressed file (path) with the input, starting from the checkpoint written along with the file.
+ * The checkpoint is replaced by the one at the new end of the stream.
+ */
+void append(FILE *istream, FILE *ostream, const char *path, size_t *size, size_t *asize, struct timing *timing)
+{
+	char checkpoint_path[4096 + sizeof(CHECKPOINT_SUFFIX)];
+
+	sprintf(checkpoint_path, "%s" CHECKPOINT_SUFFIX, path);
+
+	struct checkpoint checkpoint;
+
+	load_checkpoint(&checkpoint, checkpoint_path);
+
+	read_header(&checkpoint.header, ostream);
+
+	if ((checkpoint.header.flags & FRAME_FLAG_BLOCKS) || !(checkpoint.header.flags & FRAME_FLAG_CONTENT_SIZE) || fsize(ostream) + checkpoint.header.header_size != checkpoint.file_size || checkpoint.header.content_size != checkpoint.content_size) {
+		fprintf(stderr, "The checkpoint does not match the compressed file\n");
+		abort();
+	}
+
+	/* the same parameters as the stream */
+	configure_parser(&checkpoint.header);
+	g_checksum = (checkpoint.header.flags & FRAME_FLAG_CHECKSUM) != 0;
+	set_decoder_mem_limit(&checkpoint.header, 1);
+	format_version = checkpoint.header.version;
+
+	/* the new end of the stream and the checkpoint go to the temporary files, the compressed file is not modified until they are complete */
+	FILE *tail = tmpfile();
+
+	if (tail == NULL) {
+		fprintf(stderr, "Cannot create temporary file\n");
+		abort();
+	}
+
+	char tmp_checkpoint_path[sizeof(checkpoint_path) + 4];
+
+	sprintf(tmp_checkpoint_path, "%s.tmp", checkpoint_path);
+
+	g_checkpoint = tmp_checkpoint_path;
+
+	compress_stream(istream, tail, &checkpoint, size, asize, timing);
+
+	long start = wall_clock();
+
+	/* replace the end of the stream */
+	splice_tail(ostream, checkpoint.offset, tail);
+
+	fclose(tail);
+
+	/* now the size is known */
+	struct frame_header header = checkpoint.header;
+	unsigned char buf[65536];
+
+	header.content_size = *size;
+
+	size_t hsize = frame_write_header(&header, buf);
+
+	if (fseek(ostream, 0, SEEK_SET)) {
+		abort();
+	}
+
+	fsave(buf, hsize, ostream);
+
+	if (fflush(ostream) || rename(tmp_checkpoint_path, checkpoint_path)) {
+		fprintf(stderr, "Cannot write the checkpoint\n");
+		abort();
+	}
+
+	timing->save += wall_clock() - start;
+
+	free(checkpoint.file);
+}
+
+/* the stream needs the loaded dictionary */
+void check_dict(const struct frame_header *header)
+{
+	if (header->flags & FRAME_FLAG_DICT) {
+		if (g_dict == NULL) {
+			fprintf(stderr, "The stream needs a dictionary (-D)\n");
+			abort();
+		}
+
+		if (header->dict_id != g_dict_id) {
+			fprintf(stderr, "Dictionary mismatch\n");
+			abort();
+		}
+	}
+}
+
+/* a file of the batch */
+struct batch_file {
+	char *path;
+	size_t isize; /* the size of the input file, for the scheduling */
+	/* statistics */
+	size_t size;
+	size_t asize;
+	struct timing timing;
+	size_t events[E_LAST];
+	float sizes[E_LAST];
+	uint64_t phase_cycles[P_LAST];
+	struct state_stats state_stats;
+};
+
+struct batch {
+	int mode;
+	int force;
+	int verbose;
+	size_t workers; /* share the memory budget */
+	struct parser_params params; /* of the main thread (-t, -w, ...), for the compression */
+	struct batch_file *files;
+	size_t n;
+	size_t capacity;
+};
+
+int has_suffix(const char *path, const char *suffix)
+{
+	size_t len = strlen(path);
+	size_t slen = strlen(suffix);
+
+	return len > slen && strcmp(path + len - slen, suffix) == 0;
+}
+
+/* the compressed files are skipped when compressing, and only those are decompressed */
+void batch_add(const char *path, size_t size, void *arg)
+{
+	struct batch *batch = arg;
+
+	if (has_suffix(path, ".x3") != (batch->mode == DECOMPRESS)) {
+		return;
+	}
+
+	if (batch->n == batch->capacity) {
+		batch->capacity = batch->capacity > 0 ? 2 * batch->capacity : 64;
+		batch->files = realloc(batch->files, batch->capacity * sizeof(struct batch_file));
+
+		if (batch->files == NULL) {
+			abort();
+		}
+	}
+
+	struct batch_file *file = batch->files + batch->n++;
+
+	memset(file, 0, sizeof(struct batch_file));
+
+	file->path = malloc(strlen(path) + 1);
+
+	if (file->path == NULL) {
+		abort();
+	}
+
+	strcpy(file->path, path);
+	file->isize = size;
+}
+
+/* the largest files first, so that the last files to finish are short */
+int batch_file_compar(const void *l, const void *r)
+{
+	const struct batch_file *lf = l;
+	const struct batch_file *rf = r;
+
+	if (lf->isize != rf->isize) {
+		return lf->isize > rf->isize ? -1 : +1;
+	}
+
+	return strcmp(lf->path, rf->path);
+}
+
+/* the pool task, each file is compressed (or decompressed) by a single coder on the worker thread */
+void batch_task(void *arg, size_t i)
+{
+	struct batch *batch = arg;
+	struct batch_file *file = batch->files + i;
+
+	/* the coders on this thread reuse the storage of the previous one */
+	keep_storage(1);
+
+	/* the previous file might have set those of its header */
+	set_parser_params(&batch->params);
+
+	memset(events, 0, sizeof(events));
+	memset(sizes, 0, sizeof(sizes));
+	memset(phase_cycles, 0, sizeof(phase_cycles));
+	memset(&state_stats, 0, sizeof(state_stats));
+
+	FILE *istream = fopen(file->path, "r");
+
+	if (istream == NULL) {
+		fprintf(stderr, "Cannot open input file\n");
+		abort();
+	}
+
+	/* add the suffix, or remove it */
+	char *path = malloc(strlen(file->path) + 4);
+
+	if (path == NULL) {
+		abort();
+	}
+
+	strcpy(path, file->path);
+
+	struct frame_header header;
+
+	if (batch->mode == COMPRESS) {
+		strcat(path, ".x3");
+
+		set_encoder_mem_limit(batch->workers);
+		format_version = FRAME_VERSION;
+	} else {
+		path[strlen(path) - 3] = 0;
+
+		read_header(&header, istream);
+
+		check_dict(&header);
+
+		if (!(header.flags & FRAME_FLAG_DICT) && g_dict != NULL) {
+			fprintf(stderr, "The stream was compressed without the dictionary\n");
+			abort();
+		}
+
+		set_decoder_mem_limit(&header, batch->workers);
+		format_version = header.version;
+	}
+
+	FILE *ostream = force_fopen(path, "w+", batch->force);
+
+	if (ostream == NULL) {
+		fprintf(stderr, "Cannot open output file\n");
+		abort();
+	}
+
+	if (batch->mode == COMPRESS) {
+		if (g_blocks) {
+			compress_blocks(istream, ostream, &file->size, &file->asize, &file->timing, 0);
+		} else {
+			compress_file(istream, ostream, &file->size, &file->asize, &file->timing);
+		}
+	} else {
+		if (header.flags & FRAME_FLAG_BLOCKS) {
+			decompress_blocks(&header, istream, ostream, &file->size, &file->asize, &file->timing);
+		} else if (header.flags & FRAME_FLAG_STORED) {
+			decompress_stored(&header, istream, ostream, &file->size, &file->asize, &file->timing);
+		} else if (!(header.flags & FRAME_FLAG_CONTENT_SIZE)) {
+			decompress_stream(&header, istream, ostream, &file->size, &file->asize, &file->timing);
+		} else {
+			decompress_file(&header, istream, ostream, &file->size, &file->asize, &file->timing);
+		}
+	}
+
+	fclose(istream);
+	fclose(ostream);
+
+	memcpy(file->events, events, sizeof(events));
+	memcpy(file->sizes, sizes, sizeof(sizes));
+	memcpy(file->phase_cycles, phase_cycles, sizeof(phase_cycles));
+	file->state_stats = state_stats;
+
+	if (batch->verbose) {
+		fprintf(stderr, "%s: %zu -> %zu\n", file->path, batch->mode == COMPRESS ? file->size : file->asize, batch->mode == COMPRESS ? file->asize : file->size);
+	}
+
+	free(path);
+}
+
+/* the worker is done, release the storage of its coders */
+void batch_cleanup(void *arg)
+{
+	(void)arg;
+
+	keep_storage(0);
+}
+
+/*
+ * Compresses (or decompresses) each file found at the paths (or at the paths read from the standard input, one per line).
+ * The files are processed on g_threads worker threads, each file by a single coder.
+ * The statistics are summed over the files.
+ */
+void batch(int mode, char **paths, size_t n, int force, int verbose, size_t *size, size_t *asize, struct timing *timing)
+{
+	struct batch batch;
+
+	batch.mode = mode;
+	batch.force = force;
+	batch.verbose = verbose;
+	batch.workers = g_threads;
+	batch.files = NULL;
+	batch.n = 0;
+	batch.capacity = 0;
+
+	get_parser_params(&batch.params);
+
+	for (size_t i = 0; i < n; ++i) {
+		if (fwalk(paths[i], batch_add, &batch) == -1) {
+			fprintf(stderr, "Cannot open input file\n");
+			abort();
+		}
+	}
+
+	if (n == 0) {
+		char line[4096];
+
+		while (fgets(line, sizeof(line), stdin) != NULL) {
+			line[strcspn(line, "\n")] = 0;
+
+			if (line[0] != 0 && fwalk(line, batch_add, &batch) == -1) {
+				fprintf(stderr, "Cannot open input file\n");
+				abort();
+			}
+		}
+	}
+
+	qsort(batch.files, batch.n, sizeof(struct batch_file), batch_file_compar);
+
+	/* the files are processed in parallel, each of them on a single thread */
+	g_threads = 1;
+
+	long start = wall_clock();
+
+	pool_run_cleanup(batch.workers, batch.n, batch_task, batch_cleanup, &batch);
+
+	timing->code = wall_clock() - start;
+
+	memset(events, 0, sizeof(events));
+	memset(sizes, 0, sizeof(sizes));
+	memset(phase_cycles, 0, sizeof(phase_cycles));
+	memset(&state_stats, 0, sizeof(state_stats));
+
+	*size = 0;
+	*asize = 0;
+
+	for (size_t i = 0; i < batch.n; ++i) {
+		struct batch_file *file = batch.files + i;
+
+		for (int e = 0; e < E_LAST; ++e) {
+			events[e] += file->events[e];
+			sizes[e] += file->sizes[e];
+		}
+
+		for (int ph = 0; ph < P_LAST; ++ph) {
+			phase_cycles[ph] += file->phase_cycles[ph];
+		}
+
+		add_state_stats(&file->state_stats);
+
+		*size += file->size;
+		*asize += file->asize;
+
+		timing->load += file->timing.load;
+		timing->save += file->timing.save;
+
+		free(file->path);
+	}
+
+	if (verbose) {
+		fprintf(stderr, "files: %zu\n", batch.n);
+	}
+
+	free(batch.files);
+}
+
+/* benchmark: number of runs of each parameter set, and the format of the results */
+static size_t g_bench_iterations = 5;
+
+enum {
+	BENCH_TEXT,
+	BENCH_CSV,
+	BENCH_JSON
+};
+
+static int g_bench_format = BENCH_TEXT;
+
+/* the parameter sets (-t and -w take comma-separated lists in the benchmark mode) */
+#define BENCH_MAX_VALUES 16
+
+static size_t g_bench_match_counts[BENCH_MAX_VALUES];
+static size_t g_bench_match_count_n = 0;
+static size_t g_bench_windows[BENCH_MAX_VALUES];
+static size_t g_bench_window_n = 0;
+
+/* the benchmark of the small messages (--messages), the sizes */
+static size_t g_bench_message_sizes[BENCH_MAX_VALUES];
+static size_t g_bench_message_size_n = 0;
+
+/* the decimal values separated by commas, returns the number of values */
+size_t parse_list(const char *arg, size_t *values, size_t unit)
+{
+	size_t n = 0;
+
+	for (;;) {
+		char *end;
+
+		if (n == BENCH_MAX_VALUES) {
+			fprintf(stderr, "Too many values\n");
+			abort();
+		}
+
+		values[n++] = (size_t)strtoull(arg, &end, 10) * unit;
+
+		if (end == arg || (*end != ',' && *end != 0)) {
+			fprintf(stderr, "Invalid list of values\n");
+			abort();
+		}
+
+		if (*end == 0) {
+			return n;
+		}
+
+		arg = end + 1;
+	}
+}
+
+int long_compar(const void *l, const void *r)
+{
+	long lv = *(const long *)l;
+	long rv = *(const long *)r;
+
+	return (lv > rv) - (lv < rv);
+}
+
+/* sorts the times */
+long median(long *times, size_t n)
+{
+	qsort(times, n, sizeof(long), long_compar);
+
+	return n % 2 ? times[n / 2] : (times[n / 2 - 1] + times[n / 2]) / 2;
+}
+
+/* sorts the times, p in percent (the nearest rank) */
+long percentile(long *times, size_t n, size_t p)
+{
+	qsort(times, n, sizeof(long), long_compar);
+
+	return n > 0 ? times[(n * p + 99) / 100 - 1] : 0;
+}
+
+struct bench_result {
+	const char *path;
+	size_t size;
+	size_t csize; /* the bit streams (and the checksums) of the blocks */
+	long ctime_median, ctime_best;
+	long dtime_median, dtime_best;
+	size_t peak_rss;
+};
+
+void print_bench_header()
+{
+	if (g_bench_format == BENCH_CSV && g_bench_message_size_n > 0) {
+		printf("file,max_match_count,forward_window,message_size,messages,size,compressed_size,ratio,"
+			"compress_us_p50,compress_us_p99,cold_compress_us_p50,cold_compress_us_p99,decompress_us_p50,decompress_us_p99\n");
+	} else if (g_bench_format == BENCH_CSV) {
+		printf("file,max_match_count,forward_window,threads,block_size,size,compressed_size,ratio,"
+			"compress_mbs_median,compress_mbs_best,decompress_mbs_median,decompress_mbs_best,peak_rss\n");
+	}
+}
+
+void print_bench_result(const struct bench_result *r, size_t block_size)
+{
+	float ratio = r->csize > 0 ? r->size / (float)r->csize : 0.f;
+
+	switch (g_bench_format) {
+		case BENCH_TEXT:
+			printf("%s -t %i -w %zu: %zu -> %zu (%.3f), compress %.2f MB/s (best %.2f), decompress %.2f MB/s (best %.2f), peak RSS %zu MiB\n",
+				r->path, get_max_match_count(), get_forward_window() >> 10, r->size, r->csize, ratio,
+				mb_per_s(r->size, r->ctime_median), mb_per_s(r->size, r->ctime_best),
+				mb_per_s(r->size, r->dtime_median), mb_per_s(r->size, r->dtime_best), r->peak_rss >> 20);
+			break;
+		case BENCH_CSV:
+			printf("%s,%i,%zu,%zu,%zu,%zu,%zu,%f,%f,%f,%f,%f,%zu\n",
+				r->path, get_max_match_count(), get_forward_window(), g_threads, block_size, r->size, r->csize, ratio,
+				mb_per_s(r->size, r->ctime_median), mb_per_s(r->size, r->ctime_best),
+				mb_per_s(r->size, r->dtime_median), mb_per_s(r->size, r->dtime_best), r->peak_rss);
+			break;
+		case BENCH_JSON:
+			printf("{\"file\":\"%s\",\"params\":{\"max_match_count\":%i,\"forward_window\":%zu,\"threads\":%zu,\"block_size\":%zu},",
+				r->path, get_max_match_count(), get_forward_window(), g_threads, block_size);
+			printf("\"size\":%zu,\"compressed_size\":%zu,\"ratio\":%f,", r->size, r->csize, ratio);
+			printf("\"compress_mbs\":{\"median\":%f,\"best\":%f},\"decompress_mbs\":{\"median\":%f,\"best\":%f},",
+				mb_per_s(r->size, r->ctime_median), mb_per_s(r->size, r->ctime_best),
+				mb_per_s(r->size, r->dtime_median), mb_per_s(r->size, r->dtime_best));
+			printf("\"peak_rss\":%zu}\n", r->peak_rss);
+			break;
+	}
+
+	fflush(stdout);
+}
+
+/*
+ * Compresses and decompresses the data in memory g_bench_iterations times, with the current parameters.
+ * The data are split into blocks as in the block mode (a single block otherwise), the blocks run on the pool.
+ */
+void bench_run(struct bench_result *r, const char *data, size_t size)
+{
+	size_t block_size = g_blocks ? (g_block_size > 0 ? g_block_size : DEFAULT_BLOCK_SIZE) : (size > 0 ? size : 1);
+	size_t padding = get_forward_padding();
+	size_t n = (size + block_size - 1) / block_size;
+
+	struct block *cblocks = malloc(n * sizeof(struct block));
+	struct block *dblocks = malloc(n * sizeof(struct block));
+	char *out = malloc(size);
+	long *ctimes = malloc(g_bench_iterations * sizeof(long));
+	long *dtimes = malloc(g_bench_iterations * sizeof(long));
+
+	if ((n > 0 && (cblocks == NULL || dblocks == NULL)) || (size > 0 && out == NULL) || ctimes == NULL || dtimes == NULL) {
+		abort();
+	}
+
+	/* each block is followed by the zero padding */
+	for (size_t b = 0; b < n; ++b) {
+		struct block *block = cblocks + b;
+
+		block->size = minsize(block_size, size - b * block_size);
+		block->data = malloc(block->size + padding);
+		block->code = malloc(compress_bound(block->size) + FRAME_CHECKSUM_SIZE);
+		block->prefix = NULL;
+		block->psize = 0;
+		block->checksum = g_checksum;
+		block->mem_limit = mem_limit;
+		block->version = format_version;
+		get_parser_params(&block->params);
+
+		if (block->data == NULL || block->code == NULL) {
+			abort();
+		}
+
+		memcpy(block->data, data + b * block_size, block->size);
+		memset(block->data + block->size, 0, padding);
+	}
+
+	r->size = size;
+
+	for (size_t i = 0; i < g_bench_iterations; ++i) {
+		long start = wall_clock();
+
+		pool_run(g_threads, n, compress_block_task, cblocks);
+
+		ctimes[i] = wall_clock() - start;
+
+		r->csize = 0;
+
+		for (size_t b = 0; b < n; ++b) {
+			dblocks[b] = cblocks[b];
+			dblocks[b].data = out + b * block_size;
+			r->csize += cblocks[b].code_size;
+		}
+
+		memset(out, 0, size);
+
+		start = wall_clock();
+
+		pool_run(g_threads, n, decompress_block_task, dblocks);
+
+		dtimes[i] = wall_clock() - start;
+
+		if (memcmp(out, data, size) != 0) {
+			fprintf(stderr, "Round-trip mismatch: %s\n", r->path);
+			abort();
+		}
+	}
+
+	/* sorted by median() */
+	r->ctime_median = median(ctimes, g_bench_iterations);
+	r->ctime_best = ctimes[0];
+	r->dtime_median = median(dtimes, g_bench_iterations);
+	r->dtime_best = dtimes[0];
+	r->peak_rss = peak_rss();
+
+	for (size_t b = 0; b < n; ++b) {
+		free(cblocks[b].data);
+		free(cblocks[b].code);
+	}
+
+	free(cblocks);
+	free(dblocks);
+	free(out);
+	free(ctimes);
+	free(dtimes);
+}
+
+struct message_result {
+	const char *path;
+	size_t message_size;
+	size_t messages;
+	size_t size;
+	size_t csize; /* the bit streams of the messages */
+	long ctime_p50, ctime_p99;
+	long cold_ctime_p50, cold_ctime_p99; /* the coder and the buffers are allocated for each message */
+	long dtime_p50, dtime_p99;
+};
+
+float microseconds(long ns)
+{
+	return (float)ns / 1e3f;
+}
+
+void print_message_result(const struct message_result *r)
+{
+	float ratio = r->csize > 0 ? r->size / (float)r->csize : 0.f;
+
+	switch (g_bench_format) {
+		case BENCH_TEXT:
+			printf("%s -t %i -w %zu, %zu B messages: %zu messages, %zu -> %zu (%.3f), "
+				"compress p50 %.1f us p99 %.1f us (cold p50 %.1f us p99 %.1f us), decompress p50 %.1f us p99 %.1f us\n",
+				r->path, get_max_match_count(), get_forward_window() >> 10, r->message_size, r->messages, r->size, r->csize, ratio,
+				microseconds(r->ctime_p50), microseconds(r->ctime_p99), microseconds(r->cold_ctime_p50), microseconds(r->cold_ctime_p99),
+				microseconds(r->dtime_p50), microseconds(r->dtime_p99));
+			break;
+		case BENCH_CSV:
+			printf("%s,%i,%zu,%zu,%zu,%zu,%zu,%f,%f,%f,%f,%f,%f,%f\n",
+				r->path, get_max_match_count(), get_forward_window(), r->message_size, r->messages, r->size, r->csize, ratio,
+				microseconds(r->ctime_p50), microseconds(r->ctime_p99), microseconds(r->cold_ctime_p50), microseconds(r->cold_ctime_p99),
+				microseconds(r->dtime_p50), microseconds(r->dtime_p99));
+			break;
+		case BENCH_JSON:
+			printf("{\"file\":\"%s\",\"params\":{\"max_match_count\":%i,\"forward_window\":%zu,\"message_size\":%zu},",
+				r->path, get_max_match_count(), get_forward_window(), r->message_size);
+			printf("\"messages\":%zu,\"size\":%zu,\"compressed_size\":%zu,\"ratio\":%f,", r->messages, r->size, r->csize, ratio);
+			printf("\"compress_us\":{\"p50\":%f,\"p99\":%f},\"cold_compress_us\":{\"p50\":%f,\"p99\":%f},\"decompress_us\":{\"p50\":%f,\"p99\":%f}}\n",
+				microseconds(r->ctime_p50), microseconds(r->ctime_p99), microseconds(r->cold_ctime_p50), microseconds(r->cold_ctime_p99),
+				microseconds(r->dtime_p50), microseconds(r->dtime_p99));
+			break;
+	}
+
+	fflush(stdout);
+}
+
+/* without the message API: the padded copy, the output buffer and the coder are allocated for the message */
+size_t cold_compress(const char *src, size_t size, unsigned char *dst)
+{
+	size_t padding = get_forward_padding();
+	char *data = malloc(size + padding);
+	unsigned char *code = malloc(compress_bound(size));
+
+	if (data == NULL || code == NULL) {
+		abort();
+	}
+
+	memcpy(data, src, size);
+	memset(data + size, 0, padding);
+
+	create();
+
+	size_t csize = compress_buffer(data, size, code);
+
+	destroy();
+
+	memcpy(dst, code, csize);
+
+	free(data);
+	free(code);
+
+	return csize;
+}
+
+/*
+ * Splits the data into messages of message_size bytes, and times each of them g_bench_iterations times:
+ * through the message API, and through a coder allocated for each message.
+ */
+void bench_messages(struct message_result *r, const char *data, size_t size, size_t message_size)
+{
+	size_t n = (size + message_size - 1) / message_size;
+	size_t count = n * g_bench_iterations;
+
+	long *ctimes = malloc((count + 1) * sizeof(long));
+	long *cold_ctimes = malloc((count + 1) * sizeof(long));
+	long *dtimes = malloc((count + 1) * sizeof(long));
+	unsigned char *code = malloc(message_bound(message_size));
+	char *out = malloc(message_size);
+
+	if (ctimes == NULL || cold_ctimes == NULL || dtimes == NULL || code == NULL || out == NULL) {
+		abort();
+	}
+
+	r->message_size = message_size;
+	r->messages = n;
+	r->size = size;
+	r->csize = 0;
+
+	message_open(message_size);
+
+	for (size_t i = 0, k = 0; i < g_bench_iterations; ++i) {
+		for (size_t m = 0; m < n; ++m, ++k) {
+			const char *p = data + m * message_size;
+			size_t len = minsize(message_size, size - m * message_size);
+
+			long start = wall_clock();
+
+			size_t csize = message_compress(p, len, code, message_bound(message_size));
+
+			ctimes[k] = wall_clock() - start;
+
+			start = wall_clock();
+
+			int error = message_decompress(code, csize, out, len);
+
+			dtimes[k] = wall_clock() - start;
+
+			if (error != 0 || memcmp(out, p, len) != 0) {
+				fprintf(stderr, "Round-trip mismatch: %s\n", r->path);
+				abort();
+			}
+
+			if (i == 0) {
+				r->csize += csize;
+			}
+		}
+	}
+
+	message_close();
+
+	for (size_t i = 0, k = 0; i < g_bench_iterations; ++i) {
+		for (size_t m = 0; m < n; ++m, ++k) {
+			const char *p = data + m * message_size;
+			size_t len = minsize(message_size, size - m * message_size);
+
+			long start = wall_clock();
+
+			cold_compress(p, len, code);
+
+			cold_ctimes[k] = wall_clock() - start;
+		}
+	}
+
+	r->ctime_p50 = percentile(ctimes, count, 50);
+	r->ctime_p99 = percentile(ctimes, count, 99);
+	r->cold_ctime_p50 = percentile(cold_ctimes, count, 50);
+	r->cold_ctime_p99 = percentile(cold_ctimes, count, 99);
+	r->dtime_p50 = percentile(dtimes, count, 50);
+	r->dtime_p99 = percentile(dtimes, count, 99);
+
+	free(ctimes);
+	free(cold_ctimes);
+	free(dtimes);
+	free(code);
+	free(out);
+}
+
+/* each file with each parameter set */
+void bench(char **paths, size_t n, int verbose)
+{
+	if (g_bench_match_count_n == 0) {
+		g_bench_match_counts[g_bench_match_count_n++] = (size_t)get_max_match_count();
+	}
+
+	if (g_bench_window_n == 0) {
+		g_bench_windows[g_bench_window_n++] = get_forward_window();
+	}
+
+	set_encoder_mem_limit(g_blocks && g_bench_message_size_n == 0 ? g_threads : 1);
+
+	print_bench_header();
+
+	for (size_t i = 0; i < n; ++i) {
+		FILE *istream = fopen(paths[i], "r");
+
+		if (istream == NULL) {
+			fprintf(stderr, "Cannot open input file\n");
+			abort();
+		}
+
+		size_t size = fsize(istream);
+		char *data = malloc(size + 1);
+
+		if (data == NULL) {
+			abort();
+		}
+
+		fload(data, size, istream);
+		fclose(istream);
+
+		for (size_t t = 0; t < g_bench_match_count_n; ++t) {
+			for (size_t w = 0; w < g_bench_window_n; ++w) {
+				struct bench_result r;
+
+				set_max_match_count((int)g_bench_match_counts[t]);
+				set_forward_window(g_bench_windows[w]);
+
+				if (verbose) {
+					fprintf(stderr, "%s -t %i -w %zu...\n", paths[i], get_max_match_count(), get_forward_window() >> 10);
+				}
+
+				r.path = paths[i];
+
+				/* the messages are coded on this thread, one at a time */
+				for (size_t s = 0; s < g_bench_message_size_n; ++s) {
+					struct message_result m;
 
-				dict_insert_elem(&e);
-				model_enlarge(&model_index1);
-			}
+					m.path = paths[i];
 
-			p += len;
+					bench_messages(&m, data, size, g_bench_message_sizes[s]);
 
-			prev_context1 = 0;
-			context1 = 0;
+					print_message_result(&m);
+				}
 
-			dict_update_costs(p);
-		}
-	}
+				if (g_bench_message_size_n > 0) {
+					continue;
+				}
 
-	/* signal end of input */
-	ac_encode_symbol_model(&ac, bio, E_EOF, &model_events);
-	inc_model(&model_events, E_EOF);
-}
+				/* the peak of this file and parameter set only (the input included) */
+				reset_peak_rss();
 
-void destroy()
-{
-#if 0
-	dict_dump();
-#endif
+				bench_run(&r, data, size);
 
-	for (size_t e = 0; e < dict_get_elems(); ++e) {
-		free(ctx1[e].arr);
-	}
-	free(ctx1);
-	dict_destroy();
+				print_bench_result(&r, g_blocks ? (g_block_size > 0 ? g_block_size : DEFAULT_BLOCK_SIZE) : size);
+			}
+		}
 
-	for (size_t e = 0; e < tag_pair_get_elems(); ++e) {
-		free(ctx0[e].arr);
+		free(data);
 	}
-	free(ctx0);
-	tag_pair_destroy();
-
-	model_destroy(&model_events);
-	model_destroy(&model_match_size);
-	model_destroy(&model_chars);
-	model_destroy(&model_index1);
 }
 
+/* long options without the short form */
 enum {
-	COMPRESS,
-	DECOMPRESS
+	OPT_STATS = 256,
+	OPT_STREAM,
+	OPT_RANGE,
+	OPT_NO_MMAP,
+	OPT_NO_CHECKSUM,
+	OPT_TRAIN,
+	OPT_CHECKPOINT,
+	OPT_APPEND,
+	OPT_FORMAT,
+	OPT_TARGET_SPEED,
+	OPT_PIPELINE,
+	OPT_TRACE,
+	OPT_MESSAGES
 };
 
-void print_help(char *path)
-{
-	fprintf(stderr, "Usage :\n\t%s [arguments] [input-file] [output-file]\n\n", path);
-	fprintf(stderr, "Arguments :\n");
-	fprintf(stderr, " -d     : force decompression\n");
-	fprintf(stderr, " -z     : force compression\n");
-	fprintf(stderr, " -f     : overwrite existing output file\n");
-	fprintf(stderr, " -k     : keep (don't delete) input file (default)\n");
-	fprintf(stderr, " -h     : print this message\n");
-	fprintf(stderr, " -t NUM : maximum number of matches (affects compression ratio and speed)\n");
-	fprintf(stderr, " -w NUM : window size (in kilobytes, affects compression ratio and speed)\n");
-	fprintf(stderr, " -m NUM : magic factor (affects compression ratio and speed)\n");
-}
+static const struct option long_options[] = {
+	{ "stats", optional_argument, NULL, OPT_STATS },
+	{ "stream", no_argument, NULL, OPT_STREAM },
+	{ "range", required_argument, NULL, OPT_RANGE },
+	{ "no-mmap", no_argument, NULL, OPT_NO_MMAP },
+	{ "no-checksum", no_argument, NULL, OPT_NO_CHECKSUM },
+	{ "train", no_argument, NULL, OPT_TRAIN },
+	{ "checkpoint", no_argument, NULL, OPT_CHECKPOINT },
+	{ "append", no_argument, NULL, OPT_APPEND },
+	{ "memory", required_argument, NULL, 'M' },
+	{ "format", required_argument, NULL, OPT_FORMAT },
+	{ "target-speed", required_argument, NULL, OPT_TARGET_SPEED },
+	{ "pipeline", no_argument, NULL, OPT_PIPELINE },
+	{ "trace", required_argument, NULL, OPT_TRACE },
+	{ "messages", required_argument, NULL, OPT_MESSAGES },
+	{ NULL, 0, NULL, 0 }
+};
 
 int main(int argc, char *argv[])
 {
 	int mode = COMPRESS;
 	int force = 0;
+	int checkpoint = 0;
+	int recursive = 0;
+	const char *dict_path = NULL;
+	const char *trace_path = NULL;
+	const char *match_count_arg = NULL;
+	const char *window_arg = NULL;
 
-	parse: switch (getopt(argc, argv, "zdfkht:w:m:n:x")) {
+	/* the kernels are selected once, before the coders start */
+	backend_init();
+
+	parse: switch (getopt_long(argc, argv, "zdflkhrbi:t:w:m:n:xsT:B:P:D:M:", long_options, NULL)) {
 		case 'z':
 			mode = COMPRESS;
 			goto parse;
@@ -491,16 +5107,28 @@ int main(int argc, char *argv[])
 		case 'f':
 			force = 1;
 			goto parse;
+		case 'l':
+			mode = LIST;
+			goto parse;
 		case 'k':
 			goto parse;
 		case 'h':
 			print_help(argv[0]);
 			return 0;
+		case 'r':
+			recursive = 1;
+			goto parse;
+		case 'b':
+			mode = BENCH;
+			goto parse;
+		case 'i':
+			g_bench_iterations = atoi(optarg) > 0 ? (size_t)atoi(optarg) : 1;
+			goto parse;
 		case 't':
-			set_max_match_count(atoi(optarg));
+			match_count_arg = optarg;
 			goto parse;
 		case 'w':
-			set_forward_window(atoi(optarg) * 1024);
+			window_arg = optarg;
 			goto parse;
 		case 'm':
 			set_magic_factor1(atoi(optarg));
@@ -511,192 +5139,435 @@ int main(int argc, char *argv[])
 		case 'x':
 			g_nl = 1;
 			goto parse;
+		case 's':
+			g_stats = STATS_TEXT;
+			goto parse;
+		case 'T':
+			g_threads = atoi(optarg) > 0 ? (size_t)atoi(optarg) : pool_get_cpus();
+			g_blocks = 1;
+			goto parse;
+		case 'B':
+			g_block_size = (size_t)atoi(optarg) * 1024;
+			if (g_block_size == 0 || g_block_size > FRAME_MAX_BLOCK_SIZE) {
+				fprintf(stderr, "Invalid block size\n");
+				abort();
+			}
+			g_blocks = 1;
+			goto parse;
+		case 'P':
+			g_prime_size = (size_t)atoi(optarg) * 1024;
+			g_blocks = 1;
+			goto parse;
+		case OPT_STATS:
+			if (optarg == NULL || strcmp(optarg, "text") == 0) {
+				g_stats = STATS_TEXT;
+			} else if (strcmp(optarg, "json") == 0) {
+				g_stats = STATS_JSON;
+			} else {
+				fprintf(stderr, "Unknown statistics format\n");
+				abort();
+			}
+			goto parse;
+		case OPT_STREAM:
+			g_stream = 1;
+			goto parse;
+		case OPT_RANGE:
+			parse_range(optarg);
+			mode = DECOMPRESS;
+			goto parse;
+		case OPT_NO_MMAP:
+			g_mmap = 0;
+			goto parse;
+		case OPT_NO_CHECKSUM:
+			g_checksum = 0;
+			goto parse;
+		case 'D':
+			dict_path = optarg;
+			goto parse;
+		case 'M':
+			parse_mem_budget(optarg);
+			goto parse;
+		case OPT_TRAIN:
+			mode = TRAIN;
+			goto parse;
+		case OPT_CHECKPOINT:
+			checkpoint = 1;
+			goto parse;
+		case OPT_APPEND:
+			mode = APPEND;
+			goto parse;
+		case OPT_FORMAT:
+			if (strcmp(optarg, "text") == 0) {
+				g_bench_format = BENCH_TEXT;
+			} else if (strcmp(optarg, "csv") == 0) {
+				g_bench_format = BENCH_CSV;
+			} else if (strcmp(optarg, "json") == 0) {
+				g_bench_format = BENCH_JSON;
+			} else {
+				fprintf(stderr, "Unknown benchmark format\n");
+				abort();
+			}
+			goto parse;
+		case OPT_TRACE:
+			trace_path = optarg;
+			goto parse;
+		case OPT_MESSAGES:
+			g_bench_message_size_n = parse_list(optarg, g_bench_message_sizes, 1024);
+			for (size_t s = 0; s < g_bench_message_size_n; ++s) {
+				if (g_bench_message_sizes[s] == 0) {
+					fprintf(stderr, "Invalid message size\n");
+					abort();
+				}
+			}
+			mode = BENCH;
+			goto parse;
+		case OPT_PIPELINE:
+			/* on a single processor, the threads would only take turns */
+			g_pipeline = pool_get_cpus() > 1;
+			goto parse;
+		case OPT_TARGET_SPEED:
+			g_target_speed = (float)atof(optarg);
+			if (!(g_target_speed > 0.f)) {
+				fprintf(stderr, "Invalid target speed\n");
+				abort();
+			}
+			g_blocks = 1;
+			goto parse;
 		default:
 			abort();
 		case -1:
 			;
 	}
 
-	FILE *istream = NULL, *ostream = NULL;
+#ifdef X3_NO_STATS
+	if (g_stats != STATS_NONE) {
+		fprintf(stderr, "The statistics are compiled out (X3_NO_STATS)\n");
+		abort();
+	}
+#endif
 
-	switch (argc - optind) {
-		case 0:
-			istream = stdin;
-			ostream = stdout;
-			break;
-		case 1:
-			istream = fopen(argv[optind], "r");
-			/* guess output file name */
-			if (mode == COMPRESS) {
-				char path[4096];
-				sprintf(path, "%s.x3", argv[optind]); /* add .x suffix */
-				ostream = force_fopen(path, "w", force);
-			} else {
-				if (strrchr(argv[optind], '.') != NULL) {
-					*strrchr(argv[optind], '.') = 0; /* remove suffix */
-				}
-				ostream = force_fopen(argv[optind], "w", force);
-			}
-			break;
-		case 2:
-			istream = fopen(argv[optind + 0], "r");
-			ostream = force_fopen(argv[optind + 1], "w", force);
-			break;
-		default:
-			fprintf(stderr, "Unexpected argument\n");
-			abort();
+	/* the benchmark runs each value of the lists, the other modes take a single value */
+	if (mode != BENCH && ((match_count_arg != NULL && strchr(match_count_arg, ',') != NULL) || (window_arg != NULL && strchr(window_arg, ',') != NULL))) {
+		fprintf(stderr, "A list of values needs -b\n");
+		abort();
 	}
 
-	fprintf(stderr, "%s\n", mode == COMPRESS ? "Compressing..." : "Decompressing...");
+	if (match_count_arg != NULL) {
+		if (mode == BENCH) {
+			g_bench_match_count_n = parse_list(match_count_arg, g_bench_match_counts, 1);
+			set_max_match_count((int)g_bench_match_counts[0]);
+		} else {
+			set_max_match_count(atoi(match_count_arg));
+		}
+	}
 
-	if (istream == NULL) {
-		fprintf(stderr, "Cannot open input file\n");
-		abort();
+	if (window_arg != NULL) {
+		if (mode == BENCH) {
+			g_bench_window_n = parse_list(window_arg, g_bench_windows, 1024);
+			set_forward_window(g_bench_windows[0]);
+		} else {
+			set_forward_window(atoi(window_arg) * 1024);
+		}
 	}
 
-	if (ostream == NULL) {
-		fprintf(stderr, "Cannot open output file\n");
-		abort();
+	FILE *istream = NULL, *ostream = NULL;
+
+	if (STATS_ENABLED) {
+		/* where permitted */
+		perf_open(&g_perf);
 	}
 
-	create();
+	if (mode == LIST) {
+		if (argc - optind == 0) {
+			list(stdin);
+		}
 
-	struct bio bio;
+		for (int i = optind; i < argc; ++i) {
+			istream = fopen(argv[i], "r");
 
-	/* uncompressed size */
-	size_t size;
-	/* compressed size */
-	size_t asize;
+			if (istream == NULL) {
+				fprintf(stderr, "Cannot open input file\n");
+				abort();
+			}
 
-	if (mode == COMPRESS) {
-		fprintf(stderr, "max match count: %i\n", get_max_match_count());
-		fprintf(stderr, "forward window: %zu\n", get_forward_window());
-		fprintf(stderr, "magic factor 1: %zu\n", get_magic_factor1());
-		fprintf(stderr, "magic factor 2: %zu\n", get_magic_factor2());
+			printf("%s:\n", argv[i]);
+			list(istream);
+
+			fclose(istream);
+		}
 
-		size_t isize = fsize(istream);
+		return 0;
+	}
 
-		char *iptr = malloc(isize + get_forward_window());
-		char *optr = malloc(isize * 2); /* at most 1 : 2 ratio */
+	/* the JSON statistics are the only output on stderr */
+	int verbose = (g_stats != STATS_JSON);
 
-		if (iptr == NULL) {
+	if (mode == TRAIN) {
+		if (argc - optind == 0) {
+			fprintf(stderr, "Missing dictionary file\n");
 			abort();
 		}
 
-		if (optr == NULL) {
+		ostream = force_fopen(argv[optind], "w", force);
+
+		if (ostream == NULL) {
+			fprintf(stderr, "Cannot open output file\n");
 			abort();
 		}
 
-		memset(iptr + isize, 0, get_forward_window());
-		fload(iptr, isize, istream);
+		/* the samples, or the standard input */
+		size_t n = argc - optind - 1;
+		FILE **samples = malloc((n + 1) * sizeof(FILE *));
 
-		bio_open(&bio, optr, optr + isize * 2, BIO_MODE_WRITE);
+		if (samples == NULL) {
+			abort();
+		}
 
-		ac_init(&ac);
+		for (size_t i = 0; i < n; ++i) {
+			samples[i] = fopen(argv[optind + 1 + i], "r");
 
-		long start = wall_clock();
+			if (samples[i] == NULL) {
+				fprintf(stderr, "Cannot open input file\n");
+				abort();
+			}
+		}
 
-		compress(iptr, isize, &bio);
+		if (n == 0) {
+			samples[n++] = stdin;
+		}
 
-		fprintf(stderr, "elapsed time: %f\n", (wall_clock() - start) / (float)1000000000L);
+		if (verbose) {
+			fprintf(stderr, "Training...\n");
+		}
 
-		ac_encode_flush(&ac, &bio);
-		bio_close(&bio, BIO_MODE_WRITE);
+		train(samples, n, ostream, verbose);
 
-		char *end = (char *)bio.ptr;
+		for (size_t i = 0; i < n; ++i) {
+			fclose(samples[i]);
+		}
 
-		size = isize;
-		asize = end - optr;
+		free(samples);
+		fclose(ostream);
 
-		fsave(optr, asize, ostream);
+		return 0;
+	}
 
-		free(iptr);
-		free(optr);
-	} else {
-		size_t isize = fsize(istream);
+	if (dict_path != NULL) {
+		load_dict(dict_path);
+	}
+
+	if (mode == BENCH) {
+		if (argc - optind == 0) {
+			fprintf(stderr, "Missing input file\n");
+			abort();
+		}
 
-		asize = isize;
+		bench(argv + optind, argc - optind, verbose);
 
-		char *iptr = malloc(isize);
-		char *optr = malloc(64 * isize); /* at most 64 : 1 ratio */
+		unload_dict();
 
-		if (iptr == NULL) {
+		return 0;
+	}
+
+	/* uncompressed size */
+	size_t size;
+	/* compressed size */
+	size_t asize;
+
+	struct timing timing = { 0, 0, 0 };
+
+	if (recursive) {
+		if (g_range || checkpoint || mode == APPEND) {
+			fprintf(stderr, "The batch mode processes whole files\n");
 			abort();
 		}
 
-		if (optr == NULL) {
+		if (g_target_speed > 0.f) {
+			fprintf(stderr, "The target speed cannot be used in the batch mode\n");
 			abort();
 		}
 
-		fload(iptr, isize, istream);
+		if (trace_path != NULL) {
+			fprintf(stderr, "The trace cannot be written in the batch mode\n");
+			abort();
+		}
 
-		unsigned char *iend = (unsigned char *)iptr + isize;
+		/* -T gives the number of files processed at once, the files are split into blocks only if asked */
+		if (g_block_size == 0 && g_prime_size == 0) {
+			g_blocks = 0;
+		}
 
-		bio_open(&bio, iptr, iend, BIO_MODE_READ);
+		if (verbose) {
+			fprintf(stderr, "%s\n", mode == COMPRESS ? "Compressing..." : "Decompressing...");
+		}
 
-		ac_init(&ac);
+		batch(mode, argv + optind, argc - optind, force, verbose, &size, &asize, &timing);
 
-		ac_decode_init(&ac, &bio);
+		if (verbose) {
+			fprintf(stderr, "elapsed time: %f\n", seconds(timing.code));
+		}
 
-		long start = wall_clock();
+		switch (g_stats) {
+			case STATS_TEXT:
+				print_stats_text(size, asize, &timing);
+				break;
+			case STATS_JSON:
+				print_stats_json(mode, size, asize, &timing);
+				break;
+		}
 
-		char *oend = decompress((char *)optr, &bio);
+		unload_dict();
 
-		fprintf(stderr, "elapsed time: %f\n", (wall_clock() - start) / (float)1000000000L);
+		return 0;
+	}
 
-		bio_close(&bio, BIO_MODE_READ);
+	/* the path of the output file (when it is not the standard output) */
+	const char *opath = NULL;
+	char path[4096];
 
-		size = oend - optr;
+	/* the output files are opened for reading as well, so that they can be mapped */
+	switch (argc - optind) {
+		case 0:
+			istream = stdin;
+			ostream = stdout;
+			break;
+		case 1:
+			/* the data to append come from the standard input */
+			istream = mode == APPEND ? stdin : fopen(argv[optind], "r");
+			/* guess output file name */
+			if (mode == APPEND) {
+				ostream = fopen(argv[optind], "r+");
+				opath = argv[optind];
+			} else if (mode == COMPRESS) {
+				sprintf(path, "%s.x3", argv[optind]); /* add .x suffix */
+				ostream = force_fopen(path, "w+", force);
+				opath = path;
+			} else {
+				if (strrchr(argv[optind], '.') != NULL) {
+					*strrchr(argv[optind], '.') = 0; /* remove suffix */
+				}
+				ostream = force_fopen(argv[optind], "w+", force);
+			}
+			break;
+		case 2:
+			istream = fopen(argv[optind + 0], "r");
+			ostream = mode == APPEND ? fopen(argv[optind + 1], "r+") : force_fopen(argv[optind + 1], "w+", force);
+			opath = argv[optind + 1];
+			break;
+		default:
+			fprintf(stderr, "Unexpected argument\n");
+			abort();
+	}
 
-		fsave(optr, size, ostream);
+	if (verbose) {
+		fprintf(stderr, "%s\n", mode == COMPRESS ? "Compressing..." : mode == APPEND ? "Appending..." : "Decompressing...");
+	}
 
-		free(iptr);
-		free(optr);
+	if ((checkpoint || mode == APPEND) && opath == NULL) {
+		fprintf(stderr, "The checkpoint needs the output file\n");
+		abort();
 	}
 
-	destroy();
+	if (checkpoint && g_blocks) {
+		fprintf(stderr, "The checkpoint cannot be used with blocks\n");
+		abort();
+	}
 
-	fclose(istream);
-	fclose(ostream);
+	/* the decoder primes the blocks with the parameters of the header */
+	if (g_target_speed > 0.f && g_prime_size > 0 && mode == COMPRESS) {
+		fprintf(stderr, "The target speed cannot be used with priming\n");
+		abort();
+	}
 
-	size_t dict_hit_count = events[E_CTX0] + events[E_CTX1] + events[E_IDX1];
+	if (istream == NULL) {
+		fprintf(stderr, "Cannot open input file\n");
+		abort();
+	}
 
-	size_t stream_size_dict = (size_t)ceil(sizes[E_CTX0] + sizes[E_CTX1] + sizes[E_IDX1]);
-	size_t stream_size      = (size_t)ceil(sizes[E_CTX0] + sizes[E_CTX1] + sizes[E_IDX1] + sizes[E_NEW]);
+	if (ostream == NULL) {
+		fprintf(stderr, "Cannot open output file\n");
+		abort();
+	}
 
-	fprintf(stderr, "input stream size: %zu\n", size);
-	fprintf(stderr, "output stream size: %zu\n", (stream_size + 7) / 8);
-	fprintf(stderr, "dictionary: hit %zu, miss %zu\n", dict_hit_count, events[E_NEW]);
+	if (trace_path != NULL) {
+		open_trace(trace_path, mode, force);
+	}
 
-	fprintf(stderr, "codestream size: dictionary %zu / %f%%, new fragment %zu / %f%%\n",
-		(stream_size_dict + 7) / 8, 100.f * stream_size_dict / stream_size,
-		((size_t)ceil(sizes[E_NEW]) + 7) / 8, 100.f * (size_t)ceil(sizes[E_NEW]) / stream_size
-	);
+	if (mode == COMPRESS) {
+		if (verbose) {
+			fprintf(stderr, "max match count: %i\n", get_max_match_count());
+			fprintf(stderr, "forward window: %zu\n", get_forward_window());
+			fprintf(stderr, "magic factor 1: %zu\n", get_magic_factor1());
+			fprintf(stderr, "magic factor 2: %zu\n", get_magic_factor2());
+		}
 
-#if 1
-	fprintf(stderr, "\x1b[37;1mest. compression ratio: %f\x1b[0m\n", size / (float)((stream_size + 7) / 8));
-	fprintf(stderr, "\x1b[37;1mreal compression ratio: %f\x1b[0m\n", size / (float)asize);
-#else
-	fprintf(stderr, "est. compression ratio: %f\n", size / (float)((stream_size + 7) / 8));
-	fprintf(stderr, "real compression ratio: %f\n", size / (float)asize);
-#endif
+		set_encoder_mem_limit(g_blocks ? g_threads : 1);
 
-	fprintf(stderr, "number of events: ctx0 %zu, ctx1 %zu, miss1 %zu, new %zu\n",
-		events[E_CTX0], events[E_CTX1], events[E_IDX1], events[E_NEW]);
-	fprintf(stderr, "event sizes: ctx0 %f%%, ctx1 %f%%, miss1 %f%%, new %f%%\n",
-		100.f * (size_t)ceil(sizes[E_CTX0]) / stream_size,
-		100.f * (size_t)ceil(sizes[E_CTX1]) / stream_size,
-		100.f * (size_t)ceil(sizes[E_IDX1]) / stream_size,
-		100.f * (size_t)ceil(sizes[E_NEW] ) / stream_size
-	);
+		if (g_blocks) {
+			compress_blocks(istream, ostream, &size, &asize, &timing, verbose);
+		} else if (checkpoint) {
+			char checkpoint_path[4096 + sizeof(CHECKPOINT_SUFFIX)];
 
-	fprintf(stderr, "context entries: ctx0 %zu, ctx1 %zu\n", tag_pair_get_elems(), dict_get_elems());
+			sprintf(checkpoint_path, "%s" CHECKPOINT_SUFFIX, opath);
+			g_checkpoint = checkpoint_path;
 
-#if 0
-	fprintf(stderr, "float PROB_CTX0 = %f;\n", ac_encode_symbol_model_query_prob(E_CTX0, &model_events));
-	fprintf(stderr, "float PROB_CTX1 = %f;\n", ac_encode_symbol_model_query_prob(E_CTX1, &model_events));
-	fprintf(stderr, "float PROB_IDX1 = %f;\n", ac_encode_symbol_model_query_prob(E_IDX1, &model_events));
-#endif
+			compress_stream(istream, ostream, NULL, &size, &asize, &timing);
+		} else if (g_stream || !fseekable(istream)) {
+			compress_stream(istream, ostream, NULL, &size, &asize, &timing);
+		} else {
+			compress_file(istream, ostream, &size, &asize, &timing);
+		}
+	} else if (mode == APPEND) {
+		append(istream, ostream, opath, &size, &asize, &timing);
+	} else {
+		struct frame_header header;
+
+		read_header(&header, istream);
+
+		check_dict(&header);
+
+		if (!(header.flags & FRAME_FLAG_DICT)) {
+			/* compressed without the dictionary */
+			unload_dict();
+		}
+
+		set_decoder_mem_limit(&header, (header.flags & FRAME_FLAG_BLOCKS) ? g_threads : 1);
+		format_version = header.version;
+
+		if (g_range) {
+			decompress_range_file(&header, istream, ostream, &size, &asize, &timing);
+		} else if ((header.flags & FRAME_FLAG_BLOCKS) && (header.flags & FRAME_FLAG_SEEK_TABLE) && header.prime_size == 0 && g_threads > 1 && fseekable(istream)) {
+			decompress_blocks_parallel(&header, istream, ostream, &size, &asize, &timing);
+		} else if (header.flags & FRAME_FLAG_BLOCKS) {
+			decompress_blocks(&header, istream, ostream, &size, &asize, &timing);
+		} else if (header.flags & FRAME_FLAG_STORED) {
+			decompress_stored(&header, istream, ostream, &size, &asize, &timing);
+		} else if (g_stream || !fseekable(istream) || !(header.flags & FRAME_FLAG_CONTENT_SIZE)) {
+			decompress_stream(&header, istream, ostream, &size, &asize, &timing);
+		} else {
+			decompress_file(&header, istream, ostream, &size, &asize, &timing);
+		}
+	}
+
+	if (verbose) {
+		fprintf(stderr, "elapsed time: %f\n", seconds(timing.code));
+	}
+
+	close_trace();
+
+	fclose(istream);
+	fclose(ostream);
+
+	switch (g_stats) {
+		case STATS_TEXT:
+			print_stats_text(size, asize, &timing);
+			break;
+		case STATS_JSON:
+			print_stats_json(mode, size, asize, &timing);
+			break;
+	}
+
+	unload_dict();
 
 	return 0;
 }
@@ -0,0 +1,329 @@
+/*
+ * Summary of the parse trace written by x3 --trace
+ */
+#define _POSIX_C_SOURCE 2
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "trace.h"
+
+/* the fragments are at most this long (the longer repeats are counted as this long) */
+#define MAX_LEN 32
+
+/* log2 buckets of the reuse distances */
+#define DIST_BUCKETS 40
+
+/* the size of the regions ranked by the cost (-r) */
+static size_t g_region_size = 64 * 1024;
+
+/* the number of the costliest regions and tags (-n) */
+static size_t g_top = 10;
+
+static const char *event_names[TRACE_EVENTS] = { "ctx0", "ctx1", "miss1", "new", "eof", "rep", "run" };
+
+struct region {
+	uint64_t pos;
+	size_t size; /* of the fragments starting in the region */
+	double bits;
+};
+
+struct tag_cost {
+	uint32_t tag;
+	size_t count;
+	double bits;
+};
+
+struct summary {
+	size_t tokens;
+	uint64_t size; /* of the fragments */
+	size_t events[TRACE_EVENTS];
+	uint64_t event_size[TRACE_EVENTS];
+	double bits[TRACE_EVENTS];
+	size_t lengths[TRACE_EVENTS][MAX_LEN + 1];
+	size_t inserted; /* new fragments inserted into the dictionary */
+	size_t distances[DIST_BUCKETS]; /* since the previous use of the tag */
+	size_t first_uses; /* of a tag the trace does not show the insertion of */
+	struct region *regions;
+	size_t region_count;
+	struct tag_cost *tags; /* by the tag */
+	size_t tag_count;
+	uint64_t *last_use; /* position + 1 of the last use of the tag, 0 = not seen */
+};
+
+static void *grow(void *ptr, size_t *count, size_t need, size_t size)
+{
+	if (need <= *count) {
+		return ptr;
+	}
+
+	size_t n = *count > 0 ? *count : 1024;
+
+	while (n < need) {
+		n *= 2;
+	}
+
+	ptr = realloc(ptr, n * size);
+
+	if (ptr == NULL) {
+		abort();
+	}
+
+	memset((char *)ptr + *count * size, 0, (n - *count) * size);
+
+	*count = n;
+
+	return ptr;
+}
+
+static size_t log2_bucket(uint64_t v)
+{
+	size_t b = 0;
+
+	while (v > 1 && b + 1 < DIST_BUCKETS) {
+		v >>= 1;
+		b++;
+	}
+
+	return b;
+}
+
+static void add_record(struct summary *s, const struct trace_record *r)
+{
+	unsigned event = r->event < TRACE_EVENTS ? r->event : TRACE_NEW;
+	unsigned len = r->len <= MAX_LEN ? r->len : MAX_LEN;
+
+	s->tokens++;
+	s->size += r->len;
+	s->events[event]++;
+	s->event_size[event] += r->len;
+	s->bits[event] += r->bits;
+	s->lengths[event][len]++;
+
+	/* the region of the fragment */
+	size_t region = (size_t)(r->pos / g_region_size);
+	size_t count = s->region_count;
+
+	s->regions = grow(s->regions, &count, region + 1, sizeof(struct region));
+
+	for (size_t i = s->region_count; i < count; ++i) {
+		s->regions[i].pos = (uint64_t)i * g_region_size;
+	}
+
+	s->region_count = count;
+	s->regions[region].size += r->len;
+	s->regions[region].bits += r->bits;
+
+	if (r->tag == TRACE_NONE) {
+		return;
+	}
+
+	/* both arrays have the same size */
+	size_t tag_count = s->tag_count;
+
+	s->tags = grow(s->tags, &tag_count, (size_t)r->tag + 1, sizeof(struct tag_cost));
+	s->last_use = grow(s->last_use, &s->tag_count, (size_t)r->tag + 1, sizeof(uint64_t));
+
+	s->tags[r->tag].tag = r->tag;
+
+	s->tags[r->tag].count++;
+	s->tags[r->tag].bits += r->bits;
+
+	if (event == TRACE_NEW) {
+		s->inserted++;
+	} else if (s->last_use[r->tag] == 0) {
+		/* inserted before the trace started (the trained dictionary, or the appended stream) */
+		s->first_uses++;
+	} else {
+		s->distances[log2_bucket(r->pos + 1 - s->last_use[r->tag])]++;
+	}
+
+	/* off by one, 0 = not seen */
+	s->last_use[r->tag] = r->pos + 1;
+}
+
+static int region_compar(const void *l, const void *r)
+{
+	const struct region *lr = l;
+	const struct region *rr = r;
+
+	double lb = lr->size > 0 ? lr->bits / lr->size : 0.;
+	double rb = rr->size > 0 ? rr->bits / rr->size : 0.;
+
+	return (lb < rb) - (lb > rb);
+}
+
+static int tag_compar(const void *l, const void *r)
+{
+	const struct tag_cost *lt = l;
+	const struct tag_cost *rt = r;
+
+	return (lt->bits < rt->bits) - (lt->bits > rt->bits);
+}
+
+static double percent(double part, double whole)
+{
+	return whole > 0. ? 100. * part / whole : 0.;
+}
+
+static void print_summary(struct summary *s)
+{
+	double bits = 0.;
+
+	for (int e = 0; e < TRACE_EVENTS; ++e) {
+		bits += s->bits[e];
+	}
+
+	printf("tokens: %zu, data: %llu bytes, estimated: %.0f bytes (%.3f bits per byte)\n",
+		s->tokens, (unsigned long long)s->size, bits / 8, s->size > 0 ? bits / s->size : 0.);
+
+	printf("\nevent     tokens       share     bits    per token  avg. length\n");
+	for (int e = 0; e < TRACE_EVENTS; ++e) {
+		if (e == TRACE_EOF) {
+			continue;
+		}
+
+		printf("%-6s %10zu %10.2f%% %10.2f%% %10.2f %10.2f\n", event_names[e], s->events[e],
+			percent((double)s->events[e], (double)s->tokens), percent(s->bits[e], bits),
+			s->events[e] > 0 ? s->bits[e] / s->events[e] : 0.,
+			s->events[e] > 0 ? (double)s->event_size[e] / s->events[e] : 0.);
+	}
+
+	size_t hits = s->events[TRACE_CTX0] + s->events[TRACE_CTX1] + s->events[TRACE_IDX1];
+
+	printf("\ndictionary hits: %zu of %zu tokens (%.2f%%), coded in ctx0 %.2f%%, ctx1 %.2f%%, by index %.2f%%\n",
+		hits, s->tokens, percent((double)hits, (double)s->tokens),
+		percent((double)s->events[TRACE_CTX0], (double)hits), percent((double)s->events[TRACE_CTX1], (double)hits),
+		percent((double)s->events[TRACE_IDX1], (double)hits));
+	printf("new fragments inserted into the dictionary: %zu of %zu\n", s->inserted, s->events[TRACE_NEW]);
+	printf("repeats: %zu, covering %llu bytes (%.2f%%)\n", s->events[TRACE_REP], (unsigned long long)s->event_size[TRACE_REP],
+		percent((double)s->event_size[TRACE_REP], (double)s->size));
+	printf("runs: %zu, covering %llu bytes (%.2f%%)\n", s->events[TRACE_RUN], (unsigned long long)s->event_size[TRACE_RUN],
+		percent((double)s->event_size[TRACE_RUN], (double)s->size));
+
+	printf("\nlength   hits        new\n");
+	for (int l = 1; l <= MAX_LEN; ++l) {
+		size_t h = s->lengths[TRACE_CTX0][l] + s->lengths[TRACE_CTX1][l] + s->lengths[TRACE_IDX1][l];
+
+		if (h > 0 || s->lengths[TRACE_NEW][l] > 0) {
+			printf("%6i %10zu %10zu\n", l, h, s->lengths[TRACE_NEW][l]);
+		}
+	}
+
+	printf("\nreuse distance (bytes since the previous use of the fragment)\n");
+	for (size_t b = 0; b < DIST_BUCKETS; ++b) {
+		if (s->distances[b] > 0) {
+			printf("%12llu+ %10zu %10.2f%%\n", 1ULL << b, s->distances[b], percent((double)s->distances[b], (double)hits));
+		}
+	}
+	if (s->first_uses > 0) {
+		printf("%13s %10zu %10.2f%%\n", "first use", s->first_uses, percent((double)s->first_uses, (double)hits));
+	}
+
+	qsort(s->regions, s->region_count, sizeof(struct region), region_compar);
+
+	printf("\ncostliest regions of %zu bytes\n", g_region_size);
+	for (size_t i = 0; i < s->region_count && i < g_top; ++i) {
+		const struct region *r = &s->regions[i];
+
+		if (r->size == 0) {
+			break;
+		}
+
+		printf("%12llu %10.3f bits per byte, %10.0f bytes\n", (unsigned long long)r->pos, r->bits / r->size, r->bits / 8);
+	}
+
+	qsort(s->tags, s->tag_count, sizeof(struct tag_cost), tag_compar);
+
+	printf("\ncostliest fragments (the insertion and the hits)\n");
+	for (size_t i = 0; i < s->tag_count && i < g_top; ++i) {
+		const struct tag_cost *t = &s->tags[i];
+
+		if (t->count == 0) {
+			break;
+		}
+
+		printf("tag %10lu %10zu tokens %10.0f bytes\n", (unsigned long)t->tag, t->count, t->bits / 8);
+	}
+}
+
+static void print_help(const char *path)
+{
+	fprintf(stderr, "Usage: %s [-r NUM] [-n NUM] TRACE\n", path);
+	fprintf(stderr, " -r NUM : size of the regions ranked by the cost (in kilobytes, default 64)\n");
+	fprintf(stderr, " -n NUM : number of the costliest regions and fragments (default 10)\n");
+	fprintf(stderr, " -h     : print this message\n");
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+
+	while ((opt = getopt(argc, argv, "r:n:h")) != -1) {
+		switch (opt) {
+			case 'r':
+				g_region_size = (size_t)atoi(optarg) * 1024;
+				if (g_region_size == 0) {
+					fprintf(stderr, "Invalid region size\n");
+					abort();
+				}
+				break;
+			case 'n':
+				g_top = (size_t)atoi(optarg);
+				break;
+			case 'h':
+				print_help(argv[0]);
+				return 0;
+			default:
+				print_help(argv[0]);
+				return 1;
+		}
+	}
+
+	if (argc - optind != 1) {
+		print_help(argv[0]);
+		return 1;
+	}
+
+	FILE *stream = fopen(argv[optind], "r");
+
+	if (stream == NULL) {
+		fprintf(stderr, "Cannot open trace file\n");
+		abort();
+	}
+
+	unsigned char buf[TRACE_RECORD_SIZE];
+
+	if (fread(buf, 1, TRACE_HEADER_SIZE, stream) < TRACE_HEADER_SIZE || trace_read_header(buf) != 0) {
+		fprintf(stderr, "Not an x3 trace\n");
+		abort();
+	}
+
+	struct summary s;
+
+	memset(&s, 0, sizeof(s));
+
+	for (size_t n; (n = fread(buf, 1, TRACE_RECORD_SIZE, stream)) > 0; ) {
+		if (n < TRACE_RECORD_SIZE) {
+			fprintf(stderr, "Truncated trace\n");
+			abort();
+		}
+
+		struct trace_record r;
+
+		trace_read_record(&r, buf);
+		add_record(&s, &r);
+	}
+
+	fclose(stream);
+
+	print_summary(&s);
+
+	free(s.regions);
+	free(s.tags);
+	free(s.last_use);
+
+	return 0;
+}